@@ -0,0 +1,183 @@
+#include "EnrichableAnalyzerSubprocess.h"
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames sent before counting, so that buffers, rings and the caller's
+// vectors have grown to their working size
+#define BENCHMARK_WARMUP_FRAMES 2000
+#define BENCHMARK_FRAMES 10000
+// Marker requests kept in flight by the pipelined run
+#define BENCHMARK_PIPELINE_DEPTH 64
+#define BENCHMARK_STUB_ARGUMENT "--stub-script"
+
+// Every allocation made by the process is counted, including those of
+// the standard library on this side of the pipe.
+static std::atomic<U64> allocations(0);
+
+void* operator new(size_t size) {
+	allocations++;
+	void* allocation = malloc(size ? size : 1);
+	if(allocation == NULL) {
+		throw std::bad_alloc();
+	}
+	return allocation;
+}
+
+void operator delete(void* allocation) noexcept {
+	free(allocation);
+}
+
+void operator delete(void* allocation, size_t) noexcept {
+	free(allocation);
+}
+
+// The script the benchmark enriches against: two markers for every
+// marker request, and a short answer to everything else.  Negotiation
+// falls back to the default of every message type enabled.
+static int RunStubScript() {
+	char line[4096];
+	while(fgets(line, sizeof(line), stdin) != NULL) {
+		if(!strncmp(line, MARKER_PREFIX "\t", strlen(MARKER_PREFIX) + 1)) {
+			fputs("0\tsda\tDownArrow\n3\tsda\tStop\n\n", stdout);
+		} else if(!strncmp(line, BUBBLE_PREFIX "\t", strlen(BUBBLE_PREFIX) + 1)) {
+			fputs("b\nbubble text\n\n", stdout);
+		} else if(!strncmp(line, TABULAR_PREFIX "\t", strlen(TABULAR_PREFIX) + 1)) {
+			fputs("t\n\n", stdout);
+		} else {
+			fputs("\n", stdout);
+		}
+		fflush(stdout);
+	}
+	return 0;
+}
+
+static void FillFrame(Frame& frame, U64 frameIndex) {
+	frame.mStartingSampleInclusive = frameIndex * 100;
+	frame.mEndingSampleInclusive = frameIndex * 100 + 99;
+	frame.mType = 0;
+	frame.mFlags = 0;
+	frame.mData1 = frameIndex & 0xFF;
+	frame.mData2 = 0;
+}
+
+// Sends count marker requests from firstFrame, keeping up to depth in
+// flight, and reads every reply.
+static void RunMarkers(EnrichableAnalyzerSubprocess& subprocess, U64 firstFrame, U64 count, U32 depth, std::vector<EnrichableAnalyzerSubprocess::Marker>& markers) {
+	Frame frame;
+	for(U64 frameIndex = firstFrame; frameIndex < firstFrame + count; frameIndex++) {
+		FillFrame(frame, frameIndex);
+		if(depth <= 1) {
+			subprocess.EmitMarker(0, frameIndex, frame, 9, markers);
+			continue;
+		}
+		subprocess.SendMarker(0, frameIndex, frame, 9);
+		if(subprocess.OutstandingMarkerCount() >= depth) {
+			subprocess.ReceiveMarker(markers);
+		}
+	}
+	while(subprocess.OutstandingMarkerCount() > 0) {
+		subprocess.ReceiveMarker(markers);
+	}
+}
+
+static void RunBubbles(EnrichableAnalyzerSubprocess& subprocess, U64 firstFrame, U64 count) {
+	Frame frame;
+	for(U64 frameIndex = firstFrame; frameIndex < firstFrame + count; frameIndex++) {
+		FillFrame(frame, frameIndex);
+		subprocess.EmitBubble(0, frameIndex, frame, "sda");
+	}
+}
+
+static void RunTabular(EnrichableAnalyzerSubprocess& subprocess, U64 firstFrame, U64 count) {
+	Frame frame;
+	for(U64 frameIndex = firstFrame; frameIndex < firstFrame + count; frameIndex++) {
+		FillFrame(frame, frameIndex);
+		subprocess.EmitTabular(0, frameIndex, frame);
+	}
+}
+
+static double Report(const char* name, U64 before, U64 count, const char* note) {
+	double perFrame = (double)(allocations - before) / count;
+	std::cout << name << ": " << perFrame << " allocations per frame";
+	if(note != NULL) {
+		std::cout << " (" << note << ")";
+	}
+	std::cout << "\n";
+	return perFrame;
+}
+
+// Counts the allocations made per frame by each kind of request,
+// against a stub script that is this program run with
+// BENCHMARK_STUB_ARGUMENT, or against the script given.  Only markers
+// are allocation-free, and the benchmark fails if they allocate at all.
+// Bubbles and tabular text are not: each response is a new vector of
+// strings, allocated as it grows and for every line too long to be held
+// inline, which against the stub script's one- and two-line replies
+// comes to 1 per tabular entry and 2 per bubble.  Those counts are
+// reported, not checked.
+int main(int argc, char** argv) {
+	if(argc == 2 && !strcmp(argv[1], BENCHMARK_STUB_ARGUMENT)) {
+		return RunStubScript();
+	}
+
+	std::string command;
+	if(argc == 2) {
+		command = argv[1];
+	} else {
+		char self[PATH_MAX];
+		if(realpath(argv[0], self) == NULL) {
+			std::cerr << "Unable to find " << argv[0] << "; give a script to run against instead.\n";
+			return 2;
+		}
+		command = std::string("'") + self + "' " BENCHMARK_STUB_ARGUMENT;
+	}
+
+	EnrichableAnalyzerSubprocess subprocess;
+	subprocess.SetParserCommand(command);
+	subprocess.Start();
+	if(!subprocess.MarkerEnabled()) {
+		std::cerr << "The script did not start, or does not take markers.\n";
+		return 2;
+	}
+
+	std::vector<EnrichableAnalyzerSubprocess::Marker> markers;
+	U64 nextFrame = 0;
+	bool allocated = false;
+	const U32 depths[] = {1, BENCHMARK_PIPELINE_DEPTH};
+	for(U32 depth : depths) {
+		RunMarkers(subprocess, nextFrame, BENCHMARK_WARMUP_FRAMES, depth, markers);
+		nextFrame += BENCHMARK_WARMUP_FRAMES;
+
+		U64 before = allocations;
+		RunMarkers(subprocess, nextFrame, BENCHMARK_FRAMES, depth, markers);
+		nextFrame += BENCHMARK_FRAMES;
+		allocated |= Report(depth <= 1 ? "markers" : "markers, pipelined", before, BENCHMARK_FRAMES, NULL) > 0;
+	}
+
+	// Fresh frames every time, so that none is answered from the cache
+	RunBubbles(subprocess, nextFrame, BENCHMARK_WARMUP_FRAMES);
+	nextFrame += BENCHMARK_WARMUP_FRAMES;
+	U64 before = allocations;
+	RunBubbles(subprocess, nextFrame, BENCHMARK_FRAMES);
+	nextFrame += BENCHMARK_FRAMES;
+	Report("bubbles", before, BENCHMARK_FRAMES, "owned responses; not expected to be zero");
+
+	RunTabular(subprocess, nextFrame, BENCHMARK_WARMUP_FRAMES);
+	nextFrame += BENCHMARK_WARMUP_FRAMES;
+	before = allocations;
+	RunTabular(subprocess, nextFrame, BENCHMARK_FRAMES);
+	nextFrame += BENCHMARK_FRAMES;
+	Report("tabular", before, BENCHMARK_FRAMES, "owned responses; not expected to be zero");
+
+	subprocess.Stop();
+	return allocated ? 1 : 0;
+}
@@ -6,27 +6,25 @@
 #include <mutex>
 
 #include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <errno.h>
-#include <wordexp.h>
-
-std::mutex subprocessLock;
 
 EnrichableAnalyzerSubprocess::EnrichableAnalyzerSubprocess():
 	enabled(false),
+	draining(false),
 	featureMarker(true),
 	featureBubble(true),
 	featureTabular(true),
-	parserCommand("")
+	parserCommand(""),
+	nextWorker(0),
+	taggedStopping(false)
 {
+	subscribedAddresses.set();
 }
 
 EnrichableAnalyzerSubprocess::~EnrichableAnalyzerSubprocess()
 {
+	Stop();
 }
 
 std::vector<EnrichableAnalyzerSubprocess::Marker> EnrichableAnalyzerSubprocess::EmitMarker(
@@ -37,260 +35,2312 @@ std::vector<EnrichableAnalyzerSubprocess::Marker> EnrichableAnalyzerSubprocess::
 ) {
 	std::vector<EnrichableAnalyzerSubprocess::Marker> markers;
 
+	EmitMarker(packetId, frameIndex, frame, sampleCount, markers);
+
+	return markers;
+}
+
+void EnrichableAnalyzerSubprocess::EmitMarker(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount,
+	std::vector<Marker>& markers
+) {
+	markers.clear();
+
 	if(! (enabled && featureMarker)) {
-		return markers;
+		return;
 	}
 
-	std::stringstream outputStream;
+	SendMarker(packetId, frameIndex, frame, sampleCount);
+	ReceiveMarker(markers);
+}
 
-	outputStream << MARKER_PREFIX;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << packetId;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frameIndex;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << sampleCount;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mStartingSampleInclusive;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mEndingSampleInclusive;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mType;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mFlags;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mData1;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mData2;
-	outputStream << LINE_SEPARATOR;
+void EnrichableAnalyzerSubprocess::SendMarker(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount
+) {
+	if(! (enabled && featureMarker)) {
+		return;
+	}
+
+	if(plugin.IsLoaded()) {
+		// Answered at once; the reply waits in the queue like any other
+		// so that ReceiveMarker returns replies in order.
+		OutstandingRequest& outstanding = PushOutstandingRequest();
+		outstanding.messageType = BINARY_MARKER;
+		outstanding.awaitingReply = false;
+		GetPluginMarkers(packetId, frameIndex, frame, sampleCount, outstanding.markers);
+		return;
+	}
+
+	// Markers are applied in decode order, so they all go to the same
+	// worker regardless of the pool's dispatch policy.
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+	EnrichableRequestEncoder request;
+	FormatMarkerRequest(request, packetId, frameIndex, frame, sampleCount);
+
+	// The request is recorded in a reused slot, which must be filled in
+	// under the lock.
+	worker.Lock();
+	OutstandingRequest& outstanding = PushOutstandingRequest();
+	outstanding.messageType = BINARY_MARKER;
+	outstanding.awaitingReply = true;
+	outstanding.key = GetMemoKey(BINARY_MARKER, frame, sampleCount);
+	outstanding.frameIndex = frameIndex;
+	outstanding.frame = frame;
+
+	bool persistent = FindPersistentMarkers(frameIndex, frame, sampleCount, outstanding.markers);
+	if(!persistent && featurePure && FindMemo(memoMarkers, outstanding.key, outstanding.markers)) {
+		StorePersistentMarkers(frameIndex, frame, sampleCount, outstanding.markers, markerEntries);
+		persistent = true;
+	}
+	if(persistent) {
+		statistics.RecordCached(BINARY_MARKER);
+		outstanding.awaitingReply = false;
+		worker.Unlock();
+		return;
+	}
 
-	std::string outputValue = outputStream.str();
+	if(featureTagged) {
+		// The reply is read by the worker's reader; ReceiveMarker waits
+		// for it in its turn.
+		U32 tag;
+		SendTaggedRequest(
+			0,
+			BINARY_MARKER,
+			frameIndex,
+			frame,
+			sampleCount,
+			request.GetData(),
+			request.GetLength(),
+			std::chrono::steady_clock::time_point::max(),
+			tag,
+			NULL,
+			&outstanding.reply
+		);
+		worker.Unlock();
+		return;
+	}
 
-	LockSubprocess();
+	outstanding.sent = std::chrono::steady_clock::now();
 	SendOutputLine(
-		outputValue.c_str(),
-		outputValue.length()
+		worker,
+		request.GetData(),
+		request.GetLength()
 	);
-	char markerMessage[256];
-	while(true) {
-		GetInputLine(
-			markerMessage,
-			256
+	statistics.RecordRequest(BINARY_MARKER);
+	pendingRequests++;
+	worker.Unlock();
+}
+
+void EnrichableAnalyzerSubprocess::FormatMarkerRequest(
+	EnrichableRequestEncoder& request,
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount
+) {
+	if(binaryProtocol) {
+		request.AppendBinaryRecord(
+			BINARY_MARKER,
+			packetId,
+			frameIndex,
+			frame,
+			sampleCount
 		);
-		if(strlen(markerMessage) > 0) {
-			char forever[256];
-			strcpy(forever, markerMessage);
-
-			char *sampleNumberStr = strtok(markerMessage, "\t");
-			char *channelStr = strtok(NULL, "\t");
-			char *markerTypeStr = strtok(NULL, "\t");
-
-			if(sampleNumberStr != NULL && channelStr != NULL && markerTypeStr != NULL) {
-				U64 sampleNumber = strtoll(sampleNumberStr, NULL, 16);
-
-				markers.push_back(
-					Marker(
-						sampleNumber,
-						channelStr,
-						GetMarkerType(markerTypeStr, strlen(markerTypeStr))
-					)
-				);
-			} else {
-				std::cerr << "Unable to tokenize marker message input: \"";
-				std::cerr << forever;
-				std::cerr << "\"; input should be three tab-delimited fields: ";
-				std::cerr << "sample_number\tchannel\tmarker_type\n";
-
-				std::cerr << "Disabling analyzer subprocess.\n";
-				enabled = false;
-				return markers;
+		return;
+	}
+
+	request.AppendText(MARKER_PREFIX);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(packetId);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frameIndex);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(sampleCount);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mStartingSampleInclusive);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mEndingSampleInclusive);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mType);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mFlags);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mData1);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mData2);
+	request.AppendCharacter(LINE_SEPARATOR);
+}
+
+bool EnrichableAnalyzerSubprocess::ReceiveMarker(std::vector<Marker>& markers) {
+	markers.clear();
+
+	if(plugin.IsLoaded()) {
+		// Plugin replies are only ever queued by the analysis thread, so
+		// no lock is needed.
+		if(outstandingCount == 0) {
+			return false;
+		}
+		const std::vector<Marker>& received = GetOutstandingRequest(0).markers;
+		markers.assign(received.begin(), received.end());
+		PopOutstandingRequest();
+		return true;
+	}
+	if(workers.empty()) {
+		return false;
+	}
+
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+
+	if(featureTagged) {
+		// The reply is waited for without the lock, which the worker's
+		// other senders need.
+		std::future<std::vector<Marker>> reply;
+
+		worker.Lock();
+		if(outstandingCount == 0) {
+			worker.Unlock();
+			return false;
+		}
+		OutstandingRequest& outstanding = GetOutstandingRequest(0);
+		if(outstanding.awaitingReply) {
+			reply = std::move(outstanding.reply);
+		} else {
+			markers.assign(outstanding.markers.begin(), outstanding.markers.end());
+		}
+		PopOutstandingRequest();
+		worker.Unlock();
+
+		if(reply.valid()) {
+			markers = reply.get();
+		}
+		return true;
+	}
+
+	worker.Lock();
+	CollectDecodeResponses(worker, true);
+	if(outstandingCount == 0) {
+		worker.Unlock();
+		return false;
+	}
+	if(GetOutstandingRequest(0).awaitingReply) {
+		ReadNextMarkerResponse(worker);
+	}
+	// Copied rather than swapped, so that both vectors keep their storage.
+	const std::vector<Marker>& received = GetOutstandingRequest(0).markers;
+	markers.assign(received.begin(), received.end());
+	PopOutstandingRequest();
+	worker.Unlock();
+
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::MarkerResponseReady() {
+	bool ready = false;
+
+	if(plugin.IsLoaded()) {
+		return outstandingCount > 0;
+	}
+	if(workers.empty()) {
+		return false;
+	}
+
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+
+	worker.Lock();
+	for(size_t i = 0; i < outstandingCount; i++) {
+		OutstandingRequest& outstanding = GetOutstandingRequest(i);
+		if(!outstanding.awaitingReply) {
+			if(outstanding.messageType != BINARY_MARKER) {
+				continue;
+			}
+			ready = true;
+		} else if(featureTagged) {
+			ready = outstanding.reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		} else {
+			// A partially-buffered reply counts as ready; the remainder
+			// of it is expected to follow immediately.  Packet and
+			// transaction replies ahead of the marker's are assumed to be
+			// followed by it.
+			ready = worker.HasBufferedInput() || worker.InputReadable(0);
+		}
+		break;
+	}
+	worker.Unlock();
+
+	return ready;
+}
+
+U32 EnrichableAnalyzerSubprocess::OutstandingMarkerCount() {
+	U32 count = 0;
+
+	if(plugin.IsLoaded()) {
+		return outstandingCount;
+	}
+	if(workers.empty()) {
+		return 0;
+	}
+
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+
+	worker.Lock();
+	for(size_t i = 0; i < outstandingCount; i++) {
+		if(GetOutstandingRequest(i).messageType == BINARY_MARKER) {
+			count++;
+		}
+	}
+	worker.Unlock();
+
+	return count;
+}
+
+bool EnrichableAnalyzerSubprocess::ReadNextMarkerResponse(EnrichableAnalyzerWorker& worker) {
+	// Replies fill outstanding requests in the order they were sent,
+	// skipping those already answered from the memo.  Must be called
+	// with the marker worker's lock held.  Returns false if the worker's
+	// deadline passed first; what arrived of the reply is kept, and the
+	// rest is read on the next call.
+	if(!ReadLateResponses(worker)) {
+		return false;
+	}
+
+	for(size_t i = 0; i < outstandingCount; i++) {
+		OutstandingRequest& outstanding = GetOutstandingRequest(i);
+		if(!outstanding.awaitingReply) {
+			continue;
+		}
+
+		bool received;
+		if(outstanding.messageType == BINARY_MARKER) {
+			received = ReadMarkerResponse(worker, outstanding.markers);
+		} else {
+			received = ReadDecodeResponse(worker, outstanding.entries);
+		}
+		if(worker.TimedOut()) {
+			return false;
+		}
+
+		pendingRequests--;
+		outstanding.awaitingReply = false;
+		if(!received) {
+			// The subprocess is gone; no further replies will arrive.
+			for(size_t j = 0; j < outstandingCount; j++) {
+				GetOutstandingRequest(j).awaitingReply = false;
+			}
+			pendingRequests = 0;
+		} else if(outstanding.messageType != BINARY_MARKER) {
+			statistics.RecordResponse(outstanding.messageType, outstanding.sent);
+			if(draining) {
+				return true;
+			}
+
+			std::lock_guard<std::mutex> guard(decodeLock);
+			decodeResponses[GetDecodeKey(outstanding.messageType, outstanding.decodeId)].swap(outstanding.entries);
+		} else {
+			statistics.RecordResponse(BINARY_MARKER, outstanding.sent);
+			if(draining) {
+				return true;
+			}
+			if(featurePure) {
+				StoreMemo(memoMarkers, outstanding.key, outstanding.markers);
+			}
+			StorePersistentMarkers(
+				outstanding.frameIndex,
+				outstanding.frame,
+				outstanding.key.sampleCount,
+				outstanding.markers,
+				markerEntries
+			);
+		}
+		return true;
+	}
+
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::ReadDecodeResponse(
+	EnrichableAnalyzerWorker& worker,
+	std::vector<std::string>& entries
+) {
+	// Must be called with the worker's lock held.
+	const char* entry;
+	size_t length;
+
+	while(GetResponseLine(worker, entry, length)) {
+		entries.emplace_back(entry, length);
+	}
+
+	return enabled;
+}
+
+void EnrichableAnalyzerSubprocess::CollectDecodeResponses(EnrichableAnalyzerWorker& worker, bool wait) {
+	// Retires packet and transaction requests from the front of the
+	// queue, reading their replies if they have arrived (or regardless,
+	// when waiting).  Must be called with the marker worker's lock held.
+	while(outstandingCount > 0) {
+		OutstandingRequest& outstanding = GetOutstandingRequest(0);
+		if(outstanding.messageType == BINARY_MARKER) {
+			break;
+		}
+		if(outstanding.awaitingReply) {
+			if(
+				!wait &&
+				outstandingCount <= DECODE_PIPELINE_LIMIT &&
+				!worker.HasBufferedInput() &&
+				!worker.InputReadable(0)
+			) {
+				break;
 			}
+			if(!ReadNextMarkerResponse(worker)) {
+				break;
+			}
+		}
+		PopOutstandingRequest();
+	}
+}
+
+bool EnrichableAnalyzerSubprocess::ReadMarkerResponse(EnrichableAnalyzerWorker& worker, std::vector<Marker>& markers) {
+	// Must be called with the worker's lock held.  Each reply is parsed
+	// where it lies in the worker's input buffer.
+	const char* markerMessage;
+	size_t length;
+	while(GetResponseLine(worker, markerMessage, length)) {
+		if(!ParseMarkerEntry(markerMessage, length, markers)) {
+			return false;
+		}
+	}
+
+	return enabled;
+}
+
+bool EnrichableAnalyzerSubprocess::ParseMarkerEntry(const char* markerMessage, size_t length, std::vector<Marker>& markers) {
+	if(binaryProtocol) {
+		// Binary marker entries: sample number, marker type, then the
+		// channel name filling the rest of the entry.
+		if(length > 2 && (U8)markerMessage[1] <= AnalyzerResults::Zero) {
+			markers.push_back(
+				Marker(
+					(U8)markerMessage[0],
+					markerMessage + 2,
+					length - 2,
+					(AnalyzerResults::MarkerType)(U8)markerMessage[1]
+				)
+			);
+			return true;
+		}
+
+		std::cerr << "Invalid binary marker entry of length ";
+		std::cerr << length;
+		std::cerr << "; disabling analyzer subprocess.\n";
+		statistics.RecordProtocolError();
+		enabled = false;
+		return false;
+	}
+
+	const char* cursor = markerMessage;
+	const char* end = markerMessage + length;
+	const char* sampleNumberStr;
+	const char* channelStr;
+	const char* markerTypeStr;
+	size_t sampleNumberLength;
+	size_t channelLength;
+	size_t markerTypeLength;
+
+	if(
+		!GetMarkerField(cursor, end, sampleNumberStr, sampleNumberLength) ||
+		!GetMarkerField(cursor, end, channelStr, channelLength) ||
+		!GetMarkerField(cursor, end, markerTypeStr, markerTypeLength)
+	) {
+		std::cerr << "Unable to tokenize marker message input: \"";
+		std::cerr.write(markerMessage, length);
+		std::cerr << "\"; input should be three tab-delimited fields: ";
+		std::cerr << "sample_number\tchannel\tmarker_type\n";
+
+		std::cerr << "Disabling analyzer subprocess.\n";
+		statistics.RecordProtocolError();
+		enabled = false;
+		return false;
+	}
+	markers.push_back(
+		Marker(
+			ParseHex(sampleNumberStr, sampleNumberLength),
+			channelStr,
+			channelLength,
+			GetMarkerType(markerTypeStr, markerTypeLength)
+		)
+	);
+
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::GetMarkerField(
+	const char*& cursor,
+	const char* end,
+	const char*& field,
+	size_t& length
+) {
+	// Fields are split as strtok would split them: runs of separators
+	// count as one, and leading separators are skipped.
+	while(cursor < end && *cursor == UNIT_SEPARATOR) {
+		cursor++;
+	}
+	if(cursor == end) {
+		return false;
+	}
+
+	field = cursor;
+	while(cursor < end && *cursor != UNIT_SEPARATOR) {
+		cursor++;
+	}
+	length = cursor - field;
+
+	return true;
+}
+
+U64 EnrichableAnalyzerSubprocess::ParseHex(const char* buffer, size_t length) {
+	// Accepts what strtoull accepts in base 16: leading spaces, a sign,
+	// an optional "0x", then digits up to the first that is not one.
+	size_t i = 0;
+	bool negative = false;
+
+	while(i < length && (buffer[i] == ' ' || buffer[i] == '\t')) {
+		i++;
+	}
+	if(i < length && (buffer[i] == '+' || buffer[i] == '-')) {
+		negative = buffer[i] == '-';
+		i++;
+	}
+	if(i + 1 < length && buffer[i] == '0' && (buffer[i + 1] == 'x' || buffer[i + 1] == 'X')) {
+		i += 2;
+	}
+
+	U64 value = 0;
+	for(; i < length; i++) {
+		char digit = buffer[i];
+		if(digit >= '0' && digit <= '9') {
+			value = (value << 4) | (U64)(digit - '0');
+		} else if(digit >= 'a' && digit <= 'f') {
+			value = (value << 4) | (U64)(digit - 'a' + 10);
+		} else if(digit >= 'A' && digit <= 'F') {
+			value = (value << 4) | (U64)(digit - 'A' + 10);
 		} else {
 			break;
 		}
 	}
-	UnlockSubprocess();
 
-	return markers;
+	return negative ? (U64)0 - value : value;
+}
+
+bool EnrichableAnalyzerSubprocess::LockWorker(
+	EnrichableAnalyzerWorker& worker,
+	std::chrono::steady_clock::time_point deadline
+) {
+	if(!worker.TryLockUntil(deadline)) {
+		return false;
+	}
+	worker.SetDeadline(deadline);
+
+	// Replies arrive strictly in request order, so any late replies and
+	// marker replies still in flight must be read (and held for whoever
+	// asked for them) before a different request's reply can be.  If
+	// the deadline passes first, nothing new may be sent.
+	if(!ReadLateResponses(worker)) {
+		UnlockWorker(worker);
+		return false;
+	}
+	if(&worker == &GetMarkerWorker()) {
+		while(pendingRequests > 0) {
+			if(!ReadNextMarkerResponse(worker)) {
+				UnlockWorker(worker);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void EnrichableAnalyzerSubprocess::UnlockWorker(EnrichableAnalyzerWorker& worker) {
+	worker.ClearDeadline();
+	worker.Unlock();
+}
+
+bool EnrichableAnalyzerSubprocess::ReadLateResponses(EnrichableAnalyzerWorker& worker) {
+	// Must be called with the worker's lock held.
+	std::deque<LateResponse>& late = lateResponses[GetWorkerIndex(worker)];
+	const char* entry;
+	size_t length;
+
+	while(!late.empty()) {
+		LateResponse& response = late.front();
+		while(GetResponseLine(worker, entry, length)) {
+			response.entries.emplace_back(entry, length);
+		}
+		if(worker.TimedOut()) {
+			return false;
+		}
+		if(enabled && !draining) {
+			CompleteLateResponse(response);
+		}
+		late.pop_front();
+	}
+
+	return true;
+}
+
+void EnrichableAnalyzerSubprocess::CompleteLateResponse(LateResponse& late) {
+	statistics.RecordResponse(late.messageType, late.sent);
+	if(featurePure) {
+		StoreMemo(memoResponses, GetMemoKey(late.messageType, late.frame, 0), late.entries);
+	}
+	if(enabled) {
+		persistentCache.Store(late.messageType, late.frameIndex, late.frame, 0, late.entries);
+	}
+
+	std::lock_guard<std::mutex> guard(completedLock);
+	if(completedResponses.size() >= LATE_RESPONSE_LIMIT) {
+		completedResponses.clear();
+	}
+	completedResponses[(late.frameIndex << 2) | late.messageType].swap(late.entries);
+}
+
+bool EnrichableAnalyzerSubprocess::TakeCompletedResponse(
+	U32 messageType,
+	U64 frameIndex,
+	std::vector<std::string>& response
+) {
+	std::lock_guard<std::mutex> guard(completedLock);
+
+	std::unordered_map<U64, std::vector<std::string>>::iterator completed =
+		completedResponses.find((frameIndex << 2) | messageType);
+	if(completed == completedResponses.end()) {
+		return false;
+	}
+	response.swap(completed->second);
+	completedResponses.erase(completed);
+
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::SendTaggedRequest(
+	size_t workerIndex,
+	U32 messageType,
+	U64 id,
+	Frame& frame,
+	U32 sampleCount,
+	const char* request,
+	size_t requestLength,
+	std::chrono::steady_clock::time_point deadline,
+	U32& tag,
+	std::future<std::vector<std::string>>* response,
+	std::future<std::vector<Marker>>* markers
+) {
+	EnrichableAnalyzerWorker& worker = *workers[workerIndex];
+	std::unique_lock<std::mutex> guard(taggedLock);
+
+	// The request is recorded before it is sent, so that its reply finds
+	// it however soon it arrives.
+	auto room = [this, workerIndex] {
+		return taggedRequests.size() < TAGGED_REQUEST_LIMIT || !taggedReading[workerIndex];
+	};
+	if(deadline == std::chrono::steady_clock::time_point::max()) {
+		taggedDone.wait(guard, room);
+	} else if(!taggedDone.wait_until(guard, deadline, room)) {
+		statistics.RecordLate(messageType);
+		return false;
+	}
+
+	do {
+		tag = ++nextTag;
+	} while(tag == 0 || taggedRequests.count(tag) > 0);
+	TaggedRequest& tagged = taggedRequests[tag];
+	tagged.messageType = messageType;
+	tagged.workerIndex = workerIndex;
+	tagged.id = id;
+	tagged.frame = frame;
+	tagged.key = GetMemoKey(messageType, frame, sampleCount);
+	tagged.late = false;
+	tagged.sent = std::chrono::steady_clock::now();
+	if(response != NULL) {
+		*response = tagged.response.get_future();
+	}
+	if(markers != NULL) {
+		*markers = tagged.markers.get_future();
+	}
+
+	// Nothing more will be read from a script whose reader has stopped.
+	if(!taggedReading[workerIndex]) {
+		tagged.response.set_value(std::vector<std::string>());
+		tagged.markers.set_value(std::vector<Marker>());
+		taggedRequests.erase(tag);
+		return true;
+	}
+	guard.unlock();
+
+	// Text requests are prefixed with their tag; binary records carry it
+	// in otherwise unused bytes.  Packet and transaction requests too
+	// long for the encoder are sent in two parts.
+	EnrichableRequestEncoder framed;
+	size_t head = requestLength;
+	if(binaryProtocol) {
+		if(head > BINARY_RECORD_SIZE) {
+			head = BINARY_RECORD_SIZE;
+		}
+	} else {
+		framed.AppendHex(tag);
+		framed.AppendCharacter(UNIT_SEPARATOR);
+		if(framed.GetLength() + head > REQUEST_BUFFER_SIZE) {
+			head = 0;
+		}
+	}
+	framed.AppendText(request, head);
+	if(binaryProtocol) {
+		framed.SetU32(BINARY_TAG_OFFSET, tag);
+	}
+
+	SendOutputLine(worker, framed.GetData(), framed.GetLength());
+	if(head < requestLength) {
+		SendOutputLine(worker, request + head, requestLength - head);
+	}
+	statistics.RecordRequest(messageType);
+
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::ExchangeTaggedRequest(
+	size_t workerIndex,
+	U32 messageType,
+	U64 frameIndex,
+	Frame& frame,
+	const char* request,
+	size_t requestLength,
+	std::chrono::steady_clock::time_point deadline,
+	std::vector<std::string>& response
+) {
+	EnrichableAnalyzerWorker& worker = *workers[workerIndex];
+	std::future<std::vector<std::string>> reply;
+	U32 tag;
+
+	// The lock is held only while the request is written; other threads
+	// may send theirs while this one waits for its reply.
+	if(!worker.TryLockUntil(deadline)) {
+		statistics.RecordLate(messageType);
+		return false;
+	}
+	bool sent = SendTaggedRequest(
+		workerIndex,
+		messageType,
+		frameIndex,
+		frame,
+		0,
+		request,
+		requestLength,
+		deadline,
+		tag,
+		&reply,
+		NULL
+	);
+	worker.Unlock();
+
+	return sent && WaitTaggedResponse(messageType, tag, reply, deadline, response);
+}
+
+bool EnrichableAnalyzerSubprocess::WaitTaggedResponse(
+	U32 messageType,
+	U32 tag,
+	std::future<std::vector<std::string>>& reply,
+	std::chrono::steady_clock::time_point deadline,
+	std::vector<std::string>& response
+) {
+	if(
+		deadline != std::chrono::steady_clock::time_point::max() &&
+		reply.wait_until(deadline) != std::future_status::ready
+	) {
+		// Still unanswered, the reply is kept for when the frame is asked
+		// for again; otherwise it is being completed right now.
+		std::lock_guard<std::mutex> guard(taggedLock);
+		std::unordered_map<U32, TaggedRequest>::iterator found = taggedRequests.find(tag);
+		if(found != taggedRequests.end()) {
+			found->second.late = true;
+			statistics.RecordLate(messageType);
+			return false;
+		}
+	}
+	response = reply.get();
+
+	return true;
+}
+
+void EnrichableAnalyzerSubprocess::EmitTaggedBubbles(
+	std::vector<BubbleRequest>& requests,
+	std::vector<std::vector<std::string>>& responses,
+	const std::string& channelName
+) {
+	// Every request is sent before any reply is waited for, so the
+	// script may work on all of them at once.  The whole batch shares a
+	// single deadline.
+	std::chrono::steady_clock::time_point deadline = GetDeadline(bubbleDeadlineMs);
+	std::vector<U32> tags(requests.size(), 0);
+	std::vector<std::future<std::vector<std::string>>> replies(requests.size());
+	EnrichableRequestEncoder request;
+
+	for(size_t i = 0; i < requests.size(); i++) {
+		if(FindDisplayResponse(BINARY_BUBBLE, requests[i].frameIndex, requests[i].frame, responses[i])) {
+			continue;
+		}
+
+		size_t w = GetDisplayWorkerIndex(requests[i].frameIndex);
+		if(!workers[w]->TryLockUntil(deadline)) {
+			statistics.RecordLate(BINARY_BUBBLE);
+			requests[i].late = true;
+			continue;
+		}
+		request.Clear();
+		FormatBubbleRequest(
+			request,
+			requests[i].packetId,
+			requests[i].frameIndex,
+			requests[i].frame,
+			channelName
+		);
+		requests[i].late = !SendTaggedRequest(
+			w,
+			BINARY_BUBBLE,
+			requests[i].frameIndex,
+			requests[i].frame,
+			0,
+			request.GetData(),
+			request.GetLength(),
+			deadline,
+			tags[i],
+			&replies[i],
+			NULL
+		);
+		workers[w]->Unlock();
+	}
+
+	for(size_t i = 0; i < requests.size(); i++) {
+		if(
+			replies[i].valid() &&
+			!WaitTaggedResponse(BINARY_BUBBLE, tags[i], replies[i], deadline, responses[i])
+		) {
+			requests[i].late = true;
+		}
+	}
+}
+
+bool EnrichableAnalyzerSubprocess::WaitTaggedDecodeResponse(
+	U32 messageType,
+	U64 decodeId,
+	std::chrono::steady_clock::time_point deadline
+) {
+	// Replies are filed in decodeResponses before their requests leave
+	// the table, so once none is left for this id, its reply is there if
+	// the script sent one.
+	std::unique_lock<std::mutex> guard(taggedLock);
+	auto answered = [this, messageType, decodeId] {
+		for(const std::pair<const U32, TaggedRequest>& tagged : taggedRequests) {
+			if(tagged.second.messageType == messageType && tagged.second.id == decodeId) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	if(deadline == std::chrono::steady_clock::time_point::max()) {
+		taggedDone.wait(guard, answered);
+		return true;
+	}
+	return taggedDone.wait_until(guard, deadline, answered);
+}
+
+void EnrichableAnalyzerSubprocess::StartTaggedReaders() {
+	taggedStopping = false;
+	taggedReading.assign(workers.size(), true);
+	for(size_t i = 0; i < workers.size(); i++) {
+		workers[i]->SetConcurrentReader(true);
+		taggedReaders.emplace_back(&EnrichableAnalyzerSubprocess::ReadTaggedResponses, this, i);
+	}
+}
+
+void EnrichableAnalyzerSubprocess::StopTaggedReaders() {
+	taggedStopping = true;
+	for(std::thread& reader : taggedReaders) {
+		reader.join();
+	}
+	taggedReaders.clear();
+	taggedStopping = false;
+
+	std::lock_guard<std::mutex> guard(taggedLock);
+	taggedReading.clear();
+}
+
+void EnrichableAnalyzerSubprocess::ReadTaggedResponses(size_t workerIndex) {
+	// Runs on a thread of its own for each worker, and is the only reader
+	// of its replies.  Each entry is filed under its tag until the end
+	// of its reply arrives.  The worker's deadline is only a poll, so
+	// that the thread notices when it is being stopped.
+	EnrichableAnalyzerWorker& worker = *workers[workerIndex];
+	U32 tag;
+	const char* entry;
+	size_t length;
+	bool complete;
+
+	while(!taggedStopping) {
+		worker.SetDeadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(TAGGED_POLL_MS));
+		if(!GetTaggedEntry(worker, tag, entry, length, complete)) {
+			if(worker.TimedOut()) {
+				continue;
+			}
+			break;
+		}
+
+		std::unique_lock<std::mutex> guard(taggedLock);
+		std::unordered_map<U32, TaggedRequest>::iterator found = taggedRequests.find(tag);
+		if(found == taggedRequests.end() || found->second.workerIndex != workerIndex) {
+			std::cerr << "Ignoring reply with unknown tag " << std::hex << tag << std::dec << "\n";
+			statistics.RecordProtocolError();
+			continue;
+		}
+		if(!complete) {
+			found->second.entries.emplace_back(entry, length);
+			continue;
+		}
+
+		TaggedRequest request = std::move(found->second);
+		if(request.messageType == BINARY_PACKET || request.messageType == BINARY_TRANSACTION) {
+			std::lock_guard<std::mutex> decodeGuard(decodeLock);
+			decodeResponses[GetDecodeKey(request.messageType, request.id)].swap(request.entries);
+		}
+		taggedRequests.erase(found);
+		guard.unlock();
+
+		CompleteTaggedRequest(request);
+		taggedDone.notify_all();
+	}
+	worker.ClearDeadline();
+
+	// Whatever is still waiting on this worker is completed empty, as if
+	// the script had replied with nothing.
+	std::vector<TaggedRequest> abandoned;
+	{
+		std::lock_guard<std::mutex> guard(taggedLock);
+		taggedReading[workerIndex] = false;
+		std::unordered_map<U32, TaggedRequest>::iterator tagged = taggedRequests.begin();
+		while(tagged != taggedRequests.end()) {
+			if(tagged->second.workerIndex == workerIndex) {
+				abandoned.push_back(std::move(tagged->second));
+				tagged = taggedRequests.erase(tagged);
+			} else {
+				tagged++;
+			}
+		}
+	}
+	for(TaggedRequest& request : abandoned) {
+		request.response.set_value(std::vector<std::string>());
+		request.markers.set_value(std::vector<Marker>());
+	}
+	taggedDone.notify_all();
+}
+
+bool EnrichableAnalyzerSubprocess::GetTaggedEntry(
+	EnrichableAnalyzerWorker& worker,
+	U32& tag,
+	const char*& entry,
+	size_t& length,
+	bool& complete
+) {
+	// Binary entries have their tag after their length, and a reply ends
+	// with an entry of length zero.  Text lines begin with their tag and
+	// a tab, and a reply ends with a line holding only its tag.  Nothing
+	// is consumed until the whole entry or line has arrived.
+	if(binaryProtocol) {
+		U8 header[8];
+		if(!worker.PeekInputBytes((char*)header, sizeof(header))) {
+			CheckWorker(worker);
+			return false;
+		}
+		U32 entryLength = DecodeU32(header);
+		if(!worker.PeekInputBytes(NULL, sizeof(header) + entryLength)) {
+			CheckWorker(worker);
+			return false;
+		}
+		tag = DecodeU32(header + 4);
+		entry = worker.GetInputBytes(sizeof(header) + entryLength) + sizeof(header);
+		length = entryLength;
+		complete = entryLength == 0;
+		return true;
+	}
+
+	const char* line;
+	size_t lineLength;
+	while(!worker.GetInputLine(line, lineLength)) {
+		// Stray empty lines are skipped.
+		CheckWorker(worker);
+		if(!worker.IsAlive() || worker.TimedOut()) {
+			return false;
+		}
+	}
+
+	const char* separator = (const char*)memchr(line, UNIT_SEPARATOR, lineLength);
+	complete = separator == NULL;
+	if(complete) {
+		separator = line + lineLength;
+	}
+	tag = (U32)ParseHex(line, separator - line);
+	entry = complete ? separator : separator + 1;
+	length = line + lineLength - entry;
+
+	return true;
+}
+
+void EnrichableAnalyzerSubprocess::CompleteTaggedRequest(TaggedRequest& request) {
+	// Called by the reader without the table's lock, once the request
+	// has left it.
+	statistics.RecordResponse(request.messageType, request.sent);
+
+	if(request.messageType == BINARY_MARKER) {
+		std::vector<Marker> markers;
+		for(const std::string& entry : request.entries) {
+			if(!ParseMarkerEntry(entry.data(), entry.length(), markers)) {
+				markers.clear();
+				break;
+			}
+		}
+		if(enabled && !draining) {
+			std::vector<std::string> entries;
+			if(featurePure) {
+				StoreMemo(memoMarkers, request.key, markers);
+			}
+			StorePersistentMarkers(request.id, request.frame, request.key.sampleCount, markers, entries);
+		}
+		request.markers.set_value(markers);
+		return;
+	}
+	if(request.messageType != BINARY_BUBBLE && request.messageType != BINARY_TABULAR) {
+		return;
+	}
+
+	if(enabled && !draining) {
+		if(featurePure) {
+			StoreMemo(memoResponses, request.key, request.entries);
+		}
+		persistentCache.Store(request.messageType, request.id, request.frame, 0, request.entries);
+	}
+	if(request.late && !draining) {
+		std::lock_guard<std::mutex> guard(completedLock);
+		if(completedResponses.size() >= LATE_RESPONSE_LIMIT) {
+			completedResponses.clear();
+		}
+		completedResponses[(request.id << 2) | request.messageType] = request.entries;
+	}
+	request.response.set_value(std::move(request.entries));
+}
+
+template<typename Response>
+std::future<Response> EnrichableAnalyzerSubprocess::GetReadyFuture(Response response) {
+	std::promise<Response> promise;
+	promise.set_value(std::move(response));
+
+	return promise.get_future();
+}
+
+size_t EnrichableAnalyzerSubprocess::GetWorkerIndex(EnrichableAnalyzerWorker& worker) {
+	for(size_t i = 0; i < workers.size(); i++) {
+		if(workers[i].get() == &worker) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+std::chrono::steady_clock::time_point EnrichableAnalyzerSubprocess::GetDeadline(U32 deadlineMs) {
+	if(deadlineMs == 0) {
+		return std::chrono::steady_clock::time_point::max();
+	}
+	return std::chrono::steady_clock::now() + std::chrono::milliseconds(deadlineMs);
+}
+
+std::vector<std::string> EnrichableAnalyzerSubprocess::EmitBubble(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	std::string channelName,
+	bool* late
+) {
+	std::vector<std::string> bubbles;
+
+	if(late != NULL) {
+		*late = false;
+	}
+	if(! (enabled && featureBubble)) {
+		return bubbles;
+	}
+
+	if(plugin.IsLoaded()) {
+		GetPluginBubbles(packetId, frameIndex, frame, channelName, bubbles);
+		return bubbles;
+	}
+	if(FindDisplayResponse(BINARY_BUBBLE, frameIndex, frame, bubbles)) {
+		return bubbles;
+	}
+
+	EnrichableRequestEncoder request;
+	FormatBubbleRequest(request, packetId, frameIndex, frame, channelName);
+	if(featureTagged) {
+		if(!ExchangeTaggedRequest(
+			GetDisplayWorkerIndex(frameIndex),
+			BINARY_BUBBLE,
+			frameIndex,
+			frame,
+			request.GetData(),
+			request.GetLength(),
+			GetDeadline(bubbleDeadlineMs),
+			bubbles
+		) && late != NULL) {
+			*late = true;
+		}
+		return bubbles;
+	}
+	if(!ExchangeDisplayRequest(
+		GetDisplayWorker(frameIndex),
+		BINARY_BUBBLE,
+		frameIndex,
+		frame,
+		request.GetData(),
+		request.GetLength(),
+		GetDeadline(bubbleDeadlineMs),
+		bubbles
+	) && late != NULL) {
+		*late = true;
+	}
+
+	return bubbles;
+}
+
+bool EnrichableAnalyzerSubprocess::FindDisplayResponse(
+	U32 messageType,
+	U64 frameIndex,
+	Frame& frame,
+	std::vector<std::string>& response
+) {
+	if(persistentCache.Find(messageType, frameIndex, frame, 0, response)) {
+		statistics.RecordCached(messageType);
+		return true;
+	}
+	if(featurePure && FindMemo(memoResponses, GetMemoKey(messageType, frame, 0), response)) {
+		persistentCache.Store(messageType, frameIndex, frame, 0, response);
+		statistics.RecordCached(messageType);
+		return true;
+	}
+	if(TakeCompletedResponse(messageType, frameIndex, response)) {
+		statistics.RecordCached(messageType);
+		return true;
+	}
+
+	return false;
+}
+
+bool EnrichableAnalyzerSubprocess::ExchangeDisplayRequest(
+	EnrichableAnalyzerWorker& worker,
+	U32 messageType,
+	U64 frameIndex,
+	Frame& frame,
+	const char* request,
+	size_t requestLength,
+	std::chrono::steady_clock::time_point deadline,
+	std::vector<std::string>& response
+) {
+	bool ready = LockWorker(worker, deadline);
+
+	// Our own earlier, late request may be among those just read.
+	if(TakeCompletedResponse(messageType, frameIndex, response)) {
+		if(ready) {
+			UnlockWorker(worker);
+		}
+		statistics.RecordCached(messageType);
+		return true;
+	}
+	if(!ready) {
+		statistics.RecordLate(messageType);
+		return false;
+	}
+
+	std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	SendOutputLine(worker, request, requestLength);
+	statistics.RecordRequest(messageType);
+	const char* entry;
+	size_t length;
+	while(GetResponseLine(worker, entry, length)) {
+		response.emplace_back(entry, length);
+	}
+
+	if(worker.TimedOut()) {
+		LateResponse late;
+		late.messageType = messageType;
+		late.frameIndex = frameIndex;
+		late.frame = frame;
+		late.entries.swap(response);
+		late.sent = sent;
+		lateResponses[GetWorkerIndex(worker)].push_back(late);
+		UnlockWorker(worker);
+		statistics.RecordLate(messageType);
+		return false;
+	}
+	UnlockWorker(worker);
+	statistics.RecordResponse(messageType, sent);
+
+	if(enabled) {
+		if(featurePure) {
+			StoreMemo(memoResponses, GetMemoKey(messageType, frame, 0), response);
+		}
+		persistentCache.Store(messageType, frameIndex, frame, 0, response);
+	}
+
+	return true;
+}
+
+void EnrichableAnalyzerSubprocess::EmitBubbles(
+	std::vector<BubbleRequest>& requests,
+	std::vector<std::vector<std::string>>& responses,
+	std::string channelName
+) {
+	responses.clear();
+	responses.resize(requests.size());
+	for(BubbleRequest& request : requests) {
+		request.late = false;
+	}
+
+	if(! (enabled && featureBubble)) {
+		return;
+	}
+
+	if(plugin.IsLoaded()) {
+		for(size_t i = 0; i < requests.size(); i++) {
+			GetPluginBubbles(
+				requests[i].packetId,
+				requests[i].frameIndex,
+				requests[i].frame,
+				channelName,
+				responses[i]
+			);
+		}
+		return;
+	}
+	if(featureTagged) {
+		EmitTaggedBubbles(requests, responses, channelName);
+		return;
+	}
+
+	std::vector<size_t> assignments(requests.size(), workers.size());
+	std::vector<bool> assigned(workers.size(), false);
+	for(size_t i = 0; i < requests.size(); i++) {
+		if(FindDisplayResponse(BINARY_BUBBLE, requests[i].frameIndex, requests[i].frame, responses[i])) {
+			continue;
+		}
+		assignments[i] = GetDisplayWorkerIndex(requests[i].frameIndex);
+		assigned[assignments[i]] = true;
+	}
+
+	// Workers are always locked in index order so that concurrent
+	// batches cannot deadlock against one another.  The whole batch
+	// shares a single deadline.
+	std::chrono::steady_clock::time_point deadline = GetDeadline(bubbleDeadlineMs);
+	std::vector<bool> locked(workers.size(), false);
+	for(size_t w = 0; w < workers.size(); w++) {
+		if(assigned[w]) {
+			locked[w] = LockWorker(*workers[w], deadline);
+		}
+	}
+
+	// Locking may have read late responses to some of these requests;
+	// only the rest are sent.  Each worker's share of the batch is
+	// written at once before any replies are read, so the whole batch
+	// costs a single round trip and the workers process their shares
+	// concurrently.
+	std::vector<std::string> batches(workers.size());
+	EnrichableRequestEncoder request;
+	for(size_t i = 0; i < requests.size(); i++) {
+		size_t w = assignments[i];
+		if(w == workers.size()) {
+			continue;
+		}
+		if(TakeCompletedResponse(BINARY_BUBBLE, requests[i].frameIndex, responses[i])) {
+			statistics.RecordCached(BINARY_BUBBLE);
+			assignments[i] = workers.size();
+		} else if(!locked[w]) {
+			statistics.RecordLate(BINARY_BUBBLE);
+			requests[i].late = true;
+			assignments[i] = workers.size();
+		} else {
+			statistics.RecordRequest(BINARY_BUBBLE);
+			request.Clear();
+			FormatBubbleRequest(
+				request,
+				requests[i].packetId,
+				requests[i].frameIndex,
+				requests[i].frame,
+				channelName
+			);
+			batches[w].append(request.GetData(), request.GetLength());
+		}
+	}
+	std::vector<std::chrono::steady_clock::time_point> sent(workers.size());
+	for(size_t w = 0; w < workers.size(); w++) {
+		if(!batches[w].empty()) {
+			sent[w] = std::chrono::steady_clock::now();
+			SendOutputLine(*workers[w], batches[w].c_str(), batches[w].length());
+		}
+	}
+
+	const char* bubbleText;
+	size_t bubbleLength;
+	for(size_t i = 0; i < requests.size(); i++) {
+		size_t w = assignments[i];
+		if(w == workers.size()) {
+			continue;
+		}
+
+		if(!workers[w]->TimedOut()) {
+			while(GetResponseLine(*workers[w], bubbleText, bubbleLength)) {
+				responses[i].emplace_back(bubbleText, bubbleLength);
+			}
+		}
+		if(workers[w]->TimedOut()) {
+			// This and every later response from the same worker is read
+			// once the script catches up.
+			LateResponse late;
+			late.messageType = BINARY_BUBBLE;
+			late.frameIndex = requests[i].frameIndex;
+			late.frame = requests[i].frame;
+			late.entries.swap(responses[i]);
+			late.sent = sent[w];
+			lateResponses[w].push_back(late);
+			requests[i].late = true;
+			statistics.RecordLate(BINARY_BUBBLE);
+			continue;
+		}
+		statistics.RecordResponse(BINARY_BUBBLE, sent[w]);
+
+		if(enabled) {
+			if(featurePure) {
+				StoreMemo(memoResponses, GetMemoKey(BINARY_BUBBLE, requests[i].frame, 0), responses[i]);
+			}
+			persistentCache.Store(BINARY_BUBBLE, requests[i].frameIndex, requests[i].frame, 0, responses[i]);
+		}
+	}
+	for(size_t w = 0; w < workers.size(); w++) {
+		if(locked[w]) {
+			UnlockWorker(*workers[w]);
+		}
+	}
+}
+
+void EnrichableAnalyzerSubprocess::FormatBubbleRequest(
+	EnrichableRequestEncoder& request,
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	const std::string& channelName
+) {
+	if(binaryProtocol) {
+		request.AppendBinaryRecord(BINARY_BUBBLE, packetId, frameIndex, frame, 0);
+		return;
+	}
+
+	request.AppendText(BUBBLE_PREFIX);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(packetId);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frameIndex);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mStartingSampleInclusive);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mEndingSampleInclusive);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mType);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mFlags);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendText(channelName.c_str(), channelName.length());
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mData1);
+	request.AppendCharacter(LINE_SEPARATOR);
+}
+
+std::vector<std::string> EnrichableAnalyzerSubprocess::EmitTabular(U64 packetId, U64 frameIndex, Frame& frame, bool* late) {
+	std::vector<std::string> lines;
+
+	if(late != NULL) {
+		*late = false;
+	}
+	if(! (enabled && featureTabular)) {
+		return lines;
+	}
+
+	if(plugin.IsLoaded()) {
+		GetPluginTabular(packetId, frameIndex, frame, lines);
+		return lines;
+	}
+	if(FindDisplayResponse(BINARY_TABULAR, frameIndex, frame, lines)) {
+		return lines;
+	}
+
+	EnrichableRequestEncoder request;
+	FormatTabularRequest(request, packetId, frameIndex, frame);
+	if(featureTagged) {
+		if(!ExchangeTaggedRequest(
+			GetDisplayWorkerIndex(frameIndex),
+			BINARY_TABULAR,
+			frameIndex,
+			frame,
+			request.GetData(),
+			request.GetLength(),
+			GetDeadline(tabularDeadlineMs),
+			lines
+		) && late != NULL) {
+			*late = true;
+		}
+		return lines;
+	}
+	if(!ExchangeDisplayRequest(
+		GetDisplayWorker(frameIndex),
+		BINARY_TABULAR,
+		frameIndex,
+		frame,
+		request.GetData(),
+		request.GetLength(),
+		GetDeadline(tabularDeadlineMs),
+		lines
+	) && late != NULL) {
+		*late = true;
+	}
+
+	return lines;
+}
+
+void EnrichableAnalyzerSubprocess::FormatTabularRequest(
+	EnrichableRequestEncoder& request,
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame
+) {
+	if(binaryProtocol) {
+		request.AppendBinaryRecord(BINARY_TABULAR, packetId, frameIndex, frame, 0);
+		return;
+	}
+
+	request.AppendText(TABULAR_PREFIX);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(packetId);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frameIndex);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mStartingSampleInclusive);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mEndingSampleInclusive);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mType);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mFlags);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mData1);
+	request.AppendCharacter(UNIT_SEPARATOR);
+	request.AppendHex(frame.mData2);
+	request.AppendCharacter(LINE_SEPARATOR);
+}
+
+std::future<std::vector<EnrichableAnalyzerSubprocess::Marker>> EnrichableAnalyzerSubprocess::EmitMarkerAsync(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount
+) {
+	std::vector<Marker> markers;
+
+	if(! (enabled && featureMarker && featureTagged)) {
+		EmitMarker(packetId, frameIndex, frame, sampleCount, markers);
+		return GetReadyFuture(markers);
+	}
+
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+	EnrichableRequestEncoder request;
+	std::future<std::vector<Marker>> reply;
+	MemoKey key = GetMemoKey(BINARY_MARKER, frame, sampleCount);
+	U32 tag;
+	FormatMarkerRequest(request, packetId, frameIndex, frame, sampleCount);
+
+	worker.Lock();
+	bool persistent = FindPersistentMarkers(frameIndex, frame, sampleCount, markers);
+	if(!persistent && featurePure && FindMemo(memoMarkers, key, markers)) {
+		StorePersistentMarkers(frameIndex, frame, sampleCount, markers, markerEntries);
+		persistent = true;
+	}
+	if(persistent) {
+		statistics.RecordCached(BINARY_MARKER);
+		worker.Unlock();
+		return GetReadyFuture(markers);
+	}
+	SendTaggedRequest(
+		0,
+		BINARY_MARKER,
+		frameIndex,
+		frame,
+		sampleCount,
+		request.GetData(),
+		request.GetLength(),
+		std::chrono::steady_clock::time_point::max(),
+		tag,
+		NULL,
+		&reply
+	);
+	worker.Unlock();
+
+	return reply;
+}
+
+std::future<std::vector<std::string>> EnrichableAnalyzerSubprocess::EmitBubbleAsync(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	std::string channelName
+) {
+	std::vector<std::string> bubbles;
+
+	if(! (enabled && featureBubble && featureTagged)) {
+		return GetReadyFuture(EmitBubble(packetId, frameIndex, frame, channelName));
+	}
+	if(FindDisplayResponse(BINARY_BUBBLE, frameIndex, frame, bubbles)) {
+		return GetReadyFuture(bubbles);
+	}
+
+	EnrichableRequestEncoder request;
+	FormatBubbleRequest(request, packetId, frameIndex, frame, channelName);
+	return SendTaggedDisplayRequest(BINARY_BUBBLE, frameIndex, frame, request);
+}
+
+std::future<std::vector<std::string>> EnrichableAnalyzerSubprocess::EmitTabularAsync(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame
+) {
+	std::vector<std::string> lines;
+
+	if(! (enabled && featureTabular && featureTagged)) {
+		return GetReadyFuture(EmitTabular(packetId, frameIndex, frame));
+	}
+	if(FindDisplayResponse(BINARY_TABULAR, frameIndex, frame, lines)) {
+		return GetReadyFuture(lines);
+	}
+
+	EnrichableRequestEncoder request;
+	FormatTabularRequest(request, packetId, frameIndex, frame);
+	return SendTaggedDisplayRequest(BINARY_TABULAR, frameIndex, frame, request);
+}
+
+std::future<std::vector<std::string>> EnrichableAnalyzerSubprocess::SendTaggedDisplayRequest(
+	U32 messageType,
+	U64 frameIndex,
+	Frame& frame,
+	EnrichableRequestEncoder& request
+) {
+	size_t workerIndex = GetDisplayWorkerIndex(frameIndex);
+	std::future<std::vector<std::string>> reply;
+	U32 tag;
+
+	workers[workerIndex]->Lock();
+	SendTaggedRequest(
+		workerIndex,
+		messageType,
+		frameIndex,
+		frame,
+		0,
+		request.GetData(),
+		request.GetLength(),
+		std::chrono::steady_clock::time_point::max(),
+		tag,
+		&reply,
+		NULL
+	);
+	workers[workerIndex]->Unlock();
+
+	return reply;
+}
+
+void EnrichableAnalyzerSubprocess::SendPacket(
+	U64 packetId,
+	U64 firstFrameIndex,
+	const std::vector<Frame>& frames
+) {
+	if(! (enabled && featurePacket) || frames.empty()) {
+		return;
+	}
+
+	U64 startingSample = frames.front().mStartingSampleInclusive;
+	U64 endingSample = frames.back().mEndingSampleInclusive;
+
+	decodeRequest.clear();
+	if(binaryProtocol) {
+		Frame span;
+		span.mStartingSampleInclusive = startingSample;
+		span.mEndingSampleInclusive = endingSample;
+		span.mType = 0;
+		span.mFlags = 0;
+		span.mData1 = 0;
+		span.mData2 = 0;
+
+		EnrichableRequestEncoder header;
+		header.AppendBinaryRecord(BINARY_PACKET, packetId, firstFrameIndex, span, frames.size());
+		decodeRequest.append(header.GetData(), header.GetLength());
+		for(const Frame& frame : frames) {
+			decodeRequest += (char)frame.mType;
+			decodeRequest += (char)frame.mFlags;
+			decodeRequest += (char)frame.mData1;
+			decodeRequest += '\0';
+		}
+	} else {
+		EnrichableRequestEncoder header;
+		header.AppendText(PACKET_PREFIX);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(packetId);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(firstFrameIndex);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(frames.size());
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(startingSample);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(endingSample);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		decodeRequest.append(header.GetData(), header.GetLength());
+
+		for(const Frame& frame : frames) {
+			AppendHexByte(decodeRequest, frame.mType);
+		}
+		decodeRequest += UNIT_SEPARATOR;
+		for(const Frame& frame : frames) {
+			AppendHexByte(decodeRequest, frame.mFlags);
+		}
+		decodeRequest += UNIT_SEPARATOR;
+		for(const Frame& frame : frames) {
+			AppendHexByte(decodeRequest, (U8)frame.mData1);
+		}
+		decodeRequest += LINE_SEPARATOR;
+	}
+
+	QueueDecodeRequest(BINARY_PACKET, packetId);
+}
+
+void EnrichableAnalyzerSubprocess::SendTransaction(const TransactionRequest& transaction) {
+	if(! (enabled && featureTransaction)) {
+		return;
+	}
+
+	decodeRequest.clear();
+	if(binaryProtocol) {
+		// The register bytes are packed into data1 in the order they were
+		// sent, so that they lie in that order within the record.
+		U64 registerValue = 0;
+		for(U32 i = 0; i < transaction.registerLength && i < 8; i++) {
+			registerValue |= (U64)transaction.registerBytes[i] << (8 * i);
+		}
+
+		Frame span;
+		span.mStartingSampleInclusive = transaction.startingSample;
+		span.mEndingSampleInclusive = transaction.endingSample;
+		span.mType = transaction.address;
+		span.mFlags = transaction.read ? 1 : 0;
+		span.mData1 = registerValue;
+		span.mData2 = transaction.registerLength;
+
+		EnrichableRequestEncoder header;
+		header.AppendBinaryRecord(
+			BINARY_TRANSACTION,
+			transaction.transactionId,
+			transaction.firstFrameIndex,
+			span,
+			transaction.payloadLength
+		);
+		decodeRequest.append(header.GetData(), header.GetLength());
+		decodeRequest.append((const char*)transaction.payload, transaction.payloadLength);
+	} else {
+		EnrichableRequestEncoder header;
+		header.AppendText(TRANSACTION_PREFIX);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(transaction.transactionId);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(transaction.firstFrameIndex);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(transaction.frameCount);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(transaction.startingSample);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(transaction.endingSample);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendHex(transaction.address);
+		header.AppendCharacter(UNIT_SEPARATOR);
+		header.AppendText(transaction.read ? "read" : "write");
+		header.AppendCharacter(UNIT_SEPARATOR);
+		decodeRequest.append(header.GetData(), header.GetLength());
+
+		for(U32 i = 0; i < transaction.registerLength; i++) {
+			AppendHexByte(decodeRequest, transaction.registerBytes[i]);
+		}
+		decodeRequest += UNIT_SEPARATOR;
+		for(U32 i = 0; i < transaction.payloadLength; i++) {
+			AppendHexByte(decodeRequest, transaction.payload[i]);
+		}
+		decodeRequest += LINE_SEPARATOR;
+	}
+
+	QueueDecodeRequest(BINARY_TRANSACTION, transaction.transactionId);
+}
+
+void EnrichableAnalyzerSubprocess::QueueDecodeRequest(U32 messageType, U64 decodeId) {
+	// Sent in decode order alongside markers, so that the script sees
+	// each packet just after the markers of its frames.
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+
+	worker.Lock();
+	if(featureTagged) {
+		// The worker's reader files the reply with the others.
+		Frame span;
+		U32 tag;
+		span.mStartingSampleInclusive = 0;
+		span.mEndingSampleInclusive = 0;
+		span.mType = 0;
+		span.mFlags = 0;
+		span.mData1 = 0;
+		span.mData2 = 0;
+		SendTaggedRequest(
+			0,
+			messageType,
+			decodeId,
+			span,
+			0,
+			decodeRequest.data(),
+			decodeRequest.length(),
+			std::chrono::steady_clock::time_point::max(),
+			tag,
+			NULL,
+			NULL
+		);
+		worker.Unlock();
+		return;
+	}
+	OutstandingRequest& outstanding = PushOutstandingRequest();
+	outstanding.messageType = messageType;
+	outstanding.awaitingReply = true;
+	outstanding.decodeId = decodeId;
+	outstanding.sent = std::chrono::steady_clock::now();
+	SendOutputLine(worker, decodeRequest.data(), decodeRequest.length());
+	statistics.RecordRequest(messageType);
+	pendingRequests++;
+
+	// With no marker requests being collected, nothing else would read
+	// these replies off the pipe.
+	CollectDecodeResponses(worker, false);
+	worker.Unlock();
+}
+
+bool EnrichableAnalyzerSubprocess::GetPacketResponse(U64 packetId, std::vector<std::string>& lines) {
+	lines.clear();
+
+	if(! (enabled && featurePacket)) {
+		return false;
+	}
+
+	return GetDecodeResponse(BINARY_PACKET, packetId, lines);
+}
+
+bool EnrichableAnalyzerSubprocess::GetTransactionResponse(U64 transactionId, std::vector<std::string>& lines) {
+	lines.clear();
+
+	if(! (enabled && featureTransaction)) {
+		return false;
+	}
+
+	return GetDecodeResponse(BINARY_TRANSACTION, transactionId, lines);
+}
+
+bool EnrichableAnalyzerSubprocess::GetDecodeResponse(
+	U32 messageType,
+	U64 decodeId,
+	std::vector<std::string>& lines
+) {
+	if(workers.empty()) {
+		return false;
+	}
+	if(FindDecodeResponse(messageType, decodeId, lines)) {
+		return true;
+	}
+
+	if(featureTagged) {
+		if(!WaitTaggedDecodeResponse(messageType, decodeId, GetDeadline(tabularDeadlineMs))) {
+			statistics.RecordLate(messageType);
+		}
+		return FindDecodeResponse(messageType, decodeId, lines);
+	}
+
+	// The reply may still be queued behind others the analysis thread
+	// has not collected yet; locking the worker reads them all.
+	EnrichableAnalyzerWorker& worker = GetMarkerWorker();
+	if(!LockWorker(worker, GetDeadline(tabularDeadlineMs))) {
+		statistics.RecordLate(messageType);
+		return FindDecodeResponse(messageType, decodeId, lines);
+	}
+	UnlockWorker(worker);
+
+	return FindDecodeResponse(messageType, decodeId, lines);
+}
+
+bool EnrichableAnalyzerSubprocess::FindDecodeResponse(
+	U32 messageType,
+	U64 decodeId,
+	std::vector<std::string>& lines
+) {
+	std::lock_guard<std::mutex> guard(decodeLock);
+
+	std::unordered_map<U64, std::vector<std::string>>::iterator found =
+		decodeResponses.find(GetDecodeKey(messageType, decodeId));
+	if(found == decodeResponses.end()) {
+		return false;
+	}
+	lines = found->second;
+
+	return true;
+}
+
+U64 EnrichableAnalyzerSubprocess::GetDecodeKey(U32 messageType, U64 decodeId) {
+	return (decodeId << 1) | (messageType == BINARY_TRANSACTION ? 1 : 0);
+}
+
+void EnrichableAnalyzerSubprocess::AppendHexByte(std::string& request, U8 value) {
+	static const char digits[] = "0123456789abcdef";
+
+	request += digits[value >> 4];
+	request += digits[value & 0xF];
+}
+
+bool EnrichableAnalyzerSubprocess::Subscribes(U8 address, const Frame& frame) {
+	return SubscribesAddress(address) &&
+		frame.mType < 32 && ((subscribedFrameTypes >> frame.mType) & 1) != 0 &&
+		(frame.mFlags & subscribedFlagsMask) == subscribedFlagsValue;
+}
+
+bool EnrichableAnalyzerSubprocess::SubscribesAddress(U8 address) {
+	return address >= subscribedAddresses.size() || subscribedAddresses.test(address);
+}
+
+bool EnrichableAnalyzerSubprocess::FiltersAddresses() {
+	return !subscribedAddresses.all();
+}
+
+bool EnrichableAnalyzerSubprocess::MarkerEnabled() {
+	return featureMarker;
+}
+
+bool EnrichableAnalyzerSubprocess::BubbleEnabled() {
+	return featureBubble;
+}
+
+bool EnrichableAnalyzerSubprocess::TabularEnabled() {
+	return featureTabular;
+}
+
+bool EnrichableAnalyzerSubprocess::PacketEnabled() {
+	return featurePacket;
+}
+
+bool EnrichableAnalyzerSubprocess::TransactionEnabled() {
+	return featureTransaction;
+}
+
+void EnrichableAnalyzerSubprocess::SetParserCommand(std::string cmd) {
+	parserCommand = cmd;
+	enabled = true;
+}
+
+void EnrichableAnalyzerSubprocess::SetPoolSize(U32 size) {
+	poolSize = size > 0 ? size : 1;
+}
+
+void EnrichableAnalyzerSubprocess::SetPoolDispatch(PoolDispatch dispatch) {
+	poolDispatch = dispatch;
+}
+
+void EnrichableAnalyzerSubprocess::SetDedicatedMarkerWorker(bool dedicated) {
+	dedicatedMarkerWorker = dedicated;
+}
+
+void EnrichableAnalyzerSubprocess::SetDeadlines(U32 bubbleMs, U32 tabularMs) {
+	bubbleDeadlineMs = bubbleMs;
+	tabularDeadlineMs = tabularMs;
+}
+
+void EnrichableAnalyzerSubprocess::SetSharedMemoryTransport(bool sharedMemory) {
+	sharedMemoryTransport = sharedMemory;
+}
+
+void EnrichableAnalyzerSubprocess::SetPersistentCache(const std::string& directory, U32 sampleRate) {
+	persistentCacheDirectory = directory;
+	persistentCacheSampleRate = sampleRate;
+}
+
+void EnrichableAnalyzerSubprocess::AddCaptureFrame(const Frame& frame) {
+	persistentCache.AddCaptureFrame(frame);
+}
+
+void EnrichableAnalyzerSubprocess::GetPluginBubbles(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	const std::string& channelName,
+	std::vector<std::string>& bubbles
+) {
+	enrichable_frame pluginFrame;
+	EnrichablePlugin::GetFrame(packetId, frameIndex, frame, 0, pluginFrame);
+
+	std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	statistics.RecordRequest(BINARY_BUBBLE);
+	plugin.Bubble(pluginFrame, channelName.c_str(), bubbles);
+	statistics.RecordResponse(BINARY_BUBBLE, sent);
+}
+
+void EnrichableAnalyzerSubprocess::GetPluginTabular(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	std::vector<std::string>& lines
+) {
+	enrichable_frame pluginFrame;
+	EnrichablePlugin::GetFrame(packetId, frameIndex, frame, 0, pluginFrame);
+
+	std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	statistics.RecordRequest(BINARY_TABULAR);
+	plugin.Tabular(pluginFrame, lines);
+	statistics.RecordResponse(BINARY_TABULAR, sent);
+}
+
+void EnrichableAnalyzerSubprocess::GetPluginMarkers(
+	U64 packetId,
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount,
+	std::vector<Marker>& markers
+) {
+	enrichable_frame pluginFrame;
+	EnrichablePlugin::GetFrame(packetId, frameIndex, frame, sampleCount, pluginFrame);
+
+	std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	statistics.RecordRequest(BINARY_MARKER);
+	size_t count = plugin.Marker(pluginFrame, pluginMarkers);
+	statistics.RecordResponse(BINARY_MARKER, sent);
+
+	markers.clear();
+	for(size_t i = 0; i < count; i++) {
+		const enrichable_marker& pluginMarker = pluginMarkers[i];
+		if(pluginMarker.marker_type > AnalyzerResults::Zero) {
+			std::cerr << "Invalid plugin marker type ";
+			std::cerr << (U32)pluginMarker.marker_type;
+			std::cerr << "; ignoring.\n";
+			statistics.RecordProtocolError();
+			continue;
+		}
+		markers.push_back(
+			Marker(
+				pluginMarker.sample_number,
+				pluginMarker.channel,
+				strnlen(pluginMarker.channel, sizeof(pluginMarker.channel)),
+				(AnalyzerResults::MarkerType)pluginMarker.marker_type
+			)
+		);
+	}
+}
+
+bool EnrichableAnalyzerSubprocess::FindPersistentMarkers(
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount,
+	std::vector<Marker>& markers
+) {
+	// Markers are stored in the binary protocol's entry layout: sample
+	// number, marker type, then the channel name.  Must be called with
+	// the marker worker's lock held.
+	if(!persistentCache.Find(BINARY_MARKER, frameIndex, frame, sampleCount, markerEntries)) {
+		return false;
+	}
+
+	markers.clear();
+	for(const std::string& entry : markerEntries) {
+		if(entry.length() < 2 || (U8)entry[1] > AnalyzerResults::Zero) {
+			markers.clear();
+			return false;
+		}
+		markers.push_back(
+			Marker(
+				(U8)entry[0],
+				entry.data() + 2,
+				entry.length() - 2,
+				(AnalyzerResults::MarkerType)(U8)entry[1]
+			)
+		);
+	}
+
+	return true;
 }
 
-std::vector<std::string> EnrichableAnalyzerSubprocess::EmitBubble(U64 packetId, U64 frameIndex, Frame& frame, std::string channelName) {
-	std::vector<std::string> bubbles;
+void EnrichableAnalyzerSubprocess::StorePersistentMarkers(
+	U64 frameIndex,
+	Frame& frame,
+	U32 sampleCount,
+	const std::vector<Marker>& markers,
+	std::vector<std::string>& entries
+) {
+	// entries is scratch space for their conversion.
+	if(!persistentCache.IsOpen()) {
+		return;
+	}
 
-	if(! (enabled && featureBubble)) {
-		return bubbles;
+	entries.resize(markers.size());
+	for(size_t i = 0; i < markers.size(); i++) {
+		std::string& entry = entries[i];
+		entry.clear();
+		entry += (char)markers[i].sampleNumber;
+		entry += (char)markers[i].markerType;
+		entry += markers[i].channelName;
 	}
+	persistentCache.Store(BINARY_MARKER, frameIndex, frame, sampleCount, entries);
+}
 
-	std::stringstream outputStream;
-	outputStream << BUBBLE_PREFIX;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << packetId;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frameIndex;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mStartingSampleInclusive;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mEndingSampleInclusive;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mType;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mFlags;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << channelName;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mData1;
-	outputStream << LINE_SEPARATOR;
-	std::string value = outputStream.str();
-
-	LockSubprocess();
-	SendOutputLine(value.c_str(), value.length());
-	char bubbleText[256];
-	while(true) {
-		GetInputLine(
-			bubbleText,
-			256
-		);
-		if(strlen(bubbleText) > 0) {
-			bubbles.push_back(bubbleText);
-		} else {
-			break;
+EnrichableAnalyzerSubprocess::OutstandingRequest& EnrichableAnalyzerSubprocess::PushOutstandingRequest() {
+	// Must be called with the marker worker's lock held.  The ring only
+	// grows, so once it has reached the pipeline's depth no request
+	// allocates.
+	if(outstandingCount == outstandingRequests.size()) {
+		std::vector<OutstandingRequest> grown(outstandingRequests.empty() ? 16 : outstandingRequests.size() * 2);
+		for(size_t i = 0; i < outstandingCount; i++) {
+			grown[i] = std::move(GetOutstandingRequest(i));
 		}
+		outstandingRequests.swap(grown);
+		outstandingFirst = 0;
 	}
-	UnlockSubprocess();
 
-	return bubbles;
-}
+	OutstandingRequest& outstanding = outstandingRequests[
+		(outstandingFirst + outstandingCount) % outstandingRequests.size()
+	];
+	outstandingCount++;
+	outstanding.markers.clear();
+	outstanding.entries.clear();
 
-std::vector<std::string> EnrichableAnalyzerSubprocess::EmitTabular(U64 packetId, U64 frameIndex, Frame& frame) {
-	std::vector<std::string> lines;
+	return outstanding;
+}
 
-	if(! (enabled && featureBubble)) {
-		return lines;
-	}
+EnrichableAnalyzerSubprocess::OutstandingRequest& EnrichableAnalyzerSubprocess::GetOutstandingRequest(size_t position) {
+	return outstandingRequests[(outstandingFirst + position) % outstandingRequests.size()];
+}
 
-	std::stringstream outputStream;
+void EnrichableAnalyzerSubprocess::PopOutstandingRequest() {
+	outstandingFirst = (outstandingFirst + 1) % outstandingRequests.size();
+	outstandingCount--;
+}
 
-	outputStream << TABULAR_PREFIX;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << packetId;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frameIndex;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mStartingSampleInclusive;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mEndingSampleInclusive;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mType;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << (U64)frame.mFlags;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mData1;
-	outputStream << UNIT_SEPARATOR;
-	outputStream << std::hex << frame.mData2;
-	outputStream << LINE_SEPARATOR;
+void EnrichableAnalyzerSubprocess::LogContention() {
+	if(workers.empty()) {
+		return;
+	}
 
-	std::string value = outputStream.str();
+	// The analysis channel is the marker worker; every other worker (or
+	// the same one, when it is shared) serves the display.
+	U64 acquisitions[2] = {0, 0};
+	U64 contentions[2] = {0, 0};
+	U64 waitNanoseconds[2] = {0, 0};
+	for(size_t i = 0; i < workers.size(); i++) {
+		size_t channel = (i == 0 && (dedicatedMarkerWorker || workers.size() == 1)) ? 0 : 1;
+		acquisitions[channel] += workers[i]->GetLockAcquisitions();
+		contentions[channel] += workers[i]->GetLockContentions();
+		waitNanoseconds[channel] += workers[i]->GetLockWaitNanoseconds();
+	}
 
-	LockSubprocess();
-	SendOutputLine(value.c_str(), value.length());
-	char tabularText[512];
-	while(true) {
-		GetInputLine(
-			tabularText,
-			512
-		);
-		if(strlen(tabularText) > 0) {
-			lines.push_back(tabularText);
-		} else {
-			break;
+	const char* names[2] = {"analysis", "display"};
+	if(workers.size() == 1) {
+		names[0] = "shared";
+	}
+	for(size_t channel = 0; channel < 2; channel++) {
+		if(acquisitions[channel] == 0) {
+			continue;
 		}
+		std::cerr << "Enrichment " << names[channel] << " channel: ";
+		std::cerr << contentions[channel] << " of " << acquisitions[channel];
+		std::cerr << " lock acquisitions waited, ";
+		std::cerr << (waitNanoseconds[channel] / 1000000) << " ms total\n";
 	}
-	UnlockSubprocess();
-
-	return lines;
 }
 
-bool EnrichableAnalyzerSubprocess::MarkerEnabled() {
-	return featureMarker;
-}
+void EnrichableAnalyzerSubprocess::DumpStatistics() {
+	statistics.Dump(std::cerr);
 
-bool EnrichableAnalyzerSubprocess::BubbleEnabled() {
-	return featureBubble;
-}
+	U64 bytesSent = 0;
+	U64 bytesReceived = 0;
+	for(std::unique_ptr<EnrichableAnalyzerWorker>& worker : workers) {
+		bytesSent += worker->GetBytesSent();
+		bytesReceived += worker->GetBytesReceived();
+	}
+	if(bytesSent + bytesReceived > 0) {
+		std::cerr << "Enrichment traffic: " << bytesSent << " bytes sent, ";
+		std::cerr << bytesReceived << " bytes received\n";
+	}
 
-bool EnrichableAnalyzerSubprocess::TabularEnabled() {
-	return featureTabular;
-}
+	LogContention();
 
-void EnrichableAnalyzerSubprocess::SetParserCommand(std::string cmd) {
-	parserCommand = cmd;
-	enabled = true;
+	if(persistentCache.GetHits() + persistentCache.GetMisses() > 0) {
+		std::cerr << "Enrichment persistent cache: " << persistentCache.GetHits() << " hits, ";
+		std::cerr << persistentCache.GetMisses() << " misses, ";
+		std::cerr << persistentCache.GetRecordCount() << " records\n";
+	}
 }
 
 void EnrichableAnalyzerSubprocess::Start() {
+	bool isPlugin = EnrichablePlugin::IsPluginCommand(parserCommand);
+	U32 workerCount = isPlugin ? 0 : poolSize + (dedicatedMarkerWorker ? 1 : 0);
+
+	// The analysis thread is killed rather than returning, so the last
+	// run is reported here, before this one's figures replace it.
+	if(runningCommand.length()) {
+		DumpStatistics();
+	}
+
+	// Whatever the last run started is kept for this one if it was
+	// started the same way and is still running, so that a script slow
+	// to start is not started again every time the analyzer re-runs.
+	// It has already negotiated its features.
+	draining = true;
+	bool warm = parserCommand.length() &&
+		parserCommand == runningCommand &&
+		workerCount == runningWorkerCount &&
+		sharedMemoryTransport == runningSharedMemory &&
+		DrainWorkers();
+	draining = false;
+
 	if(!parserCommand.length()) {
 		std::cerr << "No parser command defined; aborting subprocess.\n";
 		Terminate();
+		return;
+	} else if(warm) {
+		std::cerr << "Reusing analyzer subprocess: ";
+		std::cerr << parserCommand;
+		std::cerr << "\n";
+	} else if(isPlugin) {
+		std::cerr << "Loading enrichment plugin: ";
+		std::cerr << parserCommand;
+		std::cerr << "\n";
 	} else {
 		std::cerr << "Starting analyzer subprocess: ";
 		std::cerr << parserCommand;
+		if(poolSize > 1) {
+			std::cerr << " (" << poolSize << " copies)";
+		}
 		std::cerr << "\n";
 	}
 
+	{
+		// A warm start keeps the tagged readers, which file late replies
+		// here, and the display may be asking for them.
+		std::lock_guard<std::mutex> guard(completedLock);
+		pendingRequests = 0;
+		outstandingRequests.clear();
+		outstandingFirst = 0;
+		outstandingCount = 0;
+		completedResponses.clear();
+	}
+	{
+		std::lock_guard<std::mutex> guard(decodeLock);
+		decodeResponses.clear();
+	}
+	statistics.Reset();
+	for(std::unique_ptr<EnrichableAnalyzerWorker>& worker : workers) {
+		worker->ResetStatistics();
+	}
+
+	// A pure script's responses depend only on the frames' contents, so
+	// they stay valid for as long as the same script is running.
+	if(!warm) {
+		StopWorkers();
+		memoResponses.clear();
+		memoMarkers.clear();
+		binaryProtocol = false;
+		subscribedAddresses.set();
+		subscribedFrameTypes = 0xFFFFFFFF;
+		subscribedFlagsMask = 0;
+		subscribedFlagsValue = 0;
+
+		if(isPlugin) {
+			if(!plugin.Load(parserCommand)) {
+				Terminate();
+				return;
+			}
+
+			// Plugins are called directly, so none of the message-saving
+			// features apply; a message type is enabled if the plugin both
+			// implements it and does not turn it off.
+			featureBubble = plugin.HasBubble() && plugin.GetFeatureEnablement(BUBBLE_PREFIX);
+			featureMarker = plugin.HasMarker() && plugin.GetFeatureEnablement(MARKER_PREFIX);
+			featureTabular = plugin.HasTabular() && plugin.GetFeatureEnablement(TABULAR_PREFIX);
+			featurePure = false;
+			featurePacket = false;
+			featureTransaction = false;
+			featureTagged = false;
+		} else if(!StartWorkers(workerCount)) {
+			Terminate();
+			return;
+		}
 
-	if(pipe(inpipefd) < 0) {
-		std::cerr << "Failed to create input pipe: ";
-		std::cerr << errno;
-		std::cerr << "\n";
-		Terminate();
+		runningCommand = parserCommand;
+		runningWorkerCount = workerCount;
+		runningSharedMemory = sharedMemoryTransport;
 	}
-	if(pipe(outpipefd) < 0) {
-		std::cerr << "Failed to create output pipe: ";
-		std::cerr << errno;
-		std::cerr << "\n";
-		Terminate();
+
+	if(persistentCacheDirectory.length() && !isPlugin) {
+		persistentCache.Open(persistentCacheDirectory, parserCommand, persistentCacheSampleRate);
+	} else {
+		persistentCache.Close();
 	}
-	std::cerr << "Starting fork...\n";
-	commandPid = fork();
+}
 
-	if(commandPid == 0) {
-		std::cerr << "Forked...\n";
-		if(dup2(outpipefd[0], STDIN_FILENO) < 0) {
-			std::cerr << "Failed to redirect STDIN: ";
-			std::cerr << errno;
-			std::cerr << "\n";
-			exit(errno);
+bool EnrichableAnalyzerSubprocess::StartWorkers(U32 workerCount) {
+	for(U32 i = 0; i < workerCount; i++) {
+		workers.push_back(std::unique_ptr<EnrichableAnalyzerWorker>(new EnrichableAnalyzerWorker()));
+		if(!workers.back()->Start(parserCommand, sharedMemoryTransport)) {
+			return false;
+		}
+	}
+	lateResponses.assign(workers.size(), std::deque<LateResponse>());
+
+	// Every copy of the script goes through the same negotiation; as they
+	// all run the same command, the first copy's answers (negotiated
+	// last) stand for all.
+	for(size_t i = workers.size(); i-- > 0; ) {
+		EnrichableAnalyzerWorker& worker = *workers[i];
+
+		// Scripts written before the capabilities message answer it as
+		// they would any unknown feature; they are asked about each
+		// feature in turn instead.
+		if(!NegotiateCapabilities(worker)) {
+			NegotiateFeatures(worker);
 		}
-		if(dup2(inpipefd[1], STDOUT_FILENO) < 0) {
-			std::cerr << "Failed to redirect STDOUT: ";
-			std::cerr << errno;
-			std::cerr << "\n";
-			exit(errno);
+	}
+	if(featureTagged) {
+		StartTaggedReaders();
+	}
+
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::DrainWorkers() {
+	// Reads, and discards, the replies the last run was still owed, so
+	// the next reply is to this run's first request; with draining set,
+	// none of them reaches the memo, the persistent cache or the
+	// completed responses.  Fails if any copy of the script has exited
+	// or does not answer in time.
+	if(plugin.IsLoaded()) {
+		return true;
+	}
+	if(workers.empty()) {
+		return false;
+	}
+
+	std::chrono::steady_clock::time_point deadline = GetDeadline(RESTART_DRAIN_DEADLINE_MS);
+	if(featureTagged) {
+		// The readers are still running; they need only be waited for.
+		for(std::unique_ptr<EnrichableAnalyzerWorker>& worker : workers) {
+			if(!worker->IsAlive() || worker->HasExited()) {
+				return false;
+			}
 		}
 
-		wordexp_t cmdParsed;
-		char *args[25];
+		std::unique_lock<std::mutex> guard(taggedLock);
+		for(size_t i = 0; i < taggedReading.size(); i++) {
+			if(!taggedReading[i]) {
+				return false;
+			}
+		}
+		return taggedDone.wait_until(guard, deadline, [this] { return taggedRequests.empty(); });
+	}
 
-		wordexp(parserCommand.c_str(), &cmdParsed, 0);
-		int i;
-		for(i = 0; i < cmdParsed.we_wordc; i++) {
-			args[i] = cmdParsed.we_wordv[i];
+	for(std::unique_ptr<EnrichableAnalyzerWorker>& worker : workers) {
+		if(!worker->IsAlive() || worker->HasExited()) {
+			return false;
+		}
+		if(!LockWorker(*worker, deadline)) {
+			return false;
 		}
-		args[i] = (char*)NULL;
+		UnlockWorker(*worker);
+		if(!worker->IsAlive()) {
+			return false;
+		}
+	}
 
-		close(inpipefd[0]);
-		close(inpipefd[1]);
-		close(outpipefd[0]);
-		close(outpipefd[1]);
+	return true;
+}
 
-		execvp(args[0], args);
+void EnrichableAnalyzerSubprocess::Stop() {
+	// The readers are stopped first, so that the totals are final; the
+	// workers they count are only discarded after.
+	StopTaggedReaders();
+	DumpStatistics();
+	statistics.Reset();
+	StopWorkers();
+}
 
-		std::cerr << "Failed to spawn analyzer subprocess!\n";
-	} else {
-		close(inpipefd[1]);
-		close(outpipefd[0]);
+void EnrichableAnalyzerSubprocess::StopWorkers() {
+	StopTaggedReaders();
+	featureTagged = false;
+	for(std::unique_ptr<EnrichableAnalyzerWorker>& worker : workers) {
+		worker->Stop();
+	}
+	workers.clear();
+	lateResponses.clear();
+	plugin.Unload();
+
+	runningCommand.clear();
+	runningWorkerCount = 0;
+}
+
+void EnrichableAnalyzerSubprocess::Terminate() {
+	StopWorkers();
+	enabled = false;
+}
+
+EnrichableAnalyzerWorker& EnrichableAnalyzerSubprocess::GetMarkerWorker() {
+	return *workers[0];
+}
+
+EnrichableAnalyzerWorker& EnrichableAnalyzerSubprocess::GetDisplayWorker(U64 frameIndex) {
+	return *workers[GetDisplayWorkerIndex(frameIndex)];
+}
+
+size_t EnrichableAnalyzerSubprocess::GetDisplayWorkerIndex(U64 frameIndex) {
+	// With a dedicated marker worker, the display pool starts after it.
+	size_t first = (dedicatedMarkerWorker && workers.size() > 1) ? 1 : 0;
+	size_t count = workers.size() - first;
+
+	if(count <= 1) {
+		return first;
+	}
+	if(poolDispatch == DispatchRoundRobin) {
+		return first + nextWorker++ % count;
 	}
 
+	// Fibonacci hashing; consecutive frames land on different workers.
+	return first + (size_t)((frameIndex * 0x9E3779B97F4A7C15ull) >> 32) % count;
+}
+
+void EnrichableAnalyzerSubprocess::NegotiateFeatures(EnrichableAnalyzerWorker& worker) {
 	// Check script to see which features are enabled;
 	// * 'no': This feature can be skipped.  This is used to improve
 	//   performance by allowing the script to not receive messages for
@@ -300,30 +2350,203 @@ void EnrichableAnalyzerSubprocess::Start() {
 	//   but it's more important to me that the default case be simple
 	//   than the default case be high-performance.   Scripts are expected
 	//   to respond to even unhandled messages.
-	featureBubble = GetFeatureEnablement(BUBBLE_PREFIX);
-	featureMarker = GetFeatureEnablement(MARKER_PREFIX);
-	featureTabular = GetFeatureEnablement(TABULAR_PREFIX);
+	featureBubble = GetFeatureEnablement(worker, BUBBLE_PREFIX);
+	featureMarker = GetFeatureEnablement(worker, MARKER_PREFIX);
+	featureTabular = GetFeatureEnablement(worker, TABULAR_PREFIX);
+
+	// Scripts whose output depends only on each frame's type, flags and
+	// data may opt in to having their responses memoized by content.
+	featurePure = GetFeatureOptIn(worker, PURE_FEATURE);
+
+	// Packet and transaction messages are opt-in: they add a request
+	// per packet or transaction, and their binary form is longer than
+	// the fixed record a script written before them would expect.
+	featurePacket = GetFeatureOptIn(worker, PACKET_PREFIX);
+	featureTransaction = GetFeatureOptIn(worker, TRANSACTION_PREFIX);
+
+	// Scripts that answer concurrently may opt in to tagged requests,
+	// which take effect once negotiation is over.
+	featureTagged = GetFeatureOptIn(worker, TAGGED_FEATURE);
+
+	// Scripts that find the shared memory rings described in their
+	// environment may move all further traffic onto them; the reply
+	// to this message is the last one sent through the pipe.
+	if(worker.SharedMemoryAvailable() && GetFeatureOptIn(worker, SHM_FEATURE)) {
+		worker.UseSharedMemory();
+	}
+
+	// The binary protocol must be explicitly requested with 'yes', and
+	// is negotiated last: every message after this one is binary.
+	binaryProtocol = GetFeatureOptIn(worker, BINARY_FEATURE);
 }
 
-void EnrichableAnalyzerSubprocess::Stop(int exitCode) {
-	if(enabled) {
-		close(inpipefd[0]);
-		close(outpipefd[1]);
+bool EnrichableAnalyzerSubprocess::NegotiateCapabilities(EnrichableAnalyzerWorker& worker) {
+	// One round trip in place of one per feature: the reply is a line of
+	// tab-separated name=value fields, the first of which is the
+	// version.  Fields this analyzer does not know are ignored.
+	std::string request = std::string(FEATURE_PREFIX) + UNIT_SEPARATOR + CAPABILITIES_FEATURE + LINE_SEPARATOR;
+	std::string reply;
+
+	GetScriptResponse(worker, request.c_str(), request.length(), reply);
+	if(reply.compare(0, 8, "version=") != 0) {
+		return false;
+	}
+
+	featureBubble = true;
+	featureMarker = true;
+	featureTabular = true;
+	featurePure = false;
+	featurePacket = false;
+	featureTransaction = false;
+	featureShm = false;
+	featureTagged = false;
+	binaryProtocol = false;
+
+	size_t start = 0;
+	while(start <= reply.length()) {
+		size_t end = reply.find(UNIT_SEPARATOR, start);
+		if(end == std::string::npos) {
+			end = reply.length();
+		}
+		std::string field = reply.substr(start, end - start);
+		size_t equals = field.find('=');
+		if(equals != std::string::npos && !ParseCapability(field.substr(0, equals), field.substr(equals + 1))) {
+			std::cerr << "Ignoring invalid capability \"";
+			std::cerr << field;
+			std::cerr << "\"\n";
+		}
+		start = end + 1;
+	}
 
-		kill(commandPid, SIGINT);
+	if(!featureBubble || !featureMarker || !featureTabular) {
+		std::cerr << "message types disabled:";
+		std::cerr << (featureBubble ? "" : " " BUBBLE_PREFIX);
+		std::cerr << (featureMarker ? "" : " " MARKER_PREFIX);
+		std::cerr << (featureTabular ? "" : " " TABULAR_PREFIX);
+		std::cerr << "\n";
+	}
+	if(!subscribedAddresses.all() || subscribedFrameTypes != 0xFFFFFFFF || subscribedFlagsMask != 0) {
+		std::cerr << "subscribed to " << subscribedAddresses.count() << " addresses";
+		std::cerr << ", frame types 0x" << std::hex << subscribedFrameTypes;
+		std::cerr << ", flags 0x" << (U32)subscribedFlagsMask << ":0x" << (U32)subscribedFlagsValue << std::dec << "\n";
+	}
 
-		exit(exitCode);
+	// As in the one-at-a-time negotiation, the switch to shared memory
+	// and to the binary protocol both take effect after this reply.
+	if(featureShm && worker.SharedMemoryAvailable()) {
+		worker.UseSharedMemory();
 	}
+
+	return true;
 }
 
-void EnrichableAnalyzerSubprocess::Terminate() {
-	Stop(1);
-	enabled = false;
+bool EnrichableAnalyzerSubprocess::ParseCapability(const std::string& name, const std::string& value) {
+	if(name == "version") {
+		char* end;
+		unsigned long version = strtoul(value.c_str(), &end, 10);
+		if(*end != '\0' || version == 0) {
+			return false;
+		}
+		std::cerr << "Script capabilities version " << version;
+		if(version > CAPABILITIES_VERSION) {
+			std::cerr << "; fields newer than version " << CAPABILITIES_VERSION << " are ignored";
+		}
+		std::cerr << "\n";
+		return true;
+	}
+	if(name == BUBBLE_PREFIX) {
+		return ParseYesNo(value, featureBubble);
+	}
+	if(name == MARKER_PREFIX) {
+		return ParseYesNo(value, featureMarker);
+	}
+	if(name == TABULAR_PREFIX) {
+		return ParseYesNo(value, featureTabular);
+	}
+	if(name == PURE_FEATURE) {
+		return ParseYesNo(value, featurePure);
+	}
+	if(name == PACKET_PREFIX) {
+		return ParseYesNo(value, featurePacket);
+	}
+	if(name == TRANSACTION_PREFIX) {
+		return ParseYesNo(value, featureTransaction);
+	}
+	if(name == SHM_FEATURE) {
+		return ParseYesNo(value, featureShm);
+	}
+	if(name == TAGGED_FEATURE) {
+		return ParseYesNo(value, featureTagged);
+	}
+	if(name == BINARY_FEATURE) {
+		return ParseYesNo(value, binaryProtocol);
+	}
+
+	// Comma-separated lists of numbers, in any base strtoul accepts.
+	if(name == "addresses" || name == "types") {
+		std::bitset<128> addresses;
+		U32 types = 0;
+		const char* cursor = value.c_str();
+		while(*cursor != '\0') {
+			char* end;
+			unsigned long number = strtoul(cursor, &end, 0);
+			if(end == cursor || (*end != ',' && *end != '\0')) {
+				return false;
+			}
+			if(name == "addresses") {
+				if(number >= addresses.size()) {
+					return false;
+				}
+				addresses.set(number);
+			} else {
+				if(number >= 32) {
+					return false;
+				}
+				types |= 1u << number;
+			}
+			cursor = *end == ',' ? end + 1 : end;
+		}
+		if(name == "addresses") {
+			subscribedAddresses = addresses;
+		} else {
+			subscribedFrameTypes = types;
+		}
+		return true;
+	}
+
+	// mask:value
+	if(name == "flags") {
+		char* end;
+		unsigned long mask = strtoul(value.c_str(), &end, 0);
+		if(*end != ':' || mask > 0xFF) {
+			return false;
+		}
+		unsigned long flags = strtoul(end + 1, &end, 0);
+		if(*end != '\0' || (flags & ~mask) != 0) {
+			return false;
+		}
+		subscribedFlagsMask = (U8)mask;
+		subscribedFlagsValue = (U8)flags;
+		return true;
+	}
+
+	return true;
 }
 
-bool EnrichableAnalyzerSubprocess::GetFeatureEnablement(const char* feature) {
+bool EnrichableAnalyzerSubprocess::ParseYesNo(const std::string& value, bool& result) {
+	if(value == "yes") {
+		result = true;
+	} else if(value == "no") {
+		result = false;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool EnrichableAnalyzerSubprocess::GetFeatureEnablement(EnrichableAnalyzerWorker& worker, const char* feature) {
 	std::stringstream outputStream;
-	char result[16];
+	std::string result;
 	std::string value;
 
 	outputStream << FEATURE_PREFIX;
@@ -333,12 +2556,12 @@ bool EnrichableAnalyzerSubprocess::GetFeatureEnablement(const char* feature) {
 	value = outputStream.str();
 
 	GetScriptResponse(
+		worker,
 		value.c_str(),
 		value.length(),
-		result,
-		16
+		result
 	);
-	if(strcmp(result, "no") == 0) {
+	if(result == "no") {
 		std::cerr << "message type \"";
 		std::cerr << feature;
 		std::cerr << "\" disabled\n";
@@ -347,113 +2570,236 @@ bool EnrichableAnalyzerSubprocess::GetFeatureEnablement(const char* feature) {
 	return true;
 }
 
-void EnrichableAnalyzerSubprocess::LockSubprocess() {
-	subprocessLock.lock();
-}
+bool EnrichableAnalyzerSubprocess::GetFeatureOptIn(EnrichableAnalyzerWorker& worker, const char* feature) {
+	std::stringstream outputStream;
+	std::string result;
+	std::string value;
+
+	outputStream << FEATURE_PREFIX;
+	outputStream << UNIT_SEPARATOR;
+	outputStream << feature;
+	outputStream << LINE_SEPARATOR;
+	value = outputStream.str();
 
-void EnrichableAnalyzerSubprocess::UnlockSubprocess() {
-	subprocessLock.unlock();
+	GetScriptResponse(
+		worker,
+		value.c_str(),
+		value.length(),
+		result
+	);
+	if(result == "yes") {
+		std::cerr << "optional feature \"";
+		std::cerr << feature;
+		std::cerr << "\" enabled\n";
+		return true;
+	}
+	return false;
 }
 
 bool EnrichableAnalyzerSubprocess::GetScriptResponse(
+	EnrichableAnalyzerWorker& worker,
 	const char* outBuffer,
 	unsigned outBufferLength,
-	char* inBuffer,
-	unsigned inBufferLength
+	std::string& response
 ) {
 	bool result;
 
-	LockSubprocess();
-	SendOutputLine(outBuffer, outBufferLength);
-	result = GetInputLine(inBuffer, inBufferLength);
-	UnlockSubprocess();
+	LockWorker(worker);
+	std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+	SendOutputLine(worker, outBuffer, outBufferLength);
+	statistics.RecordRequest(0);
+	result = worker.GetInputLine(response);
+	if(worker.IsAlive()) {
+		// An empty reply is still a reply.
+		statistics.RecordResponse(0, sent);
+	}
+	CheckWorker(worker);
+	UnlockWorker(worker);
+
+	return result;
+}
+
+bool EnrichableAnalyzerSubprocess::SendOutputLine(EnrichableAnalyzerWorker& worker, const char* buffer, unsigned bufferLength) {
+	bool result = worker.SendOutputLine(buffer, bufferLength);
+	CheckWorker(worker);
 
 	return result;
 }
 
-bool EnrichableAnalyzerSubprocess::SendOutputLine(const char* buffer, unsigned bufferLength) {
+bool EnrichableAnalyzerSubprocess::GetInputEntry(
+	EnrichableAnalyzerWorker& worker,
+	const char*& entry,
+	size_t& length
+) {
+	U8 header[4];
+
+	entry = NULL;
+	length = 0;
+	if(!worker.PeekInputBytes((char*)header, sizeof(header))) {
+		return false;
+	}
+
+	U32 entryLength = DecodeU32(header);
+	if(entryLength == 0) {
+		worker.GetInputBytes((char*)header, sizeof(header));
+		return false;
+	}
+
+	// Nothing is consumed until the whole entry has arrived, so an entry
+	// cut short by a deadline is read again from its start.
+	if(!worker.PeekInputBytes(NULL, sizeof(header) + entryLength)) {
+		return false;
+	}
+	entry = worker.GetInputBytes(sizeof(header) + entryLength) + sizeof(header);
+	length = entryLength;
+
 	#ifdef SUBPROCESS_DEBUG
-		std::cerr << ">> ";
-		std::cerr << buffer;
+		std::cerr << "<< [" << length << " bytes]\n";
 	#endif
-	write(outpipefd[1], buffer, bufferLength);
 
 	return true;
 }
 
-bool EnrichableAnalyzerSubprocess::GetInputLine(char* buffer, unsigned bufferLength) {
-	unsigned bufferPos = 0;
-	bool result = false;
+bool EnrichableAnalyzerSubprocess::GetResponseLine(
+	EnrichableAnalyzerWorker& worker,
+	const char*& line,
+	size_t& length
+) {
+	bool result;
 
-	#ifdef SUBPROCESS_DEBUG
-		std::cerr << "<< ";
-	#endif
+	if(binaryProtocol) {
+		result = GetInputEntry(worker, line, length);
+	} else {
+		result = worker.GetInputLine(line, length);
+	}
+	CheckWorker(worker);
 
-	while(true) {
-		int result = read(inpipefd[0], &buffer[bufferPos], 1);
-		if(buffer[bufferPos] == '\n') {
-			break;
-		}
+	return result;
+}
 
-		#ifdef SUBPROCESS_DEBUG
-			std::cerr << buffer[bufferPos];
-		#endif
+void EnrichableAnalyzerSubprocess::CheckWorker(EnrichableAnalyzerWorker& worker) {
+	// Exchanged, so that an exit seen by several threads is counted once
+	if(!worker.IsAlive() && enabled.exchange(false)) {
+		statistics.RecordScriptExit();
+	}
+}
 
-		bufferPos++;
+U32 EnrichableAnalyzerSubprocess::DecodeU32(const U8* buffer) {
+	return (U32)buffer[0] | ((U32)buffer[1] << 8) | ((U32)buffer[2] << 16) | ((U32)buffer[3] << 24);
+}
 
-		if(bufferPos == bufferLength - 1) {
-			break;
-		}
+EnrichableAnalyzerSubprocess::MemoKey EnrichableAnalyzerSubprocess::GetMemoKey(
+	U32 messageType,
+	Frame& frame,
+	U32 sampleCount
+) {
+	MemoKey key;
+
+	key.messageType = messageType;
+	key.frameType = frame.mType;
+	key.flags = frame.mFlags;
+	key.sampleCount = sampleCount;
+	key.data1 = frame.mData1;
+	key.data2 = frame.mData2;
+
+	return key;
+}
+
+template<typename Response>
+bool EnrichableAnalyzerSubprocess::FindMemo(
+	std::unordered_map<MemoKey, Response, MemoKeyHash>& memo,
+	const MemoKey& key,
+	Response& response
+) {
+	std::lock_guard<std::mutex> guard(memoLock);
+
+	typename std::unordered_map<MemoKey, Response, MemoKeyHash>::iterator entry = memo.find(key);
+	if(entry == memo.end()) {
+		return false;
 	}
-	buffer[bufferPos] = '\0';
+	response = entry->second;
 
-	#ifdef SUBPROCESS_DEBUG
-		std::cerr << '\n';
-	#endif
+	return true;
+}
 
-	if(strlen(buffer) > 0) {
-		result = true;
+template<typename Response>
+void EnrichableAnalyzerSubprocess::StoreMemo(
+	std::unordered_map<MemoKey, Response, MemoKeyHash>& memo,
+	const MemoKey& key,
+	const Response& response
+) {
+	std::lock_guard<std::mutex> guard(memoLock);
+
+	// A pure script only ever sees a few hundred distinct frames; if this
+	// one is seeing far more than that, start over rather than grow
+	// without bound.
+	if(memo.size() >= PURE_MEMO_LIMIT) {
+		memo.clear();
 	}
+	memo[key] = response;
+}
 
-	return result;
+bool EnrichableAnalyzerSubprocess::MemoKey::operator==(const MemoKey& other) const {
+	return messageType == other.messageType &&
+		frameType == other.frameType &&
+		flags == other.flags &&
+		sampleCount == other.sampleCount &&
+		data1 == other.data1 &&
+		data2 == other.data2;
 }
 
-AnalyzerResults::MarkerType EnrichableAnalyzerSubprocess::GetMarkerType(char* buffer, unsigned bufferLength) {
-	AnalyzerResults::MarkerType markerType = AnalyzerResults::Dot;
-
-	if(strncmp(buffer, "ErrorDot", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::ErrorDot;
-	} else if(strncmp(buffer, "Square", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::Square;
-	} else if(strncmp(buffer, "ErrorSquare", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::ErrorSquare;
-	} else if(strncmp(buffer, "UpArrow", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::UpArrow;
-	} else if(strncmp(buffer, "DownArrow", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::DownArrow;
-	} else if(strncmp(buffer, "X", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::X;
-	} else if(strncmp(buffer, "ErrorX", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::ErrorX;
-	} else if(strncmp(buffer, "Start", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::Start;
-	} else if(strncmp(buffer, "Stop", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::Stop;
-	} else if(strncmp(buffer, "One", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::One;
-	} else if(strncmp(buffer, "Zero", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::Zero;
-	} else if(strncmp(buffer, "Dot", strlen(buffer)) == 0) {
-		markerType = AnalyzerResults::Dot;
-	}
-
-	return markerType;
+size_t EnrichableAnalyzerSubprocess::MemoKeyHash::operator()(const MemoKey& key) const {
+	U64 hash = key.data1;
+	hash = hash * 31 + key.data2;
+	hash = hash * 31 + key.messageType;
+	hash = hash * 31 + key.frameType;
+	hash = hash * 31 + key.flags;
+	hash = hash * 31 + key.sampleCount;
+
+	return std::hash<U64>()(hash);
+}
+
+AnalyzerResults::MarkerType EnrichableAnalyzerSubprocess::GetMarkerType(const char* buffer, unsigned bufferLength) {
+	// The first type whose name starts with the text given is chosen.
+	static const struct {
+		const char* name;
+		AnalyzerResults::MarkerType markerType;
+	} markerTypes[] = {
+		{"ErrorDot", AnalyzerResults::ErrorDot},
+		{"Square", AnalyzerResults::Square},
+		{"ErrorSquare", AnalyzerResults::ErrorSquare},
+		{"UpArrow", AnalyzerResults::UpArrow},
+		{"DownArrow", AnalyzerResults::DownArrow},
+		{"X", AnalyzerResults::X},
+		{"ErrorX", AnalyzerResults::ErrorX},
+		{"Start", AnalyzerResults::Start},
+		{"Stop", AnalyzerResults::Stop},
+		{"One", AnalyzerResults::One},
+		{"Zero", AnalyzerResults::Zero},
+		{"Dot", AnalyzerResults::Dot},
+	};
+
+	for(const auto& candidate : markerTypes) {
+		if(bufferLength <= strlen(candidate.name) && memcmp(buffer, candidate.name, bufferLength) == 0) {
+			return candidate.markerType;
+		}
+	}
+
+	return AnalyzerResults::Dot;
 }
 
 EnrichableAnalyzerSubprocess::Marker::Marker(
-	U8 _sampleNumber, std::string _channelName, AnalyzerResults::MarkerType _markerType
+	U8 _sampleNumber,
+	const char* _channelName,
+	size_t _channelNameLength,
+	AnalyzerResults::MarkerType _markerType
 ) {
+	if(_channelNameLength >= sizeof(channelName)) {
+		_channelNameLength = sizeof(channelName) - 1;
+	}
+
 	sampleNumber = _sampleNumber;
-	channelName = _channelName;
+	memcpy(channelName, _channelName, _channelNameLength);
+	channelName[_channelNameLength] = '\0';
 	markerType = _markerType;
 }
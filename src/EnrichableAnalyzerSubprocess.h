@@ -1,68 +1,568 @@
 #pragma once
 
 #include "AnalyzerResults.h"
+#include "EnrichableAnalyzerWorker.h"
+#include "EnrichablePersistentCache.h"
+#include "EnrichableSubprocessStatistics.h"
+#include "EnrichableRequestEncoder.h"
+#include "EnrichablePlugin.h"
 #include <vector>
+#include <deque>
 #include <string>
+#include <unordered_map>
+#include <bitset>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 //#define SUBPROCESS_DEBUG
 
 #define BUBBLE_PREFIX "bubble"
 #define MARKER_PREFIX "marker"
 #define TABULAR_PREFIX "tabular"
+#define PACKET_PREFIX "packet"
+#define TRANSACTION_PREFIX "transaction"
 #define FEATURE_PREFIX "feature"
+#define BINARY_FEATURE "binary"
+#define PURE_FEATURE "pure"
+#define SHM_FEATURE "shm"
+#define CAPABILITIES_FEATURE "capabilities"
+#define TAGGED_FEATURE "tagged"
+
+// The version of the capabilities reply this analyzer understands
+#define CAPABILITIES_VERSION 1
+
+// Passed as the address of a frame whose address is not known; such
+// frames pass any address filter.
+#define UNKNOWN_ADDRESS 0xFF
+
+// Upper bound on memoized responses kept for a pure script
+#define PURE_MEMO_LIMIT 1048576
+
+// Upper bound on late responses held until they are asked for again
+#define LATE_RESPONSE_LIMIT 4096
+
+// Packet and transaction requests left unread before the analysis
+// thread waits for the oldest reply; only reached when no marker
+// requests are collecting them.
+#define DECODE_PIPELINE_LIMIT 256
+
+// Longest to wait, when the analyzer re-runs, for a running script to
+// answer the last run's requests before starting it afresh instead.
+#define RESTART_DRAIN_DEADLINE_MS 1000
+
+// Tagged mode: requests in flight at once, across all workers, before
+// a sender waits for replies to make room; and how often each worker's
+// reader checks whether it is being stopped.
+#define TAGGED_REQUEST_LIMIT 1024
+#define TAGGED_POLL_MS 100
+
+// Binary protocol: every request is a fixed-size little-endian record,
+// and every reply is a series of length-prefixed entries terminated by
+// an entry of length zero.
+#define BINARY_RECORD_SIZE 64
+#define BINARY_BUBBLE 1
+#define BINARY_MARKER 2
+#define BINARY_TABULAR 3
+#define BINARY_PACKET 4
+#define BINARY_TRANSACTION 5
+// Where a tagged request's tag is kept within the record
+#define BINARY_TAG_OFFSET 44
 
 #define UNIT_SEPARATOR '\t'
 #define LINE_SEPARATOR '\n'
 
+// Room for a marker's channel name, including its terminator; longer
+// names cannot match any channel and are truncated.
+#define MARKER_CHANNEL_NAME_SIZE 16
+
 class EnrichableAnalyzerSubprocess {
 	public:
+		// How bubble and tabular requests are spread across a pool of
+		// script processes; marker requests always go to the first one.
+		enum PoolDispatch {
+			DispatchRoundRobin = 0,
+			DispatchFrameHash = 1
+		};
+
+		// Held inline so that markers can be copied without allocating.
 		struct Marker {
-			Marker(U8 sampleNumber, std::string channelName, AnalyzerResults::MarkerType markerType);
+			Marker(U8 sampleNumber, const char* channelName, size_t channelNameLength, AnalyzerResults::MarkerType markerType);
 
 			U8 sampleNumber;
-			std::string channelName;
+			char channelName[MARKER_CHANNEL_NAME_SIZE];
 			AnalyzerResults::MarkerType markerType;
 		};
 
+		// A register access found by the decoder; see
+		// EnrichableI2cTransactions.
+		struct TransactionRequest {
+			U64 transactionId;
+			U64 firstFrameIndex;
+			U64 frameCount;
+			U64 startingSample;
+			U64 endingSample;
+			U8 address;
+			bool read;
+			const U8* registerBytes;
+			U32 registerLength;
+			const U8* payload;
+			U32 payloadLength;
+		};
+
+		struct BubbleRequest {
+			U64 packetId;
+			U64 frameIndex;
+			Frame frame;
+			// Set when the response missed its deadline
+			bool late;
+		};
+
 		EnrichableAnalyzerSubprocess();
 		virtual ~EnrichableAnalyzerSubprocess();
 
 		void SetParserCommand(std::string);
+		void SetPoolSize(U32 size);
+		void SetPoolDispatch(PoolDispatch dispatch);
+		void SetDedicatedMarkerWorker(bool dedicated);
+		void SetPersistentCache(const std::string& directory, U32 sampleRate);
+		// Every frame decoded, in order; the first few choose the
+		// persistent cache's file.
+		void AddCaptureFrame(const Frame& frame);
+		void SetSharedMemoryTransport(bool sharedMemory);
+		// Longest the display may wait for each kind of response; 0
+		// waits indefinitely.
+		void SetDeadlines(U32 bubbleMs, U32 tabularMs);
+		void LogContention();
+		// Writes request counts, round-trip latencies, traffic and lock
+		// contention to stderr; done for the last run when the next one
+		// starts, and when the subprocess is stopped.
+		void DumpStatistics();
 
 		std::vector<Marker> EmitMarker(U64 packetId, U64 frameIndex, Frame& frame, U32 sampleCount);
-		std::vector<std::string> EmitBubble(U64 packetId, U64 frameIndex, Frame& frame, std::string channelName);
-		std::vector<std::string> EmitTabular(U64 packetId, U64 frameIndex, Frame& frame);
+		void EmitMarker(U64 packetId, U64 frameIndex, Frame& frame, U32 sampleCount, std::vector<Marker>& markers);
+
+		// Pipelined marker requests: SendMarker queues a request without
+		// waiting for its reply; ReceiveMarker returns replies in the
+		// order their requests were sent, blocking if necessary.  Neither
+		// allocates once the queue and the caller's vector have grown to
+		// their working size.
+		void SendMarker(U64 packetId, U64 frameIndex, Frame& frame, U32 sampleCount);
+		bool ReceiveMarker(std::vector<Marker>& markers);
+		bool MarkerResponseReady();
+		U32 OutstandingMarkerCount();
+		// Responses that miss their deadline come back empty with *late
+		// set; once the script does reply, the response is returned the
+		// next time the same frame is requested.  Unlike markers, every
+		// response is a newly allocated vector of strings, which the
+		// caches keep.
+		std::vector<std::string> EmitBubble(U64 packetId, U64 frameIndex, Frame& frame, std::string channelName, bool* late = NULL);
+		void EmitBubbles(
+			std::vector<BubbleRequest>& requests,
+			std::vector<std::vector<std::string>>& responses,
+			std::string channelName
+		);
+		std::vector<std::string> EmitTabular(U64 packetId, U64 frameIndex, Frame& frame, bool* late = NULL);
+
+		// As above, but returning at once.  With a script in tagged mode
+		// the futures complete as its replies arrive, in whatever order
+		// it sends them; otherwise, and when a response is cached, they
+		// are already complete when returned.  A script that exits
+		// completes them empty.
+		std::future<std::vector<Marker>> EmitMarkerAsync(U64 packetId, U64 frameIndex, Frame& frame, U32 sampleCount);
+		std::future<std::vector<std::string>> EmitBubbleAsync(U64 packetId, U64 frameIndex, Frame& frame, std::string channelName);
+		std::future<std::vector<std::string>> EmitTabularAsync(U64 packetId, U64 frameIndex, Frame& frame);
+
+		// Packet and transaction requests are sent by the analysis thread
+		// as each packet is committed, and share the marker pipeline;
+		// their replies are kept until the display asks for them.  The
+		// Get methods return false if no reply arrived within the tabular
+		// deadline.
+		void SendPacket(U64 packetId, U64 firstFrameIndex, const std::vector<Frame>& frames);
+		void SendTransaction(const TransactionRequest& transaction);
+		bool GetPacketResponse(U64 packetId, std::vector<std::string>& lines);
+		bool GetTransactionResponse(U64 transactionId, std::vector<std::string>& lines);
 
 		bool MarkerEnabled();
 		bool BubbleEnabled();
 		bool TabularEnabled();
+		bool PacketEnabled();
+		bool TransactionEnabled();
+
+		// Whether the script subscribed to messages about a frame sent to
+		// the given 7-bit address; callers check before sending anything,
+		// and show the built-in text for frames it did not.
+		bool Subscribes(U8 address, const Frame& frame);
+		bool SubscribesAddress(U8 address);
+		bool FiltersAddresses();
 
 		void Start();
-		void Stop(int exitCode=0);
+		// Starting again with the same command reuses the script already
+		// running; Stop shuts it down.
+		void Stop();
 	protected:
+		// Everything a pure script's response may depend upon.
+		struct MemoKey {
+			U32 messageType;
+			U8 frameType;
+			U8 flags;
+			U32 sampleCount;
+			U64 data1;
+			U64 data2;
+
+			bool operator==(const MemoKey& other) const;
+		};
+		struct MemoKeyHash {
+			size_t operator()(const MemoKey& key) const;
+		};
+
+		// A display request whose deadline passed before its response had
+		// been read; entries holds whatever part of it had arrived.
+		struct LateResponse {
+			U32 messageType;
+			U64 frameIndex;
+			Frame frame;
+			std::vector<std::string> entries;
+			std::chrono::steady_clock::time_point sent;
+		};
+
+		// A marker request sent by SendMarker but not yet collected by
+		// ReceiveMarker, or a packet or transaction request whose reply
+		// has not yet been read; their replies are kept in entries until
+		// complete.
+		struct OutstandingRequest {
+			U32 messageType;
+			bool awaitingReply;
+			MemoKey key;
+			U64 frameIndex;
+			// The packet or transaction id
+			U64 decodeId;
+			Frame frame;
+			std::vector<Marker> markers;
+			std::vector<std::string> entries;
+			std::chrono::steady_clock::time_point sent;
+			// In tagged mode, where the reply arrives in place of markers
+			std::future<std::vector<Marker>> reply;
+		};
+
+		// A request sent in tagged mode whose reply has not yet been
+		// completely read; entries holds what has arrived of it.
+		struct TaggedRequest {
+			U32 messageType;
+			size_t workerIndex;
+			// The frame index, or for packets and transactions their id
+			U64 id;
+			Frame frame;
+			MemoKey key;
+			std::vector<std::string> entries;
+			std::chrono::steady_clock::time_point sent;
+			// Set when a display request's deadline has passed; the reply
+			// is then kept until the frame is asked for again.
+			bool late;
+			std::promise<std::vector<std::string>> response;
+			std::promise<std::vector<Marker>> markers;
+		};
+
+		bool StartWorkers(U32 workerCount);
+		bool DrainWorkers();
+		void StopWorkers();
 		void Terminate();
+		void StartTaggedReaders();
+		void StopTaggedReaders();
+
+		EnrichableAnalyzerWorker& GetMarkerWorker();
+		EnrichableAnalyzerWorker& GetDisplayWorker(U64 frameIndex);
+		size_t GetDisplayWorkerIndex(U64 frameIndex);
+		bool LockWorker(
+			EnrichableAnalyzerWorker& worker,
+			std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()
+		);
+		void UnlockWorker(EnrichableAnalyzerWorker& worker);
+		void CheckWorker(EnrichableAnalyzerWorker& worker);
+		size_t GetWorkerIndex(EnrichableAnalyzerWorker& worker);
+		static std::chrono::steady_clock::time_point GetDeadline(U32 deadlineMs);
+
+		bool FindDisplayResponse(
+			U32 messageType,
+			U64 frameIndex,
+			Frame& frame,
+			std::vector<std::string>& response
+		);
+		bool ExchangeDisplayRequest(
+			EnrichableAnalyzerWorker& worker,
+			U32 messageType,
+			U64 frameIndex,
+			Frame& frame,
+			const char* request,
+			size_t requestLength,
+			std::chrono::steady_clock::time_point deadline,
+			std::vector<std::string>& response
+		);
+		void FormatMarkerRequest(
+			EnrichableRequestEncoder& request,
+			U64 packetId,
+			U64 frameIndex,
+			Frame& frame,
+			U32 sampleCount
+		);
+		void FormatTabularRequest(EnrichableRequestEncoder& request, U64 packetId, U64 frameIndex, Frame& frame);
+
+		// Tagged mode.  SendTaggedRequest must be called with the worker's
+		// lock held, and fails only if no room is made for the request
+		// by the deadline; its reply completes whichever of the futures
+		// is given.
+		bool SendTaggedRequest(
+			size_t workerIndex,
+			U32 messageType,
+			U64 id,
+			Frame& frame,
+			U32 sampleCount,
+			const char* request,
+			size_t requestLength,
+			std::chrono::steady_clock::time_point deadline,
+			U32& tag,
+			std::future<std::vector<std::string>>* response,
+			std::future<std::vector<Marker>>* markers
+		);
+		bool ExchangeTaggedRequest(
+			size_t workerIndex,
+			U32 messageType,
+			U64 frameIndex,
+			Frame& frame,
+			const char* request,
+			size_t requestLength,
+			std::chrono::steady_clock::time_point deadline,
+			std::vector<std::string>& response
+		);
+		std::future<std::vector<std::string>> SendTaggedDisplayRequest(
+			U32 messageType,
+			U64 frameIndex,
+			Frame& frame,
+			EnrichableRequestEncoder& request
+		);
+		bool WaitTaggedResponse(
+			U32 messageType,
+			U32 tag,
+			std::future<std::vector<std::string>>& reply,
+			std::chrono::steady_clock::time_point deadline,
+			std::vector<std::string>& response
+		);
+		void EmitTaggedBubbles(
+			std::vector<BubbleRequest>& requests,
+			std::vector<std::vector<std::string>>& responses,
+			const std::string& channelName
+		);
+		bool WaitTaggedDecodeResponse(U32 messageType, U64 decodeId, std::chrono::steady_clock::time_point deadline);
+		void ReadTaggedResponses(size_t workerIndex);
+		bool GetTaggedEntry(
+			EnrichableAnalyzerWorker& worker,
+			U32& tag,
+			const char*& entry,
+			size_t& length,
+			bool& complete
+		);
+		void CompleteTaggedRequest(TaggedRequest& request);
+		template<typename Response>
+		static std::future<Response> GetReadyFuture(Response response);
+
+		bool ReadLateResponses(EnrichableAnalyzerWorker& worker);
+		void CompleteLateResponse(LateResponse& late);
+		bool TakeCompletedResponse(U32 messageType, U64 frameIndex, std::vector<std::string>& response);
 
 		bool GetScriptResponse(
+			EnrichableAnalyzerWorker& worker,
 			const char* outBuffer,
 			unsigned outBufferLength,
-			char* inBuffer,
-			unsigned inBufferLength
+			std::string& response
+		);
+		bool SendOutputLine(EnrichableAnalyzerWorker& worker, const char* buffer, unsigned bufferLength);
+		// Entries and lines are handed out in place; see
+		// EnrichableAnalyzerWorker::GetInputLine.
+		bool GetInputEntry(EnrichableAnalyzerWorker& worker, const char*& entry, size_t& length);
+		bool GetResponseLine(EnrichableAnalyzerWorker& worker, const char*& line, size_t& length);
+		bool ReadMarkerResponse(EnrichableAnalyzerWorker& worker, std::vector<Marker>& markers);
+		bool ParseMarkerEntry(const char* entry, size_t length, std::vector<Marker>& markers);
+		static bool GetMarkerField(const char*& cursor, const char* end, const char*& field, size_t& length);
+		static U64 ParseHex(const char* buffer, size_t length);
+		bool ReadNextMarkerResponse(EnrichableAnalyzerWorker& worker);
+		bool ReadDecodeResponse(EnrichableAnalyzerWorker& worker, std::vector<std::string>& entries);
+		void CollectDecodeResponses(EnrichableAnalyzerWorker& worker, bool wait);
+		void QueueDecodeRequest(U32 messageType, U64 decodeId);
+		bool GetDecodeResponse(U32 messageType, U64 decodeId, std::vector<std::string>& lines);
+		bool FindDecodeResponse(U32 messageType, U64 decodeId, std::vector<std::string>& lines);
+		static U64 GetDecodeKey(U32 messageType, U64 decodeId);
+		static void AppendHexByte(std::string& request, U8 value);
+		bool GetFeatureEnablement(EnrichableAnalyzerWorker& worker, const char* feature);
+		bool GetFeatureOptIn(EnrichableAnalyzerWorker& worker, const char* feature);
+		bool NegotiateCapabilities(EnrichableAnalyzerWorker& worker);
+		bool ParseCapability(const std::string& name, const std::string& value);
+		static bool ParseYesNo(const std::string& value, bool& result);
+		void NegotiateFeatures(EnrichableAnalyzerWorker& worker);
+		void FormatBubbleRequest(
+			EnrichableRequestEncoder& request,
+			U64 packetId,
+			U64 frameIndex,
+			Frame& frame,
+			const std::string& channelName
+		);
+		static U32 DecodeU32(const U8* buffer);
+
+		MemoKey GetMemoKey(U32 messageType, Frame& frame, U32 sampleCount);
+		template<typename Response>
+		bool FindMemo(
+			std::unordered_map<MemoKey, Response, MemoKeyHash>& memo,
+			const MemoKey& key,
+			Response& response
+		);
+		template<typename Response>
+		void StoreMemo(
+			std::unordered_map<MemoKey, Response, MemoKeyHash>& memo,
+			const MemoKey& key,
+			const Response& response
+		);
+		AnalyzerResults::MarkerType GetMarkerType(const char* buffer, unsigned bufferLength);
+
+		// Requests answered in-process by a plugin.
+		void GetPluginBubbles(
+			U64 packetId,
+			U64 frameIndex,
+			Frame& frame,
+			const std::string& channelName,
+			std::vector<std::string>& bubbles
+		);
+		void GetPluginTabular(U64 packetId, U64 frameIndex, Frame& frame, std::vector<std::string>& lines);
+		void GetPluginMarkers(
+			U64 packetId,
+			U64 frameIndex,
+			Frame& frame,
+			U32 sampleCount,
+			std::vector<Marker>& markers
+		);
+
+		bool FindPersistentMarkers(U64 frameIndex, Frame& frame, U32 sampleCount, std::vector<Marker>& markers);
+		void StorePersistentMarkers(
+			U64 frameIndex,
+			Frame& frame,
+			U32 sampleCount,
+			const std::vector<Marker>& markers,
+			std::vector<std::string>& entries
 		);
-		bool SendOutputLine(const char* buffer, unsigned bufferLength);
-		bool GetInputLine(char* buffer, unsigned bufferLength);
-		void LockSubprocess();
-		void UnlockSubprocess();
-		bool GetFeatureEnablement(const char* feature);
-		AnalyzerResults::MarkerType GetMarkerType(char* buffer, unsigned bufferLength);
+
+		OutstandingRequest& PushOutstandingRequest();
+		OutstandingRequest& GetOutstandingRequest(size_t position);
+		void PopOutstandingRequest();
 
 		std::string parserCommand;
-		bool enabled;
+		// Cleared by the tagged readers when a worker exits, while the
+		// analysis and display threads test it.
+		std::atomic<bool> enabled;
+		// Set while the last run's replies are drained on a re-run; they
+		// are read and thrown away rather than kept.
+		std::atomic<bool> draining;
+
+		// How the running workers, or plugin, were started; empty when
+		// nothing is running.
+		std::string runningCommand;
+		U32 runningWorkerCount = 0;
+		bool runningSharedMemory = false;
 
 		bool featureMarker;
 		bool featureBubble;
 		bool featureTabular;
+		bool featurePure = false;
+		bool featurePacket = false;
+		bool featureTransaction = false;
+		bool binaryProtocol = false;
+		bool sharedMemoryTransport = false;
+		// Requested by a capabilities reply; that of the last negotiation
+		// is applied until the next.
+		bool featureShm = false;
+		// Requests carry tags, and their replies may arrive in any order;
+		// each worker's replies are then read by a thread of its own.
+		bool featureTagged = false;
+		U32 bubbleDeadlineMs = 0;
+		U32 tabularDeadlineMs = 0;
+
+		// The frames the script asked to be sent, from its capabilities
+		// reply; everything by default.  Frames are sent only if their
+		// address and type are in these sets and their flags, masked,
+		// equal subscribedFlagsValue.
+		std::bitset<128> subscribedAddresses;
+		U32 subscribedFrameTypes = 0xFFFFFFFF;
+		U8 subscribedFlagsMask = 0;
+		U8 subscribedFlagsValue = 0;
+
+		U32 poolSize = 1;
+		PoolDispatch poolDispatch = DispatchFrameHash;
+		// When set, an extra process serves only the decode thread's
+		// marker requests, so it never waits on the UI and vice versa.
+		bool dedicatedMarkerWorker = false;
+		std::atomic<U32> nextWorker;
+		std::vector<std::unique_ptr<EnrichableAnalyzerWorker>> workers;
+
+		// Marker, packet and transaction requests not yet collected, oldest first, and
+		// how many of them are still waiting for the subprocess to reply;
+		// guarded by the marker worker's lock.  The requests are kept in a
+		// ring whose slots, and their marker vectors, are reused.
+		std::vector<OutstandingRequest> outstandingRequests;
+		size_t outstandingFirst = 0;
+		size_t outstandingCount = 0;
+		U32 pendingRequests = 0;
+		// Markers in the persistent cache's entry layout; also guarded by
+		// the marker worker's lock.
+		std::vector<std::string> markerEntries;
+		// Packet and transaction requests are variable-length, so they are
+		// formatted here rather than in a fixed encoder; only the analysis
+		// thread sends them.
+		std::string decodeRequest;
+
+		// Replies to packet and transaction requests, by message type and
+		// id.
+		std::mutex decodeLock;
+		std::unordered_map<U64, std::vector<std::string>> decodeResponses;
+
+		// Display requests whose responses are still on their way, per
+		// worker and guarded by its lock.  Their replies precede those of
+		// any pending markers, as no display request is sent while
+		// marker replies are outstanding.
+		std::vector<std::deque<LateResponse>> lateResponses;
+
+		// Tagged requests awaiting their replies, by tag; taggedDone is
+		// signalled as each is completed.  taggedReading marks the workers
+		// whose reader threads are still running.
+		std::mutex taggedLock;
+		std::condition_variable taggedDone;
+		std::unordered_map<U32, TaggedRequest> taggedRequests;
+		U32 nextTag = 0;
+		std::vector<std::thread> taggedReaders;
+		std::vector<bool> taggedReading;
+		std::atomic<bool> taggedStopping;
+
+		// Late responses that have since arrived, by message type and
+		// frame index, waiting to be asked for again.
+		std::mutex completedLock;
+		std::unordered_map<U64, std::vector<std::string>> completedResponses;
+
+		// Responses of a pure script, keyed by frame content.
+		std::mutex memoLock;
+		std::unordered_map<MemoKey, std::vector<std::string>, MemoKeyHash> memoResponses;
+		std::unordered_map<MemoKey, std::vector<Marker>, MemoKeyHash> memoMarkers;
+
+		// Responses kept on disk across sessions; disabled when no
+		// directory is configured.
+		std::string persistentCacheDirectory;
+		U32 persistentCacheSampleRate = 0;
+		EnrichablePersistentCache persistentCache;
+
+		EnrichableSubprocessStatistics statistics;
 
-		pid_t commandPid = 0;
-		int inpipefd[2];
-		int outpipefd[2];
+		// Loaded in place of starting workers when the parser command
+		// names a shared library.  Marker replies are converted through
+		// pluginMarkers, used only by the analysis thread.
+		EnrichablePlugin plugin;
+		std::vector<enrichable_marker> pluginMarkers;
 };
@@ -0,0 +1,560 @@
+#include "EnrichableAnalyzerWorker.h"
+#include "EnrichableAnalyzerSubprocess.h"
+
+#include <iostream>
+#include <chrono>
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <wordexp.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+EnrichableAnalyzerWorker::EnrichableAnalyzerWorker():
+	alive(false),
+	concurrentReader(false)
+{
+}
+
+EnrichableAnalyzerWorker::~EnrichableAnalyzerWorker()
+{
+	Stop();
+}
+
+bool EnrichableAnalyzerWorker::Start(const std::string& command, bool sharedMemory) {
+	sharedActive = false;
+	sharedTransport.reset();
+	if(sharedMemory) {
+		sharedTransport.reset(new EnrichableSharedTransport());
+		if(!sharedTransport->Create()) {
+			sharedTransport.reset();
+		} else {
+			sharedTransport->SetConcurrentReader(concurrentReader);
+		}
+	}
+
+	if(pipe(inpipefd) < 0) {
+		std::cerr << "Failed to create input pipe: ";
+		std::cerr << errno;
+		std::cerr << "\n";
+		return false;
+	}
+	if(pipe(outpipefd) < 0) {
+		std::cerr << "Failed to create output pipe: ";
+		std::cerr << errno;
+		std::cerr << "\n";
+		close(inpipefd[0]);
+		close(inpipefd[1]);
+		return false;
+	}
+	inputBuffer.resize(INPUT_CHUNK_SIZE);
+	inputStart = 0;
+	inputEnd = 0;
+
+	// Each script must hold only its own pipes: a copy of another's
+	// would keep that script from seeing end-of-file when it is stopped.
+	// dup2 clears the flag on the script's stdin and stdout.
+	for(int fd : {inpipefd[0], inpipefd[1], outpipefd[0], outpipefd[1]}) {
+		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	}
+
+	// The command is split here rather than in the child, so that the
+	// child need only exec and can share our address space until it
+	// does; forking all of Logic's memory just to replace it is slow.
+	wordexp_t cmdParsed;
+	if(wordexp(command.c_str(), &cmdParsed, 0) != 0 || cmdParsed.we_wordc == 0) {
+		std::cerr << "Unable to parse analyzer subprocess command: ";
+		std::cerr << command;
+		std::cerr << "\n";
+		ClosePipes();
+		return false;
+	}
+
+	std::string sharedEnvironment;
+	std::vector<char*> environment;
+	for(char** variable = environ; *variable != NULL; variable++) {
+		environment.push_back(*variable);
+	}
+	if(sharedTransport) {
+		sharedEnvironment = std::string(SHARED_TRANSPORT_ENVIRONMENT) + "=" + sharedTransport->GetEnvironment();
+		environment.push_back(&sharedEnvironment[0]);
+	}
+	environment.push_back(NULL);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, outpipefd[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, inpipefd[1], STDOUT_FILENO);
+	if(sharedTransport) {
+		sharedTransport->AddChildFileActions(&actions);
+	}
+
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+#ifdef POSIX_SPAWN_USEVFORK
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_USEVFORK);
+#endif
+
+	int result = posix_spawnp(
+		&commandPid,
+		cmdParsed.we_wordv[0],
+		&actions,
+		&attributes,
+		cmdParsed.we_wordv,
+		&environment[0]
+	);
+
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&actions);
+	wordfree(&cmdParsed);
+
+	if(result != 0) {
+		std::cerr << "Failed to spawn analyzer subprocess: ";
+		std::cerr << result;
+		std::cerr << "\n";
+		commandPid = 0;
+		ClosePipes();
+		return false;
+	}
+	exited = false;
+
+	close(inpipefd[1]);
+	close(outpipefd[0]);
+	if(sharedTransport) {
+		sharedTransport->CloseChildDescriptors();
+	}
+
+	// Writes must never block indefinitely while the subprocess is
+	// itself blocked writing replies we have not read yet; see
+	// SendOutputLine.
+	fcntl(outpipefd[1], F_SETFL, fcntl(outpipefd[1], F_GETFL) | O_NONBLOCK);
+
+	alive = true;
+	return true;
+}
+
+void EnrichableAnalyzerWorker::Stop() {
+	if(commandPid > 0) {
+		close(inpipefd[0]);
+		close(outpipefd[1]);
+
+		// End-of-file on its input lets the script finish on its own;
+		// one that does not is interrupted, and then killed.  Either
+		// way it is reaped, so no zombie is left behind.
+		if(!WaitForExit(WORKER_EXIT_TIMEOUT_MS)) {
+			kill(commandPid, SIGINT);
+			if(!WaitForExit(WORKER_EXIT_TIMEOUT_MS)) {
+				kill(commandPid, SIGKILL);
+				waitpid(commandPid, NULL, 0);
+			}
+		}
+		commandPid = 0;
+		exited = false;
+	}
+	alive = false;
+	sharedActive = false;
+	sharedTransport.reset();
+}
+
+bool EnrichableAnalyzerWorker::HasExited() {
+	return commandPid <= 0 || WaitForExit(0);
+}
+
+bool EnrichableAnalyzerWorker::WaitForExit(int timeoutMs) {
+	std::chrono::steady_clock::time_point waitDeadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+	while(!exited) {
+		pid_t result = waitpid(commandPid, NULL, WNOHANG);
+		if(result == commandPid || (result < 0 && errno != EINTR)) {
+			exited = true;
+			break;
+		}
+		if(std::chrono::steady_clock::now() >= waitDeadline) {
+			return false;
+		}
+		usleep(WORKER_EXIT_POLL_US);
+	}
+
+	return true;
+}
+
+void EnrichableAnalyzerWorker::ClosePipes() {
+	close(inpipefd[0]);
+	close(inpipefd[1]);
+	close(outpipefd[0]);
+	close(outpipefd[1]);
+}
+
+bool EnrichableAnalyzerWorker::SharedMemoryAvailable() {
+	return sharedTransport != nullptr;
+}
+
+bool EnrichableAnalyzerWorker::UseSharedMemory() {
+	// Only valid between exchanges, when nothing is left in the pipe.
+	if(!sharedTransport) {
+		return false;
+	}
+	sharedActive = true;
+	return true;
+}
+
+bool EnrichableAnalyzerWorker::IsAlive() {
+	return alive;
+}
+
+void EnrichableAnalyzerWorker::Lock() {
+	if(workerLock.try_lock()) {
+		lockAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+	workerLock.lock();
+	lockAcquisitions.fetch_add(1, std::memory_order_relaxed);
+	lockContentions.fetch_add(1, std::memory_order_relaxed);
+	lockWaitNanoseconds.fetch_add(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count(),
+		std::memory_order_relaxed
+	);
+}
+
+bool EnrichableAnalyzerWorker::TryLockUntil(std::chrono::steady_clock::time_point lockDeadline) {
+	if(lockDeadline == std::chrono::steady_clock::time_point::max()) {
+		Lock();
+		return true;
+	}
+	if(workerLock.try_lock()) {
+		lockAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+	if(!workerLock.try_lock_until(lockDeadline)) {
+		return false;
+	}
+	lockAcquisitions.fetch_add(1, std::memory_order_relaxed);
+	lockContentions.fetch_add(1, std::memory_order_relaxed);
+	lockWaitNanoseconds.fetch_add(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStart).count(),
+		std::memory_order_relaxed
+	);
+
+	return true;
+}
+
+void EnrichableAnalyzerWorker::Unlock() {
+	workerLock.unlock();
+}
+
+void EnrichableAnalyzerWorker::SetDeadline(std::chrono::steady_clock::time_point readDeadline) {
+	deadline = readDeadline;
+	timedOut = false;
+}
+
+void EnrichableAnalyzerWorker::ClearDeadline() {
+	deadline = std::chrono::steady_clock::time_point::max();
+	timedOut = false;
+}
+
+bool EnrichableAnalyzerWorker::TimedOut() {
+	return timedOut;
+}
+
+void EnrichableAnalyzerWorker::SetConcurrentReader(bool concurrent) {
+	concurrentReader = concurrent;
+	if(sharedTransport) {
+		sharedTransport->SetConcurrentReader(concurrent);
+	}
+}
+
+U64 EnrichableAnalyzerWorker::GetLockAcquisitions() {
+	return lockAcquisitions.load(std::memory_order_relaxed);
+}
+
+U64 EnrichableAnalyzerWorker::GetLockContentions() {
+	return lockContentions.load(std::memory_order_relaxed);
+}
+
+U64 EnrichableAnalyzerWorker::GetLockWaitNanoseconds() {
+	return lockWaitNanoseconds.load(std::memory_order_relaxed);
+}
+
+U64 EnrichableAnalyzerWorker::GetBytesSent() {
+	return bytesSent.load(std::memory_order_relaxed);
+}
+
+U64 EnrichableAnalyzerWorker::GetBytesReceived() {
+	return bytesReceived.load(std::memory_order_relaxed);
+}
+
+void EnrichableAnalyzerWorker::ResetStatistics() {
+	lockAcquisitions.store(0, std::memory_order_relaxed);
+	lockContentions.store(0, std::memory_order_relaxed);
+	lockWaitNanoseconds.store(0, std::memory_order_relaxed);
+	bytesSent.store(0, std::memory_order_relaxed);
+	bytesReceived.store(0, std::memory_order_relaxed);
+}
+
+bool EnrichableAnalyzerWorker::SendOutputLine(const char* buffer, unsigned bufferLength) {
+	#ifdef SUBPROCESS_DEBUG
+		std::cerr << ">> ";
+		std::cerr.write(buffer, bufferLength);
+	#endif
+
+	if(!alive) {
+		return false;
+	}
+	bytesSent.fetch_add(bufferLength, std::memory_order_relaxed);
+
+	while(sharedActive && bufferLength > 0) {
+		size_t written = sharedTransport->Write(buffer, bufferLength);
+		buffer += written;
+		bufferLength -= written;
+		if(bufferLength == 0) {
+			break;
+		}
+
+		// The ring is full; as with the pipe, buffer replies while the
+		// script works through our requests.
+		if(!sharedTransport->Wait(EnrichableSharedTransport::WaitWritable, -1, inpipefd[0])) {
+			std::cerr << "Analyzer subprocess exited; disabling analyzer subprocess.\n";
+			alive = false;
+			return false;
+		}
+		if(!concurrentReader && sharedTransport->Readable() && !FillInputBuffer()) {
+			return false;
+		}
+	}
+
+	while(bufferLength > 0) {
+		ssize_t written = write(outpipefd[1], buffer, bufferLength);
+		if(written >= 0) {
+			buffer += written;
+			bufferLength -= written;
+			continue;
+		} else if(errno == EINTR) {
+			continue;
+		} else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			std::cerr << "Failed to write to analyzer subprocess: ";
+			std::cerr << errno;
+			std::cerr << "\n";
+			alive = false;
+			return false;
+		}
+
+		// The pipe is full.  With pipelined requests outstanding, the
+		// subprocess may in turn be waiting for us to read its replies,
+		// so buffer whatever it has written while we wait for room,
+		// unless another thread is already reading it.
+		struct pollfd fds[2];
+		fds[0].fd = outpipefd[1];
+		fds[0].events = POLLOUT;
+		fds[1].fd = inpipefd[0];
+		fds[1].events = POLLIN;
+		if(poll(fds, concurrentReader ? 1 : 2, -1) < 0 && errno != EINTR) {
+			alive = false;
+			return false;
+		}
+		if(!concurrentReader && (fds[1].revents & (POLLIN | POLLHUP))) {
+			if(!FillInputBuffer()) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool EnrichableAnalyzerWorker::HasBufferedInput() {
+	return inputStart < inputEnd;
+}
+
+bool EnrichableAnalyzerWorker::InputReadable(int timeoutMs) {
+	if(sharedActive) {
+		return alive &&
+			sharedTransport->Wait(EnrichableSharedTransport::WaitReadable, timeoutMs, inpipefd[0]) &&
+			sharedTransport->Readable();
+	}
+
+	struct pollfd fds[1];
+	fds[0].fd = inpipefd[0];
+	fds[0].events = POLLIN;
+
+	return alive && poll(fds, 1, timeoutMs) > 0;
+}
+
+bool EnrichableAnalyzerWorker::FillInputBuffer() {
+	if(!alive) {
+		return false;
+	}
+
+	// Keep any bytes not yet handed out as lines, making room at the end
+	// of the buffer either by discarding consumed bytes or by growing it.
+	if(inputStart == inputEnd) {
+		inputStart = 0;
+		inputEnd = 0;
+	} else if(inputEnd == inputBuffer.size()) {
+		if(inputStart > 0) {
+			memmove(&inputBuffer[0], &inputBuffer[inputStart], inputEnd - inputStart);
+			inputEnd -= inputStart;
+			inputStart = 0;
+		} else {
+			inputBuffer.resize(inputBuffer.size() * 2);
+		}
+	}
+
+	if(deadline != std::chrono::steady_clock::time_point::max()) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		int remainingMs = 0;
+		if(deadline > now) {
+			remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+		}
+		if(!InputReadable(remainingMs) && std::chrono::steady_clock::now() >= deadline) {
+			timedOut = true;
+			return false;
+		}
+	}
+
+	while(sharedActive) {
+		size_t count = sharedTransport->Read(inputBuffer.data() + inputEnd, inputBuffer.size() - inputEnd);
+		if(count > 0) {
+			inputEnd += count;
+			bytesReceived.fetch_add(count, std::memory_order_relaxed);
+			return true;
+		}
+		// The wait above may return a little before the deadline; the
+		// deadline still bounds this one.
+		int waitMs = -1;
+		if(deadline != std::chrono::steady_clock::time_point::max()) {
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if(now >= deadline) {
+				timedOut = true;
+				return false;
+			}
+			waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+		}
+		if(!sharedTransport->Wait(EnrichableSharedTransport::WaitReadable, waitMs, inpipefd[0])) {
+			std::cerr << "Analyzer subprocess exited; disabling analyzer subprocess.\n";
+			alive = false;
+			return false;
+		}
+	}
+
+	while(true) {
+		ssize_t count = read(inpipefd[0], inputBuffer.data() + inputEnd, inputBuffer.size() - inputEnd);
+		if(count > 0) {
+			inputEnd += count;
+			bytesReceived.fetch_add(count, std::memory_order_relaxed);
+			return true;
+		} else if(count < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if(count == 0) {
+			std::cerr << "Analyzer subprocess closed its output; ";
+		} else {
+			std::cerr << "Failed to read from analyzer subprocess: ";
+			std::cerr << errno;
+			std::cerr << "; ";
+		}
+		std::cerr << "disabling analyzer subprocess.\n";
+		alive = false;
+		return false;
+	}
+}
+
+bool EnrichableAnalyzerWorker::GetInputLine(std::string& line) {
+	const char* view;
+	size_t length;
+	bool result = GetInputLine(view, length);
+
+	line.assign(view, length);
+
+	return result;
+}
+
+bool EnrichableAnalyzerWorker::GetInputLine(const char*& line, size_t& length) {
+	size_t scanned = 0;
+
+	line = inputBuffer.data() + inputStart;
+	length = 0;
+
+	while(true) {
+		const char* begin = inputBuffer.data() + inputStart;
+		size_t available = inputEnd - inputStart;
+		const char* newline = (const char*)memchr(
+			begin + scanned,
+			LINE_SEPARATOR,
+			available - scanned
+		);
+
+		if(newline != NULL) {
+			line = begin;
+			length = newline - begin;
+			inputStart += length + 1;
+			break;
+		}
+
+		// No complete line buffered yet; pull the next chunk from the
+		// pipe without rescanning what we have already looked at.  A
+		// partial line is kept if we merely ran out of time.
+		scanned = available;
+		if(!FillInputBuffer()) {
+			if(!alive) {
+				inputStart = inputEnd;
+			}
+			line = inputBuffer.data() + inputStart;
+			break;
+		}
+	}
+
+	#ifdef SUBPROCESS_DEBUG
+		std::cerr << "<< ";
+		std::cerr.write(line, length);
+		std::cerr << '\n';
+	#endif
+
+	return length > 0;
+}
+
+bool EnrichableAnalyzerWorker::GetInputBytes(char* buffer, size_t length) {
+	if(!PeekInputBytes(buffer, length)) {
+		return false;
+	}
+	inputStart += length;
+
+	return true;
+}
+
+const char* EnrichableAnalyzerWorker::GetInputBytes(size_t length) {
+	if(!PeekInputBytes(NULL, length)) {
+		return NULL;
+	}
+	inputStart += length;
+
+	return inputBuffer.data() + inputStart - length;
+}
+
+bool EnrichableAnalyzerWorker::PeekInputBytes(char* buffer, size_t length) {
+	while(inputEnd - inputStart < length) {
+		if(!FillInputBuffer()) {
+			if(!alive) {
+				inputStart = inputEnd;
+			}
+			return false;
+		}
+	}
+	if(buffer != NULL) {
+		memcpy(buffer, inputBuffer.data() + inputStart, length);
+	}
+
+	return true;
+}
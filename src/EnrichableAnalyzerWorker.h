@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <atomic>
+
+#include "LogicPublicTypes.h"
+#include "EnrichableSharedTransport.h"
+
+#include <sys/types.h>
+
+// Number of bytes requested from the subprocess per read() call
+#define INPUT_CHUNK_SIZE 65536
+
+// How long a stopping script is given to exit, first after its input is
+// closed and then after it is interrupted, before it is killed; and how
+// often it is checked on meanwhile.
+#define WORKER_EXIT_TIMEOUT_MS 250
+#define WORKER_EXIT_POLL_US 2000
+
+// One running copy of the enrichment script and the pipes connecting us
+// to it, or, once the script has opted in, the shared memory rings.
+// Callers must hold the worker's lock around each exchange, except that
+// in tagged mode one thread reads every reply while others, holding the
+// lock, only write requests.
+class EnrichableAnalyzerWorker {
+	public:
+		EnrichableAnalyzerWorker();
+		virtual ~EnrichableAnalyzerWorker();
+
+		bool Start(const std::string& command, bool sharedMemory = false);
+		bool SharedMemoryAvailable();
+		bool UseSharedMemory();
+		void Stop();
+		bool IsAlive();
+		// Whether the script has exited, whether or not we have noticed
+		// through its pipes.
+		bool HasExited();
+
+		void Lock();
+		bool TryLockUntil(std::chrono::steady_clock::time_point deadline);
+		void Unlock();
+
+		// While a deadline is set, reads that would wait past it fail
+		// instead, leaving whatever was received buffered and the worker
+		// alive; TimedOut() tells such a failure apart from the script
+		// having exited.
+		void SetDeadline(std::chrono::steady_clock::time_point deadline);
+		void ClearDeadline();
+		bool TimedOut();
+
+		// Set while another thread reads the script's replies, so that a
+		// write waiting for room leaves the input to that thread instead
+		// of buffering it.
+		void SetConcurrentReader(bool concurrent);
+
+		// How often taking this worker's lock meant waiting for another
+		// thread, and for how long in total.
+		U64 GetLockAcquisitions();
+		U64 GetLockContentions();
+		U64 GetLockWaitNanoseconds();
+
+		// Traffic exchanged with the script over either transport.
+		U64 GetBytesSent();
+		U64 GetBytesReceived();
+		// Zeroes the counts above, when a warm worker starts a new run.
+		void ResetStatistics();
+
+		bool SendOutputLine(const char* buffer, unsigned bufferLength);
+		bool GetInputLine(std::string& line);
+		bool GetInputBytes(char* buffer, size_t length);
+		// As above, but handing out the bytes where they lie in the input
+		// buffer rather than copying them; they remain valid only until
+		// the next read from this worker.
+		bool GetInputLine(const char*& line, size_t& length);
+		const char* GetInputBytes(size_t length);
+		bool PeekInputBytes(char* buffer, size_t length);
+		bool HasBufferedInput();
+		bool InputReadable(int timeoutMs);
+	protected:
+		bool FillInputBuffer();
+		bool WaitForExit(int timeoutMs);
+		void ClosePipes();
+
+		std::atomic<bool> alive;
+		std::atomic<bool> concurrentReader;
+		std::timed_mutex workerLock;
+		// Counted by whichever thread holds the lock or reads replies, and
+		// read while they run; only the totals matter, so relaxed.
+		std::atomic<U64> lockAcquisitions{0};
+		std::atomic<U64> lockContentions{0};
+		std::atomic<U64> lockWaitNanoseconds{0};
+		std::atomic<U64> bytesSent{0};
+		std::atomic<U64> bytesReceived{0};
+
+		pid_t commandPid = 0;
+		// Set once the script has been reaped, so its pid is not waited
+		// on or signalled again.
+		bool exited = false;
+		int inpipefd[2];
+		int outpipefd[2];
+
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		bool timedOut = false;
+
+		// Created before the script starts so that it inherits the
+		// descriptors; used for all traffic once sharedActive is set.
+		std::unique_ptr<EnrichableSharedTransport> sharedTransport;
+		bool sharedActive = false;
+
+		// Bytes read from the subprocess but not yet handed out as lines;
+		// the unconsumed region is [inputStart, inputEnd).
+		std::vector<char> inputBuffer;
+		size_t inputStart = 0;
+		size_t inputEnd = 0;
+};
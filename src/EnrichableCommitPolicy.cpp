@@ -0,0 +1,66 @@
+#include "EnrichableCommitPolicy.h"
+
+EnrichableCommitPolicy::EnrichableCommitPolicy()
+{
+	Reset(0, 1);
+}
+
+EnrichableCommitPolicy::~EnrichableCommitPolicy()
+{
+}
+
+void EnrichableCommitPolicy::Reset(U32 intervalMs, U32 _frameLimit) {
+	interval = std::chrono::milliseconds(intervalMs);
+	frameLimit = _frameLimit > 1 ? _frameLimit : 1;
+	pending = false;
+	pendingFrames = 0;
+	started = Clock::now();
+	commits = 0;
+	frames = 0;
+}
+
+void EnrichableCommitPolicy::AddFrame() {
+	AddChange();
+	pendingFrames++;
+	frames++;
+}
+
+void EnrichableCommitPolicy::AddChange() {
+	if(!pending) {
+		pending = true;
+		firstPending = Clock::now();
+	}
+}
+
+bool EnrichableCommitPolicy::Pending() const {
+	return pending;
+}
+
+bool EnrichableCommitPolicy::Due() const {
+	if(!pending) {
+		return false;
+	}
+	if(pendingFrames >= frameLimit) {
+		return true;
+	}
+	return Clock::now() - firstPending >= interval;
+}
+
+void EnrichableCommitPolicy::Committed() {
+	pending = false;
+	pendingFrames = 0;
+	commits++;
+}
+
+void EnrichableCommitPolicy::Dump(std::ostream& out) const {
+	double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+	out << "Results committed " << commits << " times for " << frames << " frames";
+	if(seconds > 0) {
+		out << " over " << seconds << " s (" << commits / seconds << " per second)";
+	}
+	out << "\n";
+}
+
+U64 EnrichableCommitPolicy::GetCommitCount() const {
+	return commits;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+
+#include <chrono>
+#include <ostream>
+
+// Decides when the analysis thread publishes its results to the display.
+// Committing after every byte competes with decoding on a busy bus, and
+// the display gains nothing from it; results are instead committed once
+// the oldest uncommitted change is a given age, or enough frames have
+// built up, whichever comes first.  The analyzer also commits whenever
+// it has decoded everything captured so far.
+class EnrichableCommitPolicy {
+	public:
+		EnrichableCommitPolicy();
+		virtual ~EnrichableCommitPolicy();
+
+		// Starts a run; an interval of 0 or a frame limit of 1 commits
+		// after every frame.
+		void Reset(U32 intervalMs, U32 frameLimit);
+
+		void AddFrame();
+		// Something other than a frame changed, such as a marker or packet.
+		void AddChange();
+		bool Pending() const;
+		bool Due() const;
+		void Committed();
+
+		// Writes the number of commits this run, and their rate, to out.
+		void Dump(std::ostream& out) const;
+		U64 GetCommitCount() const;
+	protected:
+		typedef std::chrono::steady_clock Clock;
+
+		std::chrono::milliseconds interval;
+		U32 frameLimit;
+
+		bool pending;
+		U32 pendingFrames;
+		Clock::time_point firstPending;
+
+		Clock::time_point started;
+		U64 commits;
+		U64 frames;
+};
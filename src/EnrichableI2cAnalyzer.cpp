@@ -4,12 +4,18 @@
 
 #include <iostream>
 #include <sstream>
+#include <string.h>
 
 EnrichableI2cAnalyzer::EnrichableI2cAnalyzer()
 :	Analyzer2(),  
 	mSettings( new EnrichableI2cAnalyzerSettings() ),
 	mSimulationInitilized( false ),
-	mSubprocess( new EnrichableAnalyzerSubprocess() )
+	mSubprocess( new EnrichableAnalyzerSubprocess() ),
+	mPendingMarkerFirst( 0 ),
+	mPendingMarkerCount( 0 ),
+	mPacketFirstFrame( 0 ),
+	mCurrentAddress( UNKNOWN_ADDRESS ),
+	mRegisterMap( new EnrichableRegisterMap() )
 {
 	SetAnalyzerSettings( mSettings.get() );
 }
@@ -17,11 +23,19 @@ EnrichableI2cAnalyzer::EnrichableI2cAnalyzer()
 EnrichableI2cAnalyzer::~EnrichableI2cAnalyzer()
 {
 	KillThread();
+	if( mCommitPolicy.GetCommitCount() > 0 )
+		mCommitPolicy.Dump( std::cerr );
 }
 
 void EnrichableI2cAnalyzer::SetupResults()
 {
-	mResults.reset( new EnrichableI2cAnalyzerResults( this, mSettings.get(), mSubprocess.get() ) );
+	//compiled once per run, before any frame is decoded or displayed.
+	std::shared_ptr< EnrichableRegisterMap > register_map( new EnrichableRegisterMap() );
+	if( strlen( mSettings->mRegisterMapFile ) > 0 )
+		register_map->Load( mSettings->mRegisterMapFile );
+	mRegisterMap = register_map;
+
+	mResults.reset( new EnrichableI2cAnalyzerResults( this, mSettings.get(), mSubprocess.get(), &mTransactions, mRegisterMap, &mRegisterContexts ) );
 	SetAnalyzerResults( mResults.get() );
 	mResults->AddChannelBubblesWillAppearOn( mSettings->mSdaChannel );
 }
@@ -29,262 +43,333 @@ void EnrichableI2cAnalyzer::SetupResults()
 void EnrichableI2cAnalyzer::WorkerThread()
 {
 	mSampleRateHz = GetSampleRate();
-	mNeedAddress = true;
+	//the last run is over; report how often it published its results.
+	if( mCommitPolicy.GetCommitCount() > 0 )
+		mCommitPolicy.Dump( std::cerr );
+	mCommitPolicy.Reset( mSettings->mCommitInterval, mSettings->mCommitFrameLimit );
 
 	mSubprocess->SetParserCommand(mSettings->mParserCommand);
+	mSubprocess->SetPoolSize(mSettings->mPoolSize);
+	mSubprocess->SetPoolDispatch(
+		mSettings->mPoolDispatch == POOL_ROUND_ROBIN ?
+			EnrichableAnalyzerSubprocess::DispatchRoundRobin :
+			EnrichableAnalyzerSubprocess::DispatchFrameHash
+	);
+	mSubprocess->SetDedicatedMarkerWorker(mSettings->mDedicatedMarkerProcess);
+	mSubprocess->SetSharedMemoryTransport(mSettings->mSharedMemoryTransport);
+	mSubprocess->SetDeadlines(mSettings->mBubbleDeadline, mSettings->mTabularDeadline);
+	mSubprocess->SetPersistentCache(mSettings->mPersistentCacheDirectory, mSampleRateHz);
 	mSubprocess->Start();
+	//CollectMarkers never lets more than the pipeline depth build up.
+	mPendingMarkerArrows.assign( mSettings->mMarkerPipelineDepth > 1 ? mSettings->mMarkerPipelineDepth : 1, std::vector<U64>() );
+	mPendingMarkerFirst = 0;
+	mPendingMarkerCount = 0;
+	mPacketFrames.clear();
+	mTransactions.Clear();
+	mRegisterPointers.Clear();
+	mRegisterContexts.Clear();
+	mCurrentAddress = UNKNOWN_ADDRESS;
 
 	mSda = GetAnalyzerChannelData( mSettings->mSdaChannel );
 	mScl = GetAnalyzerChannelData( mSettings->mSclChannel );
 
-	AdvanceToStartBit(); 
-	mScl->AdvanceToNextEdge(); //now scl is low.
+	mDecoder.Reset( mScl->GetBitState() == BIT_HIGH, mSda->GetBitState() == BIT_HIGH );
+	mDecoderEvents.resize( DECODER_EVENT_CHUNK );
+	mDecoderArrows.resize( DECODER_EVENT_CHUNK * I2C_DECODER_BITS );
 
 	for( ; ; )
 	{
-		GetByte();
+		FetchTransitions();
+		DecodeTransitions();
 		CheckIfThreadShouldExit();
 	}
-
-	mSubprocess->Stop();
 }
 
-void EnrichableI2cAnalyzer::GetByte()
+void EnrichableI2cAnalyzer::FetchTransitions()
 {
-	mArrowLocataions.clear();
-	U64 value;
-	DataBuilder byte;
-	byte.Reset( &value, AnalyzerEnums::MsbFirst, 8 );
-	U64 starting_stample = 0;
-	U64 potential_ending_sample = 0;
-	
-	for( U32 i=0; i<8; i++ )
+	//gather the transitions already captured on both channels in sample order, so that the decoder is given every transition up to the last one on either.
+	mSclTransitions.clear();
+	mSdaTransitions.clear();
+
+	//with nothing new captured, wait for the clock; SDA only changes alone for a START or STOP, which the clock soon follows.
+	if( !mScl->DoMoreTransitionsExistInCurrentData() && !mSda->DoMoreTransitionsExistInCurrentData() )
 	{
-		BitState bit_state;
-		U64 scl_rising_edge;
-		bool result = GetBitPartOne( bit_state, scl_rising_edge, potential_ending_sample );
-		result &= GetBitPartTwo();
-		if( result == true )
+		//everything captured so far is decoded, and the display may not see more for a while: publish it all now, the script's last markers included.
+		CollectMarkers( true );
+		if( mCommitPolicy.Pending() )
+			CommitResults();
+		mScl->AdvanceToNextEdge();
+		U64 clock_edge = mScl->GetSampleNumber();
+		while( mSda->WouldAdvancingToAbsPositionCauseTransition( clock_edge ) )
 		{
-			mArrowLocataions.push_back( scl_rising_edge );
-			byte.AddBit( bit_state );
+			mSda->AdvanceToNextEdge();
+			mSdaTransitions.push_back( mSda->GetSampleNumber() );
+		}
+		mSclTransitions.push_back( clock_edge );
+	}
 
-			if( i == 0 )
-				starting_stample = scl_rising_edge;
+	U64 last_sample = 0;
+	for( ; ; )
+	{
+		bool scl_more = mScl->DoMoreTransitionsExistInCurrentData();
+		bool sda_more = mSda->DoMoreTransitionsExistInCurrentData();
+		if( !scl_more && !sda_more )
+			break;
+
+		bool take_scl = scl_more && ( !sda_more || mScl->GetSampleOfNextEdge() < mSda->GetSampleOfNextEdge() );
+		U64 next_sample = take_scl ? mScl->GetSampleOfNextEdge() : mSda->GetSampleOfNextEdge();
+		//a full chunk still takes any transitions at the same sample as its last, so that none is split from its partner.
+		if( mSclTransitions.size() + mSdaTransitions.size() >= DECODER_TRANSITION_CHUNK && next_sample != last_sample )
+			break;
+
+		if( take_scl )
+		{
+			mScl->AdvanceToNextEdge();
+			mSclTransitions.push_back( next_sample );
 		}else
 		{
-			return;
+			mSda->AdvanceToNextEdge();
+			mSdaTransitions.push_back( next_sample );
+		}
+		last_sample = next_sample;
+	}
+}
+
+void EnrichableI2cAnalyzer::DecodeTransitions()
+{
+	EnrichableI2cTransitions input;
+	input.scl = mSclTransitions.data();
+	input.sclCount = mSclTransitions.size();
+	input.sda = mSdaTransitions.data();
+	input.sdaCount = mSdaTransitions.size();
+
+	EnrichableI2cOutput output;
+	output.events = mDecoderEvents.data();
+	output.eventCapacity = mDecoderEvents.size();
+	output.arrows = mDecoderArrows.data();
+	output.arrowCapacity = mDecoderArrows.size();
+
+	bool done = false;
+	while( !done )
+	{
+		output.eventCount = 0;
+		output.arrowCount = 0;
+		done = mDecoder.Decode( input, output );
+
+		const uint64_t* arrows = output.arrows;
+		for( size_t i=0; i<output.eventCount; i++ )
+		{
+			const EnrichableI2cEvent& event = output.events[ i ];
+			switch( event.kind )
+			{
+			case EnrichableI2cDecoder::EventFrame:
+				RecordFrame( event, arrows );
+				arrows += I2C_DECODER_BITS;
+				break;
+			case EnrichableI2cDecoder::EventBusStart:
+				CollectMarkers( true );
+				mResults->AddMarker( event.startingSample, AnalyzerResults::Start, mSettings->mSdaChannel );
+				break;
+			default:
+				RecordStartStopBit( event.startingSample, event.kind == EnrichableI2cDecoder::EventStart );
+				break;
+			}
 		}
 	}
+}
+
+void EnrichableI2cAnalyzer::RecordFrame( const EnrichableI2cEvent& event, const uint64_t* arrows )
+{
+	mArrowLocataions.assign( arrows, arrows + I2C_DECODER_BITS );
 
-	BitState ack_bit_state;
-	U64 scl_rising_edge;
-	S64 last_valid_sample = mScl->GetSampleNumber();
-	bool result = GetBitPartOne( ack_bit_state, scl_rising_edge, potential_ending_sample );//GetBit( ack_bit_state, scl_rising_edge );
-	
 	Frame frame;
-	frame.mStartingSampleInclusive = starting_stample;
-	frame.mEndingSampleInclusive = result ? potential_ending_sample : last_valid_sample;
-	frame.mData1 = U8( value );
+	frame.mStartingSampleInclusive = event.startingSample;
+	frame.mEndingSampleInclusive = event.endingSample;
+	frame.mData1 = event.value;
 	frame.mData2 = U8( 0 );
 
-	if( !result )
+	if( event.ack == I2C_DECODER_MISSING_ACK )
 		frame.mFlags = I2C_MISSING_FLAG_ACK;
-	else if( ack_bit_state == BIT_HIGH )
+	else if( event.ack == I2C_DECODER_NAK )
 		frame.mFlags = DISPLAY_AS_WARNING_FLAG;
 	else
 		frame.mFlags = I2C_FLAG_ACK;
 
-	if( mNeedAddress == true && result == true ) //if result is false, then we have already recorded a stop bit and toggled mNeedAddress
-	{
-		mNeedAddress = false;
-		frame.mType = I2cAddress;
-	}else
-	{
-		frame.mType = I2cData;
-	}
+	frame.mType = event.address ? I2cAddress : I2cData;
+	if( frame.mType == I2cAddress )
+		mCurrentAddress = U8( frame.mData1 >> 1 );
+	U32 register_context = 0;
+	if( mRegisterMap->IsLoaded() )
+		register_context = mRegisterPointers.GetContext( *mRegisterMap, mCurrentAddress, frame.mType == I2cAddress, frame );
 	U64 frameIndex = mResults->AddFrame( frame );
+	mSubprocess->AddCaptureFrame( frame );
+	if( register_context != 0 )
+		mRegisterContexts.Add( frameIndex, register_context );
+
+	if( mPacketFrames.empty() )
+		mPacketFirstFrame = frameIndex;
+	mPacketFrames.push_back( frame );
 
 	U32 count = mArrowLocataions.size();
 	for( U32 i=0; i<count; i++ )
 		mResults->AddMarker( mArrowLocataions[i], AnalyzerResults::UpArrow, mSettings->mSclChannel );
+	if( ( register_context >> 16 ) == REGISTER_MAP_CONTEXT_REGISTER )
+	{
+		CollectMarkers( true );
+		ApplyRegisterMapMarkers( register_context, frame );
+	}
 
-	if(mSubprocess->MarkerEnabled()) {
-		std::vector<EnrichableAnalyzerSubprocess::Marker> markers = mSubprocess->EmitMarker(
-			mResults->GetNumPackets(),
-			frameIndex,
-			frame,
-			count
-		);
-
-		Channel* channel = NULL;
-		for(const EnrichableAnalyzerSubprocess::Marker& marker : markers) {
-			if(marker.channelName == "sda") {
-				channel = &mSettings->mSdaChannel;
-			}
-			if(channel != NULL) {
-				mResults->AddMarker(
-					mArrowLocataions[marker.sampleNumber],
-					marker.markerType,
-					*channel
-				);
-			} else {
-				std::cerr << "Received marker request for invalid marker: ";
-				std::cerr << marker.channelName;
-				std::cerr << " ignoring.\n";
-			}
+	//frames the register map describes are shown from it alone, so the script is not asked for their markers either.
+	bool mapped = register_context != 0 && mRegisterMap->GetText( register_context, frame ) != NULL;
+	if(!mapped && mSubprocess->MarkerEnabled() && mSubprocess->Subscribes(mCurrentAddress, frame)) {
+		if( mSettings->mMarkerPipelineDepth <= 1 )
+		{
+			mSubprocess->EmitMarker(
+				mResults->GetNumPackets(),
+				frameIndex,
+				frame,
+				count,
+				mMarkers
+			);
+			ApplyMarkers( mArrowLocataions, mMarkers );
+		}else
+		{
+			mSubprocess->SendMarker(
+				mResults->GetNumPackets(),
+				frameIndex,
+				frame,
+				count
+			);
+			std::vector<U64>& pending = mPendingMarkerArrows[ ( mPendingMarkerFirst + mPendingMarkerCount ) % mPendingMarkerArrows.size() ];
+			pending.assign( mArrowLocataions.begin(), mArrowLocataions.end() );
+			mPendingMarkerCount++;
+			CollectMarkers( false );
 		}
 	}
 
-	mResults->CommitResults();
-
-	result &= GetBitPartTwo();
+	mCommitPolicy.AddFrame();
+	if( mCommitPolicy.Due() )
+		CommitResults();
 }
 
-bool EnrichableI2cAnalyzer::GetBit( BitState& bit_state, U64& sck_rising_edge )
+void EnrichableI2cAnalyzer::RecordStartStopBit( U64 sample, bool repeated_start )
 {
-	//SCL must be low coming into this function
-	mScl->AdvanceToNextEdge(); //posedge
-	sck_rising_edge = mScl->GetSampleNumber();
-	mSda->AdvanceToAbsPosition( sck_rising_edge );  //data read on SCL posedge
-
-	bit_state = mSda->GetBitState();
-	bool result = true;
-
-	//this while loop is only important if you need to be careful and check for things that that might happen at the very end of a data set, and you don't want to get stuck waithing on a channel that never changes.
-	while( mScl->DoMoreTransitionsExistInCurrentData() == false )
+	//markers must be added to each channel in sample order, so the earlier frames' script markers go first.
+	CollectMarkers( true );
+	if( repeated_start )
 	{
-		// there are no more SCL transtitions, at least yet.
-		if( mSda->DoMoreTransitionsExistInCurrentData() == true )
-		{
-			//there ARE some SDA transtions, let's double check to make sure there's still no SDA activity
-			if( mScl->DoMoreTransitionsExistInCurrentData() == true )
-				break;
-
-			//ok, for sure we can advance to the next SDA edge without running past any SCL events.
-			mSda->AdvanceToNextEdge();
-			RecordStartStopBit();
-			result = false;
-			//return result;
-		}
+		//negedge -> START / restart
+		mResults->AddMarker( sample, AnalyzerResults::Start, mSettings->mSdaChannel );
+	}else
+	{
+		//posedge -> STOP
+		mResults->AddMarker( sample, AnalyzerResults::Stop, mSettings->mSdaChannel );
 	}
 
-	mScl->AdvanceToNextEdge(); //negedge; we'll leave the clock here
-	while( mSda->WouldAdvancingToAbsPositionCauseTransition( mScl->GetSampleNumber() - 1 ) == true )
+	U64 packet_id = mResults->CommitPacketAndStartNewPacket();
+	if( !mPacketFrames.empty() )
 	{
-		//clock is high -- SDA changes indicate start, stop, etc.
-		mSda->AdvanceToNextEdge();
-		RecordStartStopBit();
-		result = false;
+		//sent after the packet's last marker request, so the script sees the packet whole.
+		if( packet_id != INVALID_RESULT_INDEX )
+		{
+			if( mSubprocess->SubscribesAddress( mCurrentAddress ) )
+				mSubprocess->SendPacket( packet_id, mPacketFirstFrame, mPacketFrames );
+			RecordTransactions( packet_id, repeated_start );
+		}
+		mPacketFrames.clear();
 	}
-
-	return result;
+	mCommitPolicy.AddChange();
+	if( mCommitPolicy.Due() )
+		CommitResults();
 }
 
-bool EnrichableI2cAnalyzer::GetBitPartOne( BitState& bit_state, U64& sck_rising_edge, U64& frame_end_sample )
+void EnrichableI2cAnalyzer::RecordTransactions( U64 packet_id, bool repeated_start )
 {
-	//SCL must be low coming into this function
-	mScl->AdvanceToNextEdge(); //posedge
-	sck_rising_edge = mScl->GetSampleNumber();
-	frame_end_sample = sck_rising_edge;
-	mSda->AdvanceToAbsPosition( sck_rising_edge );  //data read on SCL posedge
-
-	bit_state = mSda->GetBitState();
-
-	//clock is on the rising edge, and data is at the same location.
+	//group register accesses as they are decoded; a pointer write is held until we see whether a read follows it.
+	if( mTransactions.AddPacket( packet_id, mPacketFirstFrame, mPacketFrames, repeated_start ) == 0 )
+		return;
 
-	while( mScl->DoMoreTransitionsExistInCurrentData() == false )
+	U64 transaction_id;
+	EnrichableI2cTransaction transaction;
+	while( mTransactions.TakeCompleted( transaction_id, transaction, mTransactionPayload ) )
 	{
-		// there are no more SCL transtitions, at least yet.
-		if( mSda->DoMoreTransitionsExistInCurrentData() == true )
-		{
-			//there ARE some SDA transtions, let's double check to make sure there's still no SDA activity
-			if( mScl->DoMoreTransitionsExistInCurrentData() == true )
-			{
-				if( mScl->GetSampleOfNextEdge() < mSda->GetSampleOfNextEdge() )
-					break; //there is not a stop or start condition here, everything is normal - we should jump out now.
-			}
-			
+		for( U32 i=0; i<transaction.packetCount; i++ )
+			mResults->AddPacketToTransaction( transaction_id, transaction.firstPacket + i );
 
-			//ok, for sure we can advance to the next SDA edge without running past any SCL events.
-			mSda->AdvanceToNextEdge();
-			mScl->AdvanceToAbsPosition( mSda->GetSampleNumber() ); //clock is still high, we're just moving it to the stop condition here.
-			RecordStartStopBit();
-			return false;
+		if( mSubprocess->TransactionEnabled() && mSubprocess->SubscribesAddress( transaction.address ) )
+		{
+			EnrichableAnalyzerSubprocess::TransactionRequest request;
+			request.transactionId = transaction_id;
+			request.firstFrameIndex = transaction.firstFrame;
+			request.frameCount = transaction.frameCount;
+			request.startingSample = transaction.startingSample;
+			request.endingSample = transaction.endingSample;
+			request.address = transaction.address;
+			request.read = transaction.read;
+			request.registerBytes = transaction.registerBytes;
+			request.registerLength = transaction.registerLength;
+			request.payload = mTransactionPayload.empty() ? NULL : &mTransactionPayload[0];
+			request.payloadLength = mTransactionPayload.size();
+			mSubprocess->SendTransaction( request );
 		}
 	}
-
-	//ok, so there are more transitions on the clock channel, so the above code path didn't run.
-	U64 sample_of_next_clock_falling_edge = mScl->GetSampleOfNextEdge();
-	while( mSda->WouldAdvancingToAbsPositionCauseTransition( sample_of_next_clock_falling_edge - 1 ) == true )
-	{
-		//clock is high -- SDA changes indicate start, stop, etc.
-		mSda->AdvanceToNextEdge();
-		mScl->AdvanceToAbsPosition( mSda->GetSampleNumber() ); //advance the clock to match the SDA channel.
-		RecordStartStopBit();
-		return false;
-	}
-
-	if( mScl->DoMoreTransitionsExistInCurrentData() == true )
-	{
-		frame_end_sample = mScl->GetSampleOfNextEdge();
-	}
-
-	return true;
-	
 }
 
-bool EnrichableI2cAnalyzer::GetBitPartTwo()
+void EnrichableI2cAnalyzer::ApplyRegisterMapMarkers( U32 register_context, const Frame& frame )
 {
-	//the sda and scl should be synced up, and we are either on a stop/start condition (clock high) or we're on a regular bit( clock high).
-	//we also should not expect any more start/stop conditions before the next falling edge, I beleive.
+	const std::vector<EnrichableRegisterMapMarker>* markers = mRegisterMap->GetMarkers( U8( register_context >> 8 ) & 0x7F, U8( register_context ), U8( frame.mData1 ) );
+	if( markers == NULL )
+		return;
 
-	//move to next falling edge.
-	bool result = true;
-	mScl->AdvanceToNextEdge();
-	while( mSda->WouldAdvancingToAbsPositionCauseTransition( mScl->GetSampleNumber() - 1 ) == true )
+	for( const EnrichableRegisterMapMarker& marker : *markers )
 	{
-		//clock is high -- SDA changes indicate start, stop, etc.
-		mSda->AdvanceToNextEdge();
-		RecordStartStopBit();
-		result = false;
+		if( marker.arrow < mArrowLocataions.size() )
+			mResults->AddMarker( mArrowLocataions[ marker.arrow ], marker.markerType, mSettings->mSdaChannel );
 	}
-	return result;
 }
 
-void EnrichableI2cAnalyzer::RecordStartStopBit()
+void EnrichableI2cAnalyzer::CollectMarkers( bool wait_for_all )
 {
-	if( mSda->GetBitState() == BIT_LOW )
+	//apply every reply that has already arrived, then block only as long as needed to get back inside the pipeline window.
+	while( mPendingMarkerCount > 0 )
 	{
-		//negedge -> START / restart
-		mResults->AddMarker( mSda->GetSampleNumber(), AnalyzerResults::Start, mSettings->mSdaChannel );
-	}else
-	{
-		//posedge -> STOP
-		mResults->AddMarker( mSda->GetSampleNumber(), AnalyzerResults::Stop, mSettings->mSdaChannel );
+		bool must_wait = wait_for_all || mPendingMarkerCount >= mSettings->mMarkerPipelineDepth;
+		if( !must_wait && !mSubprocess->MarkerResponseReady() )
+			break;
+
+		if( mSubprocess->ReceiveMarker( mMarkers ) )
+			ApplyMarkers( mPendingMarkerArrows[ mPendingMarkerFirst ], mMarkers );
+		mPendingMarkerFirst = ( mPendingMarkerFirst + 1 ) % mPendingMarkerArrows.size();
+		mPendingMarkerCount--;
 	}
-	
-	mNeedAddress = true;
-	mResults->CommitPacketAndStartNewPacket();
-	mResults->CommitResults( );
-
 }
 
-void EnrichableI2cAnalyzer::AdvanceToStartBit()
+void EnrichableI2cAnalyzer::ApplyMarkers( const std::vector<U64>& arrow_locations, const std::vector<EnrichableAnalyzerSubprocess::Marker>& markers )
 {
-	for( ; ; )
-	{
-		mSda->AdvanceToNextEdge();
-
-		if( mSda->GetBitState() == BIT_LOW )
-		{
-			//SDA negedge
-			mScl->AdvanceToAbsPosition( mSda->GetSampleNumber() );
-			if( mScl->GetBitState() == BIT_HIGH )
-				break;
+	Channel* channel = NULL;
+	for(const EnrichableAnalyzerSubprocess::Marker& marker : markers) {
+		if(strcmp(marker.channelName, "sda") == 0) {
+			channel = &mSettings->mSdaChannel;
+		}
+		if(channel != NULL && marker.sampleNumber < arrow_locations.size()) {
+			mResults->AddMarker(
+				arrow_locations[marker.sampleNumber],
+				marker.markerType,
+				*channel
+			);
+		} else {
+			std::cerr << "Received marker request for invalid marker: ";
+			std::cerr << marker.channelName;
+			std::cerr << " ignoring.\n";
 		}
 	}
-	mResults->AddMarker( mSda->GetSampleNumber(), AnalyzerResults::Start, mSettings->mSdaChannel );
+	mCommitPolicy.AddChange();
+}
+
+void EnrichableI2cAnalyzer::CommitResults()
+{
+	mResults->CommitResults();
+	mCommitPolicy.Committed();
 }
 
 bool EnrichableI2cAnalyzer::NeedsRerun()
@@ -5,6 +5,15 @@
 #include "EnrichableAnalyzerSubprocess.h"
 #include "EnrichableI2cAnalyzerResults.h"
 #include "EnrichableI2cSimulationDataGenerator.h"
+#include "EnrichableI2cTransactions.h"
+#include "EnrichableRegisterMap.h"
+#include "EnrichableI2cDecoder.h"
+#include "EnrichableCommitPolicy.h"
+#include <memory>
+
+//transitions gathered from both channels before each pass of the decoder, and the events and arrows it may emit per call.
+#define DECODER_TRANSITION_CHUNK 4096
+#define DECODER_EVENT_CHUNK 4096
 
 class EnrichableI2cAnalyzerSettings;
 class EnrichableI2cAnalyzer : public Analyzer2
@@ -26,12 +35,15 @@ public:
 #pragma warning( disable : 4251 ) //warning C4251: 'SerialAnalyzer::<...>' : class <...> needs to have dll-interface to be used by clients of class
 
 protected: //functions
-	void AdvanceToStartBit();
-	void GetByte();
-	bool GetBit( BitState& bit_state, U64& sck_rising_edge );
-	bool GetBitPartOne( BitState& bit_state, U64& sck_rising_edge, U64& frame_end_sample );
-	bool GetBitPartTwo();
-	void RecordStartStopBit();
+	void FetchTransitions();
+	void DecodeTransitions();
+	void RecordFrame( const EnrichableI2cEvent& event, const uint64_t* arrows );
+	void RecordStartStopBit( U64 sample, bool repeated_start );
+	void RecordTransactions( U64 packet_id, bool repeated_start );
+	void ApplyRegisterMapMarkers( U32 register_context, const Frame& frame );
+	void CollectMarkers( bool wait_for_all );
+	void ApplyMarkers( const std::vector<U64>& arrow_locations, const std::vector<EnrichableAnalyzerSubprocess::Marker>& markers );
+	void CommitResults();
 protected: //vars
 	std::auto_ptr< EnrichableI2cAnalyzerSettings > mSettings;
 	std::auto_ptr< EnrichableI2cAnalyzerResults > mResults;
@@ -44,8 +56,25 @@ protected: //vars
 
 	//Serial analysis vars:
 	U32 mSampleRateHz;
-	bool mNeedAddress;
+	EnrichableI2cDecoder mDecoder;
+	std::vector<uint64_t> mSclTransitions;  //reused for every pass of the decoder
+	std::vector<uint64_t> mSdaTransitions;
+	std::vector<EnrichableI2cEvent> mDecoderEvents;
+	std::vector<uint64_t> mDecoderArrows;
 	std::vector<U64> mArrowLocataions;
+	std::vector< std::vector<U64> > mPendingMarkerArrows;  //ring of arrow locations of frames awaiting marker replies; slots are reused
+	U32 mPendingMarkerFirst;
+	U32 mPendingMarkerCount;
+	std::vector<EnrichableAnalyzerSubprocess::Marker> mMarkers;  //reused for every reply
+	std::vector<Frame> mPacketFrames;  //frames of the packet being decoded; reused for every packet
+	U64 mPacketFirstFrame;
+	U8 mCurrentAddress;  //7-bit address of the frame being decoded, or UNKNOWN_ADDRESS before the first
+	EnrichableI2cTransactions mTransactions;
+	std::vector<U8> mTransactionPayload;  //reused for every transaction
+	std::shared_ptr< const EnrichableRegisterMap > mRegisterMap;  //shared with the results, and replaced rather than changed
+	EnrichableRegisterPointers mRegisterPointers;
+	EnrichableRegisterContexts mRegisterContexts;  //shared with the results
+	EnrichableCommitPolicy mCommitPolicy;
 
 #pragma warning( pop )
 };
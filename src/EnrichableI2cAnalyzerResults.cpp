@@ -3,6 +3,7 @@
 #include "EnrichableI2cAnalyzer.h"
 #include "EnrichableAnalyzerSubprocess.h"
 #include "EnrichableI2cAnalyzerSettings.h"
+#include "EnrichableI2cTransactions.h"
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
@@ -10,16 +11,30 @@
 EnrichableI2cAnalyzerResults::EnrichableI2cAnalyzerResults(
 	EnrichableI2cAnalyzer* analyzer,
 	EnrichableI2cAnalyzerSettings* settings,
-	EnrichableAnalyzerSubprocess* subprocess
+	EnrichableAnalyzerSubprocess* subprocess,
+	EnrichableI2cTransactions* transactions,
+	std::shared_ptr< const EnrichableRegisterMap > register_map,
+	EnrichableRegisterContexts* register_contexts
 ) :	AnalyzerResults(),
 	mSettings( settings ),
 	mAnalyzer( analyzer ),
-	mSubprocess( subprocess )
+	mSubprocess( subprocess ),
+	mTransactions( transactions ),
+	mRegisterMap( register_map ),
+	mRegisterContexts( register_contexts ),
+	mResponseCache( settings->mResponseCacheSize ),
+	mPrefetchWindow( settings->mBubblePrefetchWindow < settings->mResponseCacheSize ? settings->mBubblePrefetchWindow : settings->mResponseCacheSize )
 {
 }
 
 EnrichableI2cAnalyzerResults::~EnrichableI2cAnalyzerResults()
 {
+	if( mResponseCache.GetHits() + mResponseCache.GetMisses() > 0 )
+	{
+		std::cerr << "Enrichment cache: " << mResponseCache.GetHits() << " hits, ";
+		std::cerr << mResponseCache.GetMisses() << " misses, ";
+		std::cerr << mResponseCache.GetSize() << "/" << mResponseCache.GetCapacity() << " entries\n";
+	}
 }
 
 void EnrichableI2cAnalyzerResults::GenerateBubbleText( U64 frame_index, Channel& /*channel*/, DisplayBase display_base )  //unrefereced vars commented out to remove warnings.
@@ -27,19 +42,47 @@ void EnrichableI2cAnalyzerResults::GenerateBubbleText( U64 frame_index, Channel&
 	//we only need to pay attention to 'channel' if we're making bubbles for more than one channel (as set by AddChannelBubblesWillAppearOn)
 	ClearResultStrings();
 	Frame frame = GetFrame( frame_index );
-	std::stringstream outputStream;
-
-	if(mSubprocess->BubbleEnabled()) {
-		std::vector<std::string> bubbles = mSubprocess->EmitBubble(
-			GetPacketContainingFrameSequential(frame_index),
-			frame_index,
-			frame,
-			"sda"
-		);
-		for(const std::string& bubbleText: bubbles) {
+
+	//frames the register map describes need neither the script nor any formatting.
+	const std::vector<std::string>* mapped = GetMappedText( frame_index, frame );
+	if( mapped != NULL )
+	{
+		for(const std::string& bubbleText: *mapped) {
 			AddResultString(bubbleText.c_str());
 		}
-	} else {
+		AddResultString( mapped->back().c_str(), " + ", GetAckString( frame ) );
+		return;
+	}
+
+	//if the script misses its deadline, show the built-in text for now; its own text is picked up the next time this frame is drawn.
+	bool enriched = false;
+	if(mSubprocess->BubbleEnabled() && Subscribed( frame_index, frame )) {
+		std::vector<std::string> bubbles;
+		bool prefetched = false;
+		bool late = false;
+		if( mResponseCache.Get( EnrichableResponseCache::Bubble, frame_index, bubbles, &prefetched ) )
+		{
+			mPrefetchWindow.RecordHit( frame_index, prefetched );
+		}else if( !PrefetchBubbles( frame_index, bubbles, late ) )
+		{
+			bubbles = mSubprocess->EmitBubble(
+				GetPacketContainingFrameSequential(frame_index),
+				frame_index,
+				frame,
+				"sda",
+				&late
+			);
+			if( !late )
+				mResponseCache.Put( EnrichableResponseCache::Bubble, frame_index, bubbles );
+		}
+		if( !late ) {
+			for(const std::string& bubbleText: bubbles) {
+				AddResultString(bubbleText.c_str());
+			}
+			enriched = true;
+		}
+	}
+	if( !enriched ) {
 		char ack[32];
 		if( ( frame.mFlags & I2C_FLAG_ACK ) != 0 )
 			snprintf( ack, sizeof(ack), "ACK" );
@@ -121,6 +164,52 @@ void EnrichableI2cAnalyzerResults::GenerateBubbleText( U64 frame_index, Channel&
 	}
 }
 
+bool EnrichableI2cAnalyzerResults::PrefetchBubbles( U64 frame_index, std::vector<std::string>& bubbles, bool& late )
+{
+	//fetch the bubbles of the frames we expect to be asked for next in the same round trip as the one being displayed.
+	if( mPrefetchWindow.GetSize() == 0 )
+		return false;
+
+	mPrefetchWindow.RecordMiss( frame_index );
+
+	U64 first_frame;
+	U64 last_frame;
+	mPrefetchWindow.GetRange( frame_index, GetNumFrames(), first_frame, last_frame );
+
+	std::vector<EnrichableAnalyzerSubprocess::BubbleRequest> requests;
+	for( U64 i = first_frame; i <= last_frame; i++ )
+	{
+		if( i != frame_index && mResponseCache.Contains( EnrichableResponseCache::Bubble, i ) )
+			continue;
+
+		EnrichableAnalyzerSubprocess::BubbleRequest request;
+		request.packetId = GetPacketContainingFrameSequential( i );
+		request.frameIndex = i;
+		request.frame = GetFrame( i );
+		if( i != frame_index && ( !Subscribed( i, request.frame ) || GetMappedText( i, request.frame ) != NULL ) )
+			continue;
+		requests.push_back( request );
+	}
+
+	std::vector< std::vector<std::string> > responses;
+	mSubprocess->EmitBubbles( requests, responses, "sda" );
+
+	for( U32 i = 0; i < requests.size(); i++ )
+	{
+		bool requested = requests[i].frameIndex == frame_index;
+		if( !requests[i].late )
+			mResponseCache.Put( EnrichableResponseCache::Bubble, requests[i].frameIndex, responses[i], !requested );
+		if( requested )
+		{
+			bubbles = responses[i];
+			late = requests[i].late;
+		}
+	}
+	mPrefetchWindow.RecordPrefetched( requests.size() - 1 );
+
+	return true;
+}
+
 void EnrichableI2cAnalyzerResults::GenerateExportFile( const char* file, DisplayBase display_base, U32 /*export_type_user_id*/ )
 {
 	//export_type_user_id is only important if we have more than one export type.
@@ -222,16 +311,36 @@ void EnrichableI2cAnalyzerResults::GenerateFrameTabularText( U64 frame_index, Di
 
 	Frame frame = GetFrame( frame_index );
 
-	if(mSubprocess->TabularEnabled()) {
-		std::vector<std::string> tabularLines = mSubprocess->EmitTabular(
-			GetPacketContainingFrameSequential( frame_index ),
-			frame_index,
-			frame
-		);
-		for(const std::string& tabularText: tabularLines) {
-			AddTabularText(tabularText.c_str());
+	const std::vector<std::string>* mapped = GetMappedText( frame_index, frame );
+	if( mapped != NULL )
+	{
+		AddTabularText( mapped->back().c_str(), " + ", GetAckString( frame ) );
+		return;
+	}
+
+	bool enriched = false;
+	if(mSubprocess->TabularEnabled() && Subscribed( frame_index, frame )) {
+		std::vector<std::string> tabularLines;
+		bool late = false;
+		if( !mResponseCache.Get( EnrichableResponseCache::Tabular, frame_index, tabularLines ) )
+		{
+			tabularLines = mSubprocess->EmitTabular(
+				GetPacketContainingFrameSequential( frame_index ),
+				frame_index,
+				frame,
+				&late
+			);
+			if( !late )
+				mResponseCache.Put( EnrichableResponseCache::Tabular, frame_index, tabularLines );
 		}
-	} else {
+		if( !late ) {
+			for(const std::string& tabularText: tabularLines) {
+				AddTabularText(tabularText.c_str());
+			}
+			enriched = true;
+		}
+	}
+	if( !enriched ) {
 		char ack[32];
 		if( ( frame.mFlags & I2C_FLAG_ACK ) != 0 )
 			snprintf( ack, sizeof(ack), "ACK" );
@@ -284,14 +393,160 @@ void EnrichableI2cAnalyzerResults::GenerateFrameTabularText( U64 frame_index, Di
 	}
 }
 
-void EnrichableI2cAnalyzerResults::GeneratePacketTabularText( U64 /*packet_id*/, DisplayBase /*display_base*/ )  //unrefereced vars commented out to remove warnings.
+void EnrichableI2cAnalyzerResults::GeneratePacketTabularText( U64 packet_id, DisplayBase display_base )
 {
-	ClearResultStrings();
-	AddResultString( "not supported" );
+	ClearTabularText();
+
+	U64 first_frame;
+	U64 last_frame;
+	GetFramesContainedInPacket( packet_id, &first_frame, &last_frame );
+	if( first_frame == INVALID_RESULT_INDEX || last_frame < first_frame )
+		return;
+
+	//the script's reply to the packet message was stored as the packet was decoded; without one, summarize the packet ourselves.
+	if( mSubprocess->PacketEnabled() && mSubprocess->SubscribesAddress( GetFrameAddress( first_frame, GetFrame( first_frame ) ) ) )
+	{
+		std::vector<std::string> packetLines;
+		if( mSubprocess->GetPacketResponse( packet_id, packetLines ) )
+		{
+			for(const std::string& packetText: packetLines) {
+				AddTabularText(packetText.c_str());
+			}
+			return;
+		}
+	}
+
+	std::stringstream ss;
+	for( U64 i = first_frame; i <= last_frame; i++ )
+	{
+		Frame frame = GetFrame( i );
+
+		char number_str[128];
+		if( frame.mType == I2cAddress )
+		{
+			GetAddressString( frame.mData1, display_base, number_str, 128 );
+
+			if( i != first_frame )
+				ss << "; ";
+			if( ( frame.mData1 & 0x1 ) != 0 )
+				ss << "Read [" << number_str << "]";
+			else
+				ss << "Write [" << number_str << "]";
+		}else
+		{
+			AnalyzerHelpers::GetNumberString( frame.mData1, display_base, 8, number_str, 128 );
+			ss << " " << number_str;
+		}
+
+		if( ( frame.mFlags & I2C_FLAG_ACK ) == 0 )
+		{
+			if( ( frame.mFlags & I2C_MISSING_FLAG_ACK ) != 0 )
+				ss << " (Missing ACK/NAK)";
+			else
+				ss << " (NAK)";
+		}
+	}
+	AddTabularText( ss.str().c_str() );
 }
 
-void EnrichableI2cAnalyzerResults::GenerateTransactionTabularText( U64 /*transaction_id*/, DisplayBase /*display_base*/ )  //unrefereced vars commented out to remove warnings.
+void EnrichableI2cAnalyzerResults::GenerateTransactionTabularText( U64 transaction_id, DisplayBase display_base )
 {
-	ClearResultStrings();
-	AddResultString( "not supported" );
+	ClearTabularText();
+
+	EnrichableI2cTransaction transaction;
+	if( !mTransactions->GetTransaction( transaction_id, transaction ) )
+		return;
+
+	if( mSubprocess->TransactionEnabled() && mSubprocess->SubscribesAddress( transaction.address ) )
+	{
+		std::vector<std::string> transactionLines;
+		if( mSubprocess->GetTransactionResponse( transaction_id, transactionLines ) )
+		{
+			for(const std::string& transactionText: transactionLines) {
+				AddTabularText(transactionText.c_str());
+			}
+			return;
+		}
+	}
+
+	//the address byte is rebuilt so that the address setting applies as it does to address frames.
+	char number_str[128];
+	GetAddressString( ( transaction.address << 1 ) | ( transaction.read ? 1 : 0 ), display_base, number_str, 128 );
+
+	std::stringstream ss;
+	ss << ( transaction.read ? "Read [" : "Write [" ) << number_str << "]";
+
+	U64 register_value = 0;
+	for( U32 i=0; i<transaction.registerLength; i++ )
+		register_value = ( register_value << 8 ) | transaction.registerBytes[i];
+	AnalyzerHelpers::GetNumberString( register_value, display_base, 8 * transaction.registerLength, number_str, 128 );
+	ss << " @ " << number_str;
+
+	for( U64 i=0; i<transaction.payloadCount; i++ )
+	{
+		Frame frame = GetFrame( transaction.payloadFirstFrame + i );
+		AnalyzerHelpers::GetNumberString( frame.mData1, display_base, 8, number_str, 128 );
+		ss << ( i == 0 ? ": " : " " ) << number_str;
+	}
+	AddTabularText( ss.str().c_str() );
+}
+
+const std::vector<std::string>* EnrichableI2cAnalyzerResults::GetMappedText( U64 frame_index, const Frame& frame )
+{
+	if( !mRegisterMap->IsLoaded() )
+		return NULL;
+	return mRegisterMap->GetText( mRegisterContexts->Get( frame_index ), frame );
+}
+
+const char* EnrichableI2cAnalyzerResults::GetAckString( const Frame& frame )
+{
+	if( ( frame.mFlags & I2C_FLAG_ACK ) != 0 )
+		return "ACK";
+	else if( ( frame.mFlags & I2C_MISSING_FLAG_ACK ) != 0 )
+		return "Missing ACK/NAK";
+	else
+		return "NAK";
+}
+
+U8 EnrichableI2cAnalyzerResults::GetFrameAddress( U64 frame_index, const Frame& frame )
+{
+	if( frame.mType == I2cAddress )
+		return U8( frame.mData1 >> 1 );
+
+	//a data frame was sent to the address at the start of its packet.
+	U64 packet_id = GetPacketContainingFrameSequential( frame_index );
+	if( packet_id == INVALID_RESULT_INDEX )
+		return UNKNOWN_ADDRESS;
+
+	U64 first_frame;
+	U64 last_frame;
+	GetFramesContainedInPacket( packet_id, &first_frame, &last_frame );
+	if( first_frame == INVALID_RESULT_INDEX )
+		return UNKNOWN_ADDRESS;
+
+	Frame first = GetFrame( first_frame );
+	return first.mType == I2cAddress ? U8( first.mData1 >> 1 ) : U8( UNKNOWN_ADDRESS );
+}
+
+bool EnrichableI2cAnalyzerResults::Subscribed( U64 frame_index, const Frame& frame )
+{
+	//only look the address up if the script filters on it.
+	U8 address = mSubprocess->FiltersAddresses() ? GetFrameAddress( frame_index, frame ) : U8( UNKNOWN_ADDRESS );
+	return mSubprocess->Subscribes( address, frame );
+}
+
+void EnrichableI2cAnalyzerResults::GetAddressString( U64 address_byte, DisplayBase display_base, char* result_string, U32 result_string_length )
+{
+	switch( mSettings->mAddressDisplay )
+	{
+	case NO_DIRECTION_7:
+		AnalyzerHelpers::GetNumberString( address_byte >> 1, display_base, 7, result_string, result_string_length );
+		break;
+	case NO_DIRECTION_8:
+		AnalyzerHelpers::GetNumberString( address_byte & 0xFE, display_base, 8, result_string, result_string_length );
+		break;
+	case YES_DIRECTION_8:
+		AnalyzerHelpers::GetNumberString( address_byte, display_base, 8, result_string, result_string_length );
+		break;
+	}
 }
@@ -3,6 +3,10 @@
 
 #include <AnalyzerResults.h>
 #include "EnrichableAnalyzerSubprocess.h"
+#include "EnrichableResponseCache.h"
+#include "EnrichablePrefetchWindow.h"
+#include "EnrichableRegisterMap.h"
+#include <memory>
 
 #define I2C_FLAG_ACK ( 1 << 0 )
 #define I2C_MISSING_FLAG_ACK ( 1 << 1 )
@@ -11,6 +15,7 @@ enum I2cFrameType { I2cAddress, I2cData };
 
 class EnrichableI2cAnalyzer;
 class EnrichableI2cAnalyzerSettings;
+class EnrichableI2cTransactions;
 
 class EnrichableI2cAnalyzerResults : public AnalyzerResults
 {
@@ -18,7 +23,10 @@ public:
 	EnrichableI2cAnalyzerResults(
 		EnrichableI2cAnalyzer* analyzer,
 		EnrichableI2cAnalyzerSettings* settings,
-		EnrichableAnalyzerSubprocess* subprocess
+		EnrichableAnalyzerSubprocess* subprocess,
+		EnrichableI2cTransactions* transactions,
+		std::shared_ptr< const EnrichableRegisterMap > register_map,
+		EnrichableRegisterContexts* register_contexts
 	);
 	virtual ~EnrichableI2cAnalyzerResults();
 
@@ -30,11 +38,22 @@ public:
 	virtual void GenerateTransactionTabularText( U64 transaction_id, DisplayBase display_base );
 
 protected: //functions
+	bool PrefetchBubbles( U64 frame_index, std::vector<std::string>& bubbles, bool& late );
+	const std::vector<std::string>* GetMappedText( U64 frame_index, const Frame& frame );
+	const char* GetAckString( const Frame& frame );
+	U8 GetFrameAddress( U64 frame_index, const Frame& frame );
+	bool Subscribed( U64 frame_index, const Frame& frame );
+	void GetAddressString( U64 address_byte, DisplayBase display_base, char* result_string, U32 result_string_length );
 
 protected:  //vars
 	EnrichableI2cAnalyzerSettings* mSettings;
 	EnrichableI2cAnalyzer* mAnalyzer;
 	EnrichableAnalyzerSubprocess* mSubprocess;
+	EnrichableI2cTransactions* mTransactions;
+	std::shared_ptr< const EnrichableRegisterMap > mRegisterMap;
+	EnrichableRegisterContexts* mRegisterContexts;
+	EnrichableResponseCache mResponseCache;
+	EnrichablePrefetchWindow mPrefetchWindow;
 };
 
 #endif //SERIAL_ANALYZER_RESULTS
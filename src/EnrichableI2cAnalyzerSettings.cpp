@@ -7,7 +7,20 @@ EnrichableI2cAnalyzerSettings::EnrichableI2cAnalyzerSettings()
 :	mSdaChannel( UNDEFINED_CHANNEL ),
 	mSclChannel( UNDEFINED_CHANNEL ),
 	mAddressDisplay( YES_DIRECTION_8 ),
-	mParserCommand("")
+	mParserCommand(""),
+	mRegisterMapFile( "" ),
+	mMarkerPipelineDepth( 1 ),
+	mResponseCacheSize( 65536 ),
+	mBubblePrefetchWindow( 64 ),
+	mPoolSize( 1 ),
+	mPoolDispatch( POOL_FRAME_HASH ),
+	mDedicatedMarkerProcess( false ),
+	mPersistentCacheDirectory( "" ),
+	mSharedMemoryTransport( false ),
+	mBubbleDeadline( 250 ),
+	mTabularDeadline( 250 ),
+	mCommitInterval( 50 ),
+	mCommitFrameLimit( 1024 )
 {
 	mSdaChannelInterface.reset( new AnalyzerSettingInterfaceChannel() );
 	mSdaChannelInterface->SetTitleAndTooltip( "SDA", "Serial Data Line" );
@@ -29,10 +42,97 @@ EnrichableI2cAnalyzerSettings::EnrichableI2cAnalyzerSettings()
 	mParserCommandInterface->SetTextType(AnalyzerSettingInterfaceText::NormalText);
 	mParserCommandInterface->SetText(mParserCommand);
 
+	mRegisterMapFileInterface.reset( new AnalyzerSettingInterfaceText() );
+	mRegisterMapFileInterface->SetTitleAndTooltip( "Register Map", "File naming the devices, registers and bit fields on the bus; their accesses are decoded without running the enrichment script.  Leave empty to disable." );
+	mRegisterMapFileInterface->SetTextType( AnalyzerSettingInterfaceText::FilePath );
+	mRegisterMapFileInterface->SetText( mRegisterMapFile );
+
+	mMarkerPipelineDepthInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mMarkerPipelineDepthInterface->SetTitleAndTooltip( "Marker Pipeline Depth", "Maximum number of marker requests awaiting a reply from the enrichment script; 1 waits for each reply before decoding the next byte." );
+	mMarkerPipelineDepthInterface->SetMin( 1 );
+	mMarkerPipelineDepthInterface->SetMax( 256 );
+	mMarkerPipelineDepthInterface->SetInteger( mMarkerPipelineDepth );
+
+	mResponseCacheSizeInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mResponseCacheSizeInterface->SetTitleAndTooltip( "Enrichment Cache Size", "Number of bubble and tabular responses from the enrichment script to keep in memory; 0 disables the cache." );
+	mResponseCacheSizeInterface->SetMin( 0 );
+	mResponseCacheSizeInterface->SetMax( 16777216 );
+	mResponseCacheSizeInterface->SetInteger( mResponseCacheSize );
+
+	mBubblePrefetchWindowInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mBubblePrefetchWindowInterface->SetTitleAndTooltip( "Bubble Prefetch Window", "Maximum number of neighbouring frames whose bubbles are requested from the enrichment script along with the one being displayed; 0 disables prefetching." );
+	mBubblePrefetchWindowInterface->SetMin( 0 );
+	mBubblePrefetchWindowInterface->SetMax( 4096 );
+	mBubblePrefetchWindowInterface->SetInteger( mBubblePrefetchWindow );
+
+	mPoolSizeInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mPoolSizeInterface->SetTitleAndTooltip( "Enrichment Processes", "Number of copies of the enrichment script to run.  Bubble and tabular requests are spread across them; markers always go to the first.  Only use more than one if your script keeps no state between messages." );
+	mPoolSizeInterface->SetMin( 1 );
+	mPoolSizeInterface->SetMax( 64 );
+	mPoolSizeInterface->SetInteger( mPoolSize );
+
+	mPoolDispatchInterface.reset( new AnalyzerSettingInterfaceNumberList() );
+	mPoolDispatchInterface->SetTitleAndTooltip( "Enrichment Dispatch", "Specify how requests are spread across multiple enrichment processes." );
+	mPoolDispatchInterface->AddNumber( POOL_FRAME_HASH, "By frame index [default]", "Each frame is always sent to the same process" );
+	mPoolDispatchInterface->AddNumber( POOL_ROUND_ROBIN, "Round-robin", "Each request is sent to the next process in turn" );
+	mPoolDispatchInterface->SetNumber( mPoolDispatch );
+
+	mDedicatedMarkerProcessInterface.reset( new AnalyzerSettingInterfaceBool() );
+	mDedicatedMarkerProcessInterface->SetTitleAndTooltip( "Dedicated Marker Process", "Run a separate copy of the enrichment script for markers, so decoding and display never wait on each other.  Only use this if your script keeps no state between messages." );
+	mDedicatedMarkerProcessInterface->SetCheckBoxText( "Separate decode and display channels" );
+	mDedicatedMarkerProcessInterface->SetValue( mDedicatedMarkerProcess );
+
+	mPersistentCacheDirectoryInterface.reset( new AnalyzerSettingInterfaceText() );
+	mPersistentCacheDirectoryInterface->SetTitleAndTooltip( "Persistent Cache Directory", "Directory in which to keep the enrichment script's responses between sessions, so re-analyzing a capture with an unchanged script does not run it again.  Leave empty to disable." );
+	mPersistentCacheDirectoryInterface->SetTextType( AnalyzerSettingInterfaceText::FolderPath );
+	mPersistentCacheDirectoryInterface->SetText( mPersistentCacheDirectory );
+
+	mSharedMemoryTransportInterface.reset( new AnalyzerSettingInterfaceBool() );
+	mSharedMemoryTransportInterface->SetTitleAndTooltip( "Shared Memory Transport", "Offer the enrichment script shared memory ring buffers in place of its stdin and stdout.  Only scripts that support it will use them; Linux only." );
+	mSharedMemoryTransportInterface->SetCheckBoxText( "Offer shared memory transport" );
+	mSharedMemoryTransportInterface->SetValue( mSharedMemoryTransport );
+
+	mBubbleDeadlineInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mBubbleDeadlineInterface->SetTitleAndTooltip( "Bubble Deadline (ms)", "Longest to wait for the enrichment script's bubble text before showing the built-in text instead; the script's text replaces it once it arrives.  0 waits indefinitely." );
+	mBubbleDeadlineInterface->SetMin( 0 );
+	mBubbleDeadlineInterface->SetMax( 60000 );
+	mBubbleDeadlineInterface->SetInteger( mBubbleDeadline );
+
+	mTabularDeadlineInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mTabularDeadlineInterface->SetTitleAndTooltip( "Tabular Deadline (ms)", "Longest to wait for the enrichment script's tabular text before showing the built-in text instead; the script's text replaces it once it arrives.  0 waits indefinitely." );
+	mTabularDeadlineInterface->SetMin( 0 );
+	mTabularDeadlineInterface->SetMax( 60000 );
+	mTabularDeadlineInterface->SetInteger( mTabularDeadline );
+
+	mCommitIntervalInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mCommitIntervalInterface->SetTitleAndTooltip( "Commit Interval (ms)", "Longest that decoded frames wait before they are shown; results are also shown as soon as everything captured so far is decoded.  0 shows every frame as it is decoded." );
+	mCommitIntervalInterface->SetMin( 0 );
+	mCommitIntervalInterface->SetMax( 10000 );
+	mCommitIntervalInterface->SetInteger( mCommitInterval );
+
+	mCommitFrameLimitInterface.reset( new AnalyzerSettingInterfaceInteger() );
+	mCommitFrameLimitInterface->SetTitleAndTooltip( "Commit Frames", "Most decoded frames to hold back before they are shown, if the commit interval has not passed first.  1 shows every frame as it is decoded." );
+	mCommitFrameLimitInterface->SetMin( 1 );
+	mCommitFrameLimitInterface->SetMax( 1048576 );
+	mCommitFrameLimitInterface->SetInteger( mCommitFrameLimit );
+
 	AddInterface( mSdaChannelInterface.get() );
 	AddInterface( mSclChannelInterface.get() );
 	AddInterface( mAddressDisplayInterface.get() );
 	AddInterface( mParserCommandInterface.get() );
+	AddInterface( mRegisterMapFileInterface.get() );
+	AddInterface( mMarkerPipelineDepthInterface.get() );
+	AddInterface( mResponseCacheSizeInterface.get() );
+	AddInterface( mBubblePrefetchWindowInterface.get() );
+	AddInterface( mPoolSizeInterface.get() );
+	AddInterface( mPoolDispatchInterface.get() );
+	AddInterface( mDedicatedMarkerProcessInterface.get() );
+	AddInterface( mPersistentCacheDirectoryInterface.get() );
+	AddInterface( mSharedMemoryTransportInterface.get() );
+	AddInterface( mBubbleDeadlineInterface.get() );
+	AddInterface( mTabularDeadlineInterface.get() );
+	AddInterface( mCommitIntervalInterface.get() );
+	AddInterface( mCommitFrameLimitInterface.get() );
 
 	//AddExportOption( 0, "Export as text/csv file", "text (*.txt);;csv (*.csv)" );
 	AddExportOption( 0, "Export as text/csv file" );
@@ -60,6 +160,19 @@ bool EnrichableI2cAnalyzerSettings::SetSettingsFromInterfaces()
 	mSclChannel = mSclChannelInterface->GetChannel();
 	mAddressDisplay = AddressDisplay( U32( mAddressDisplayInterface->GetNumber() ) );
 	mParserCommand = mParserCommandInterface->GetText();
+	mRegisterMapFile = mRegisterMapFileInterface->GetText();
+	mMarkerPipelineDepth = mMarkerPipelineDepthInterface->GetInteger();
+	mResponseCacheSize = mResponseCacheSizeInterface->GetInteger();
+	mBubblePrefetchWindow = mBubblePrefetchWindowInterface->GetInteger();
+	mPoolSize = mPoolSizeInterface->GetInteger();
+	mPoolDispatch = PoolDispatch( U32( mPoolDispatchInterface->GetNumber() ) );
+	mDedicatedMarkerProcess = mDedicatedMarkerProcessInterface->GetValue();
+	mPersistentCacheDirectory = mPersistentCacheDirectoryInterface->GetText();
+	mSharedMemoryTransport = mSharedMemoryTransportInterface->GetValue();
+	mBubbleDeadline = mBubbleDeadlineInterface->GetInteger();
+	mTabularDeadline = mTabularDeadlineInterface->GetInteger();
+	mCommitInterval = mCommitIntervalInterface->GetInteger();
+	mCommitFrameLimit = mCommitFrameLimitInterface->GetInteger();
 
 	ClearChannels();
 	AddChannel( mSdaChannel, "SDA", true );
@@ -82,6 +195,32 @@ void EnrichableI2cAnalyzerSettings::LoadSettings( const char* settings )
 	text_archive >> mSclChannel;
 	text_archive >> *(U32*)&mAddressDisplay;
 	text_archive >>  &mParserCommand;
+	if( !( text_archive >> mMarkerPipelineDepth ) )
+		mMarkerPipelineDepth = 1;  //settings saved before this option existed
+	if( !( text_archive >> mResponseCacheSize ) )
+		mResponseCacheSize = 65536;
+	if( !( text_archive >> mBubblePrefetchWindow ) )
+		mBubblePrefetchWindow = 64;
+	if( !( text_archive >> mPoolSize ) )
+		mPoolSize = 1;
+	if( !( text_archive >> *(U32*)&mPoolDispatch ) )
+		mPoolDispatch = POOL_FRAME_HASH;
+	if( !( text_archive >> mDedicatedMarkerProcess ) )
+		mDedicatedMarkerProcess = false;
+	if( !( text_archive >> &mPersistentCacheDirectory ) )
+		mPersistentCacheDirectory = "";
+	if( !( text_archive >> mSharedMemoryTransport ) )
+		mSharedMemoryTransport = false;
+	if( !( text_archive >> mBubbleDeadline ) )
+		mBubbleDeadline = 250;
+	if( !( text_archive >> mTabularDeadline ) )
+		mTabularDeadline = 250;
+	if( !( text_archive >> &mRegisterMapFile ) )
+		mRegisterMapFile = "";
+	if( !( text_archive >> mCommitInterval ) )
+		mCommitInterval = 50;
+	if( !( text_archive >> mCommitFrameLimit ) )
+		mCommitFrameLimit = 1024;
 
 	ClearChannels();
 	AddChannel( mSdaChannel, "SDA", true );
@@ -99,6 +238,19 @@ const char* EnrichableI2cAnalyzerSettings::SaveSettings()
 	text_archive << mSclChannel;
 	text_archive << mAddressDisplay;
 	text_archive <<  mParserCommand;
+	text_archive << mMarkerPipelineDepth;
+	text_archive << mResponseCacheSize;
+	text_archive << mBubblePrefetchWindow;
+	text_archive << mPoolSize;
+	text_archive << mPoolDispatch;
+	text_archive << mDedicatedMarkerProcess;
+	text_archive << mPersistentCacheDirectory;
+	text_archive << mSharedMemoryTransport;
+	text_archive << mBubbleDeadline;
+	text_archive << mTabularDeadline;
+	text_archive << mRegisterMapFile;
+	text_archive << mCommitInterval;
+	text_archive << mCommitFrameLimit;
 
 	return SetReturnString( text_archive.GetString() );
 }
@@ -109,4 +261,17 @@ void EnrichableI2cAnalyzerSettings::UpdateInterfacesFromSettings()
 	mSclChannelInterface->SetChannel( mSclChannel );
 	mAddressDisplayInterface->SetNumber( mAddressDisplay );
 	mParserCommandInterface->SetText( mParserCommand );
+	mRegisterMapFileInterface->SetText( mRegisterMapFile );
+	mMarkerPipelineDepthInterface->SetInteger( mMarkerPipelineDepth );
+	mResponseCacheSizeInterface->SetInteger( mResponseCacheSize );
+	mBubblePrefetchWindowInterface->SetInteger( mBubblePrefetchWindow );
+	mPoolSizeInterface->SetInteger( mPoolSize );
+	mPoolDispatchInterface->SetNumber( mPoolDispatch );
+	mDedicatedMarkerProcessInterface->SetValue( mDedicatedMarkerProcess );
+	mPersistentCacheDirectoryInterface->SetText( mPersistentCacheDirectory );
+	mSharedMemoryTransportInterface->SetValue( mSharedMemoryTransport );
+	mBubbleDeadlineInterface->SetInteger( mBubbleDeadline );
+	mTabularDeadlineInterface->SetInteger( mTabularDeadline );
+	mCommitIntervalInterface->SetInteger( mCommitInterval );
+	mCommitFrameLimitInterface->SetInteger( mCommitFrameLimit );
 }
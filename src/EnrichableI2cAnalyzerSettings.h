@@ -8,6 +8,7 @@ enum I2cDirection { I2C_READ, I2C_WRITE };
 enum I2cResponse { I2C_ACK, I2C_NAK };
 
 enum AddressDisplay { NO_DIRECTION_7, NO_DIRECTION_8, YES_DIRECTION_8 };
+enum PoolDispatch { POOL_ROUND_ROBIN, POOL_FRAME_HASH };
 
 class EnrichableI2cAnalyzerSettings : public AnalyzerSettings
 {
@@ -25,12 +26,38 @@ public:
 	Channel mSclChannel;
 	enum AddressDisplay mAddressDisplay;
 	const char* mParserCommand;
+	const char* mRegisterMapFile;
+	U32 mMarkerPipelineDepth;
+	U32 mResponseCacheSize;
+	U32 mBubblePrefetchWindow;
+	U32 mPoolSize;
+	enum PoolDispatch mPoolDispatch;
+	bool mDedicatedMarkerProcess;
+	const char* mPersistentCacheDirectory;
+	bool mSharedMemoryTransport;
+	U32 mBubbleDeadline;
+	U32 mTabularDeadline;
+	U32 mCommitInterval;
+	U32 mCommitFrameLimit;
 
 protected:
 	std::auto_ptr< AnalyzerSettingInterfaceChannel > mSdaChannelInterface;
 	std::auto_ptr< AnalyzerSettingInterfaceChannel > mSclChannelInterface;
 	std::auto_ptr< AnalyzerSettingInterfaceNumberList > mAddressDisplayInterface;
 	std::auto_ptr< AnalyzerSettingInterfaceText >		mParserCommandInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceText >		mRegisterMapFileInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mMarkerPipelineDepthInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mResponseCacheSizeInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mBubblePrefetchWindowInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mPoolSizeInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceNumberList >	mPoolDispatchInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceBool >		mDedicatedMarkerProcessInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceText >		mPersistentCacheDirectoryInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceBool >		mSharedMemoryTransportInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mBubbleDeadlineInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mTabularDeadlineInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mCommitIntervalInterface;
+	std::auto_ptr< AnalyzerSettingInterfaceInteger >	mCommitFrameLimitInterface;
 };
 
 #endif //I2C_ANALYZER_SETTINGS
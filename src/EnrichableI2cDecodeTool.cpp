@@ -0,0 +1,838 @@
+#include "EnrichableI2cDecodeTool.h"
+#include "EnrichableI2cAnalyzerResults.h"
+#include "AnalyzerHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+EnrichableI2cDecodeOptions::EnrichableI2cDecodeOptions():
+	transitionList(false),
+	binaryOutput(false),
+	sampleRate(0),
+	channelCount(2),
+	sclChannel(0),
+	sdaChannel(1),
+	sampleCount(0),
+	minimumPulse(0),
+	poolSize(1),
+	threadCount(1),
+	addressDisplay(YES_DIRECTION_8),
+	displayBase(Hexadecimal)
+{
+}
+
+EnrichableI2cDecodeTool::EnrichableI2cDecodeTool():
+	captureFile(-1),
+	capture(NULL),
+	captureLength(0),
+	output(NULL),
+	sampleRate(0),
+	segmentCount(0),
+	enriched(false),
+	currentAddress(UNKNOWN_ADDRESS),
+	nextPacketId(0),
+	frameCount(0),
+	direction("")
+{
+	address[0] = '\0';
+}
+
+EnrichableI2cDecodeTool::~EnrichableI2cDecodeTool()
+{
+	UnmapCapture();
+}
+
+static void PrintUsage(const char* program) {
+	std::cerr <<
+		"Usage: " << program << " [options] CAPTURE\n"
+		"\n"
+		"Decodes the I2C traffic in CAPTURE, writing the frames as the analyzer's\n"
+		"export does.\n"
+		"\n"
+		"  -t, --transitions         CAPTURE is a transition list, not a raw capture\n"
+		"  -r, --sample-rate HZ      sample rate of a raw capture\n"
+		"  -n, --channels COUNT      channels in a raw capture (default 2)\n"
+		"  -c, --scl CHANNEL         SCL channel of a raw capture (default 0)\n"
+		"  -d, --sda CHANNEL         SDA channel of a raw capture (default 1)\n"
+		"  -s, --samples COUNT       samples per channel, if fewer than the file holds\n"
+		"  -g, --min-pulse SAMPLES   drop pulses shorter than this from a raw capture\n"
+		"  -e, --enrich COMMAND      enrichment script or plugin\n"
+		"  -p, --processes COUNT     copies of the enrichment script (default 1)\n"
+		"  -j, --threads COUNT       threads decoding at once, or 0 for one per core\n"
+		"                            (default 1)\n"
+		"  -m, --register-map FILE   register map\n"
+		"  -a, --address MODE        7, 8, or 8rw (default 8rw)\n"
+		"  -b, --base BASE           hex, dec, bin or ascii (default hex)\n"
+		"  -o, --output FILE         write to FILE rather than standard output\n"
+		"  -B, --binary              write a binary frame file rather than CSV\n";
+}
+
+static bool ParseUnsigned(const char* text, U64 maximum, U64& value) {
+	char* end = NULL;
+	errno = 0;
+	unsigned long long parsed = strtoull(text, &end, 0);
+	if(errno || end == text || *end != '\0' || text[0] == '-' || parsed > maximum) {
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+bool EnrichableI2cDecodeTool::ParseArguments(int argc, char** argv, EnrichableI2cDecodeOptions& options) {
+	static const struct option longOptions[] = {
+		{"transitions", no_argument, NULL, 't'},
+		{"sample-rate", required_argument, NULL, 'r'},
+		{"channels", required_argument, NULL, 'n'},
+		{"scl", required_argument, NULL, 'c'},
+		{"sda", required_argument, NULL, 'd'},
+		{"samples", required_argument, NULL, 's'},
+		{"min-pulse", required_argument, NULL, 'g'},
+		{"enrich", required_argument, NULL, 'e'},
+		{"processes", required_argument, NULL, 'p'},
+		{"threads", required_argument, NULL, 'j'},
+		{"register-map", required_argument, NULL, 'm'},
+		{"address", required_argument, NULL, 'a'},
+		{"base", required_argument, NULL, 'b'},
+		{"output", required_argument, NULL, 'o'},
+		{"binary", no_argument, NULL, 'B'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int option;
+	U64 value;
+	while((option = getopt_long(argc, argv, "tr:n:c:d:s:g:e:p:j:m:a:b:o:B", longOptions, NULL)) != -1) {
+		bool valid = true;
+		switch(option) {
+			case 't':
+				options.transitionList = true;
+				break;
+			case 'r':
+				valid = ParseUnsigned(optarg, 0xFFFFFFFF, value) && value > 0;
+				options.sampleRate = U32(value);
+				break;
+			case 'n':
+				valid = ParseUnsigned(optarg, 0xFFFF, value) && value > 0;
+				options.channelCount = U32(value);
+				break;
+			case 'c':
+				valid = ParseUnsigned(optarg, 0xFFFF, value);
+				options.sclChannel = U32(value);
+				break;
+			case 'd':
+				valid = ParseUnsigned(optarg, 0xFFFF, value);
+				options.sdaChannel = U32(value);
+				break;
+			case 's':
+				valid = ParseUnsigned(optarg, ~U64(0), options.sampleCount);
+				break;
+			case 'g':
+				valid = ParseUnsigned(optarg, ~U64(0), options.minimumPulse);
+				break;
+			case 'e':
+				options.enrichmentCommand = optarg;
+				break;
+			case 'p':
+				valid = ParseUnsigned(optarg, 64, value) && value > 0;
+				options.poolSize = U32(value);
+				break;
+			case 'j':
+				valid = ParseUnsigned(optarg, 1024, value);
+				options.threadCount = U32(value);
+				break;
+			case 'm':
+				options.registerMapFile = optarg;
+				break;
+			case 'a':
+				if(!strcmp(optarg, "7")) {
+					options.addressDisplay = NO_DIRECTION_7;
+				} else if(!strcmp(optarg, "8")) {
+					options.addressDisplay = NO_DIRECTION_8;
+				} else if(!strcmp(optarg, "8rw")) {
+					options.addressDisplay = YES_DIRECTION_8;
+				} else {
+					valid = false;
+				}
+				break;
+			case 'b':
+				if(!strcmp(optarg, "hex")) {
+					options.displayBase = Hexadecimal;
+				} else if(!strcmp(optarg, "dec")) {
+					options.displayBase = Decimal;
+				} else if(!strcmp(optarg, "bin")) {
+					options.displayBase = Binary;
+				} else if(!strcmp(optarg, "ascii")) {
+					options.displayBase = ASCII;
+				} else {
+					valid = false;
+				}
+				break;
+			case 'o':
+				options.outputPath = optarg;
+				break;
+			case 'B':
+				options.binaryOutput = true;
+				break;
+			default:
+				valid = false;
+				break;
+		}
+		if(!valid) {
+			if(option != '?') {
+				std::cerr << "Invalid value for -" << (char)option << ": " << optarg << "\n";
+			}
+			PrintUsage(argv[0]);
+			return false;
+		}
+	}
+
+	if(optind != argc - 1) {
+		PrintUsage(argv[0]);
+		return false;
+	}
+	options.capturePath = argv[optind];
+
+	if(!options.transitionList) {
+		if(options.sampleRate == 0) {
+			std::cerr << "A raw capture needs its sample rate (--sample-rate).\n";
+			return false;
+		}
+		if(options.sclChannel >= options.channelCount || options.sdaChannel >= options.channelCount) {
+			std::cerr << "SCL and SDA must be among the capture's " << options.channelCount << " channels.\n";
+			return false;
+		}
+		if(options.sclChannel == options.sdaChannel) {
+			std::cerr << "SCL and SDA must be different channels.\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+int EnrichableI2cDecodeTool::Run(const EnrichableI2cDecodeOptions& _options) {
+	options = _options;
+	if(!MapCapture()) {
+		return 1;
+	}
+
+	if(options.registerMapFile.length() && !registerMap.Load(options.registerMapFile)) {
+		return 1;
+	}
+	if(options.enrichmentCommand.length()) {
+		subprocess.reset(new EnrichableAnalyzerSubprocess());
+		subprocess->SetParserCommand(options.enrichmentCommand);
+		subprocess->SetPoolSize(options.poolSize);
+		// Nothing is waiting on a display, so every reply is waited for.
+		subprocess->SetDeadlines(0, 0);
+		subprocess->Start();
+	}
+	enriched = registerMap.IsLoaded() || (subprocess && subprocess->TabularEnabled());
+
+	if(!OpenOutput()) {
+		return 1;
+	}
+
+	events.resize(DECODE_TOOL_EVENT_CHUNK);
+	arrows.resize(DECODE_TOOL_EVENT_CHUNK * I2C_DECODER_BITS);
+	registerPointers.Clear();
+	U32 threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+	if(threadCount > 1) {
+		pool.reset(new EnrichableWorkStealingPool(threadCount));
+	}
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	bool decoded = options.transitionList ? DecodeTransitionList() : DecodeRaw();
+	if(decoded) {
+		if(pool) {
+			MergeSegments(0);
+		} else {
+			// A byte whose acknowledge bit began before the end is still a byte.
+			EnrichableI2cOutput last = {events.data(), events.size(), 0, arrows.data(), arrows.size(), 0};
+			decoder.Finish(last);
+			RecordEvents(last);
+		}
+		// Frames after the last STOP or START belong to no packet.
+		CommitPacket(INVALID_RESULT_INDEX);
+	}
+	bool written = CloseOutput();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	if(subprocess) {
+		subprocess->Stop();
+	}
+	UnmapCapture();
+	if(!decoded || !written) {
+		return 1;
+	}
+
+	std::cerr << "Decoded " << frameCount << " frames in " << nextPacketId << " packets in " << seconds << " s";
+	if(pool) {
+		std::cerr << " on " << pool->ThreadCount() << " threads, in " << segmentCount << " segments";
+	}
+	if(seconds > 0) {
+		std::cerr << " (" << U64(frameCount / seconds) << " frames/s)";
+	}
+	std::cerr << "\n";
+	return 0;
+}
+
+bool EnrichableI2cDecodeTool::MapCapture() {
+	captureFile = open(options.capturePath.c_str(), O_RDONLY);
+	if(captureFile < 0) {
+		std::cerr << "Could not open " << options.capturePath << ": " << strerror(errno) << "\n";
+		return false;
+	}
+	struct stat status;
+	if(fstat(captureFile, &status) < 0) {
+		std::cerr << "Could not read " << options.capturePath << ": " << strerror(errno) << "\n";
+		return false;
+	}
+	captureLength = size_t(status.st_size);
+	if(captureLength == 0) {
+		return true;
+	}
+
+	void* mapped = mmap(NULL, captureLength, PROT_READ, MAP_PRIVATE, captureFile, 0);
+	if(mapped == MAP_FAILED) {
+		std::cerr << "Could not map " << options.capturePath << ": " << strerror(errno) << "\n";
+		captureLength = 0;
+		return false;
+	}
+	// Both formats are read once from front to back.
+	madvise(mapped, captureLength, MADV_SEQUENTIAL);
+	capture = (const uint8_t*)mapped;
+	return true;
+}
+
+void EnrichableI2cDecodeTool::UnmapCapture() {
+	if(capture) {
+		munmap((void*)capture, captureLength);
+		capture = NULL;
+		captureLength = 0;
+	}
+	if(captureFile >= 0) {
+		close(captureFile);
+		captureFile = -1;
+	}
+}
+
+bool EnrichableI2cDecodeTool::OpenOutput() {
+	if(options.outputPath.length()) {
+		output = fopen(options.outputPath.c_str(), options.binaryOutput ? "wb" : "w");
+		if(!output) {
+			std::cerr << "Could not create " << options.outputPath << ": " << strerror(errno) << "\n";
+			return false;
+		}
+	} else {
+		output = stdout;
+	}
+	outputBuffer.resize(DECODE_TOOL_OUTPUT_BUFFER);
+	setvbuf(output, outputBuffer.data(), _IOFBF, outputBuffer.size());
+	return true;
+}
+
+bool EnrichableI2cDecodeTool::CloseOutput() {
+	bool written = !ferror(output);
+	written &= fflush(output) == 0;
+	if(output != stdout) {
+		written &= fclose(output) == 0;
+	}
+	output = NULL;
+	if(!written) {
+		std::cerr << "Could not write the output: " << strerror(errno) << "\n";
+	}
+	return written;
+}
+
+bool EnrichableI2cDecodeTool::DecodeRaw() {
+	// Every channel's samples are padded to a whole number of words.
+	U64 wordsPerChannel = captureLength / sizeof(uint64_t) / options.channelCount;
+	U64 available = wordsPerChannel * TRANSITION_EXTRACTOR_WORD_BITS;
+	if(captureLength != wordsPerChannel * sizeof(uint64_t) * options.channelCount) {
+		std::cerr << options.capturePath << " does not hold " << options.channelCount << " whole channels of 64-bit words.\n";
+		return false;
+	}
+	if(options.sampleCount > available) {
+		std::cerr << options.capturePath << " holds only " << available << " samples per channel.\n";
+		return false;
+	}
+
+	EnrichablePackedCapture packed;
+	packed.words = (const uint64_t*)capture;
+	packed.sampleCount = options.sampleCount ? options.sampleCount : available;
+	packed.channelCount = options.channelCount;
+	// Channels are laid out at their padded length, which a shorter
+	// sample count must not change.
+	if(EnrichableTransitionExtractor::WordsPerChannel(packed.sampleCount) != wordsPerChannel) {
+		std::cerr << "--samples must leave each channel's length in words unchanged.\n";
+		return false;
+	}
+	uint32_t channels[2] = {options.sclChannel, options.sdaChannel};
+	extractor.Reset(packed, channels, 2, options.minimumPulse);
+	sampleRate = options.sampleRate;
+
+	WriteHeader();
+	if(pool) {
+		// Transitions are gathered until a segment's worth has built up and
+		// the bus next goes idle.
+		std::unique_ptr<EnrichableI2cSegment> segment = NewSegment();
+		segment->sclHigh = extractor.InitialLevel(0);
+		segment->sdaHigh = extractor.InitialLevel(1);
+		segment->first = true;
+		size_t searched = 0;
+		while(extractor.Next()) {
+			const std::vector<uint64_t>& scl = extractor.Transitions(0);
+			const std::vector<uint64_t>& sda = extractor.Transitions(1);
+			segment->scl.insert(segment->scl.end(), scl.begin(), scl.end());
+			segment->sda.insert(segment->sda.end(), sda.begin(), sda.end());
+
+			size_t total = segment->scl.size() + segment->sda.size();
+			if(total < DECODE_TOOL_SEGMENT_TRANSITIONS) {
+				continue;
+			}
+			size_t fromSda = std::max(searched, size_t(U64(segment->sda.size()) * DECODE_TOOL_SEGMENT_TRANSITIONS / total));
+			size_t sclSplit, sdaSplit;
+			if(!FindSplit(segment->scl.data(), segment->scl.size(), segment->sda.data(), segment->sda.size(), segment->sclHigh, segment->sdaHigh, fromSda, false, sclSplit, sdaSplit)) {
+				// The last SDA transition may yet turn out to be a STOP.
+				searched = segment->sda.empty() ? 0 : segment->sda.size() - 1;
+				continue;
+			}
+
+			std::unique_ptr<EnrichableI2cSegment> next = NewSegment();
+			next->scl.assign(segment->scl.begin() + sclSplit, segment->scl.end());
+			next->sda.assign(segment->sda.begin() + sdaSplit, segment->sda.end());
+			next->sclHigh = true;
+			next->sdaHigh = true;
+			next->first = false;
+			segment->scl.resize(sclSplit);
+			segment->sda.resize(sdaSplit);
+			segment->input = {segment->scl.data(), segment->scl.size(), segment->sda.data(), segment->sda.size()};
+			segment->last = false;
+			SubmitSegment(std::move(segment));
+			segment = std::move(next);
+			searched = 0;
+		}
+		segment->input = {segment->scl.data(), segment->scl.size(), segment->sda.data(), segment->sda.size()};
+		segment->last = true;
+		SubmitSegment(std::move(segment));
+		return true;
+	}
+
+	decoder.Reset(extractor.InitialLevel(0), extractor.InitialLevel(1));
+	EnrichableI2cTransitions input;
+	while(extractor.Next()) {
+		extractor.GetI2cTransitions(0, 1, input);
+		Decode(input);
+	}
+	return true;
+}
+
+bool EnrichableI2cDecodeTool::DecodeTransitionList() {
+	const EnrichableTransitionListHeader* header = (const EnrichableTransitionListHeader*)capture;
+	if(captureLength < sizeof(*header) || memcmp(header->magic, TRANSITION_LIST_MAGIC, sizeof(header->magic))) {
+		std::cerr << options.capturePath << " is not a transition list.\n";
+		return false;
+	}
+	if(header->version != TRANSITION_LIST_VERSION) {
+		std::cerr << options.capturePath << " is a transition list of unsupported version " << header->version << ".\n";
+		return false;
+	}
+	U64 available = (captureLength - sizeof(*header)) / sizeof(uint64_t);
+	if(header->sclCount > available || header->sdaCount > available - header->sclCount) {
+		std::cerr << options.capturePath << " is truncated.\n";
+		return false;
+	}
+	sampleRate = header->sampleRate;
+
+	WriteHeader();
+	// The transitions are decoded where they lie in the mapping.
+	const uint64_t* transitions = (const uint64_t*)(capture + sizeof(*header));
+	if(pool) {
+		DecodeSegments(transitions, header->sclCount, transitions + header->sclCount, header->sdaCount, header->sclInitial != 0, header->sdaInitial != 0);
+		return true;
+	}
+	EnrichableI2cTransitions input;
+	input.scl = transitions;
+	input.sclCount = header->sclCount;
+	input.sda = transitions + header->sclCount;
+	input.sdaCount = header->sdaCount;
+	decoder.Reset(header->sclInitial != 0, header->sdaInitial != 0);
+	Decode(input);
+	return true;
+}
+
+void EnrichableI2cDecodeTool::WriteHeader() {
+	if(options.binaryOutput) {
+		EnrichableFrameFileHeader header = {{'I', '2', 'C', 'F'}, FRAME_FILE_VERSION, sampleRate, 0};
+		fwrite(&header, sizeof(header), 1, output);
+	} else if(enriched) {
+		fputs("Time [s],Packet ID,Address,Data,Read/Write,ACK/NAK,Enrichment\n", output);
+	} else {
+		fputs("Time [s],Packet ID,Address,Data,Read/Write,ACK/NAK\n", output);
+	}
+}
+
+void EnrichableI2cDecodeTool::Decode(EnrichableI2cTransitions& input) {
+	bool done = false;
+	while(!done) {
+		EnrichableI2cOutput decoded = {events.data(), events.size(), 0, arrows.data(), arrows.size(), 0};
+		done = decoder.Decode(input, decoded);
+		RecordEvents(decoded);
+	}
+}
+
+void EnrichableI2cDecodeTool::DecodeSegments(const uint64_t* scl, size_t sclCount, const uint64_t* sda, size_t sdaCount, bool sclHigh, bool sdaHigh) {
+	bool first = true;
+	for(;;) {
+		std::unique_ptr<EnrichableI2cSegment> segment = NewSegment();
+		segment->sclHigh = sclHigh;
+		segment->sdaHigh = sdaHigh;
+		segment->first = first;
+
+		size_t total = sclCount + sdaCount;
+		size_t sclSplit = sclCount;
+		size_t sdaSplit = sdaCount;
+		segment->last = total <= DECODE_TOOL_SEGMENT_TRANSITIONS ||
+			!FindSplit(scl, sclCount, sda, sdaCount, sclHigh, sdaHigh, size_t(U64(sdaCount) * DECODE_TOOL_SEGMENT_TRANSITIONS / total), true, sclSplit, sdaSplit);
+		if(segment->last) {
+			sclSplit = sclCount;
+			sdaSplit = sdaCount;
+		}
+		segment->input = {scl, sclSplit, sda, sdaSplit};
+		SubmitSegment(std::move(segment));
+		if(sclSplit == sclCount && sdaSplit == sdaCount) {
+			return;
+		}
+
+		scl += sclSplit;
+		sclCount -= sclSplit;
+		sda += sdaSplit;
+		sdaCount -= sdaSplit;
+		sclHigh = true;
+		sdaHigh = true;
+		first = false;
+	}
+}
+
+bool EnrichableI2cDecodeTool::FindSplit(
+	const uint64_t* scl,
+	size_t sclCount,
+	const uint64_t* sda,
+	size_t sdaCount,
+	bool sclHigh,
+	bool sdaHigh,
+	size_t fromSda,
+	bool complete,
+	size_t& sclSplit,
+	size_t& sdaSplit
+) {
+	if(fromSda >= sdaCount) {
+		return false;
+	}
+
+	// A STOP is SDA rising while SCL is high; the bus is idle from then
+	// until SDA falls again for a START, so long as SCL stays high
+	// throughout.  Decoding from there gives what the whole capture
+	// would, since the decoder keeps nothing across a STOP but waiting
+	// for a START.
+	size_t sclIndex = std::lower_bound(scl, scl + sclCount, sda[fromSda]) - scl;
+	for(size_t i = fromSda; i + 1 < sdaCount; i++) {
+		while(sclIndex < sclCount && scl[sclIndex] < sda[i]) {
+			sclIndex++;
+		}
+		// Each line's level after a number of transitions
+		bool sdaRose = sdaHigh != ((i + 1) % 2 == 1);
+		bool sclWasHigh = sclHigh != (sclIndex % 2 == 1);
+		if(!sdaRose || !sclWasHigh) {
+			continue;
+		}
+		if(sclIndex < sclCount ? scl[sclIndex] <= sda[i + 1] : !complete) {
+			continue;
+		}
+		sclSplit = sclIndex;
+		sdaSplit = i + 1;
+		return true;
+	}
+	return false;
+}
+
+std::unique_ptr<EnrichableI2cSegment> EnrichableI2cDecodeTool::NewSegment() {
+	// Written segments are reused, so that their buffers need not be
+	// allocated and faulted in again for every segment.
+	if(spareSegments.empty()) {
+		return std::unique_ptr<EnrichableI2cSegment>(new EnrichableI2cSegment());
+	}
+	std::unique_ptr<EnrichableI2cSegment> segment = std::move(spareSegments.back());
+	spareSegments.pop_back();
+	segment->scl.clear();
+	segment->sda.clear();
+	segment->decoded = std::promise<void>();
+	return segment;
+}
+
+void EnrichableI2cDecodeTool::SubmitSegment(std::unique_ptr<EnrichableI2cSegment> segment) {
+	EnrichableI2cSegment* submitted = segment.get();
+	segments.push_back(std::move(segment));
+	segmentCount++;
+	pool->Submit([submitted] { DecodeSegment(*submitted); });
+
+	// Decoding runs ahead of writing by only so many segments, so that
+	// an unending capture is not held in memory.
+	MergeSegments(pool->ThreadCount() * DECODE_TOOL_SEGMENTS_PER_THREAD);
+}
+
+void EnrichableI2cDecodeTool::MergeSegments(size_t keep) {
+	while(segments.size() > keep) {
+		EnrichableI2cSegment& segment = *segments.front();
+		segment.decoded.get_future().wait();
+
+		// Frames and packets are numbered here, in capture order.
+		EnrichableI2cOutput decoded = {
+			segment.events.data(),
+			segment.events.size(),
+			segment.events.size(),
+			segment.arrows.data(),
+			segment.arrows.size(),
+			segment.arrows.size()
+		};
+		RecordEvents(decoded);
+		spareSegments.push_back(std::move(segments.front()));
+		segments.pop_front();
+	}
+}
+
+void EnrichableI2cDecodeTool::DecodeSegment(EnrichableI2cSegment& segment) {
+	EnrichableI2cDecoder decoder;
+	decoder.Reset(segment.sclHigh, segment.sdaHigh);
+	// Sized for a byte every 16 clock edges and a START or STOP every 4
+	// data edges, so that they seldom need to grow; a reused segment's
+	// buffers are kept at least as large as they were.
+	size_t frames = segment.input.sclCount / 16 + DECODE_TOOL_EVENT_CHUNK;
+	size_t events = frames + segment.input.sdaCount / 4;
+	segment.events.resize(std::max(segment.events.capacity(), events));
+	segment.arrows.resize(std::max(segment.arrows.capacity(), frames * I2C_DECODER_BITS));
+
+	EnrichableI2cTransitions input = segment.input;
+	EnrichableI2cOutput decoded = {NULL, 0, 0, NULL, 0, 0};
+	for(;;) {
+		decoded.events = segment.events.data();
+		decoded.eventCapacity = segment.events.size();
+		decoded.arrows = segment.arrows.data();
+		decoded.arrowCapacity = segment.arrows.size();
+		if(decoder.Decode(input, decoded)) {
+			break;
+		}
+		segment.events.resize(segment.events.size() * 2);
+		segment.arrows.resize(segment.arrows.size() * 2);
+	}
+	if(segment.last) {
+		if(decoded.eventCapacity == decoded.eventCount || decoded.arrowCapacity - decoded.arrowCount < I2C_DECODER_BITS) {
+			segment.events.resize(segment.events.size() + 1);
+			segment.arrows.resize(segment.arrows.size() + I2C_DECODER_BITS);
+			decoded.events = segment.events.data();
+			decoded.eventCapacity = segment.events.size();
+			decoded.arrows = segment.arrows.data();
+			decoded.arrowCapacity = segment.arrows.size();
+		}
+		// A byte whose acknowledge bit began before the end is still a byte.
+		decoder.Finish(decoded);
+	}
+	segment.events.resize(decoded.eventCount);
+	segment.arrows.resize(decoded.arrowCount);
+
+	// A later segment's decoder starts out waiting for the bus to start;
+	// in the whole capture, its first START would have followed a STOP.
+	if(!segment.first) {
+		for(EnrichableI2cEvent& event : segment.events) {
+			if(event.kind == EnrichableI2cDecoder::EventBusStart) {
+				event.kind = EnrichableI2cDecoder::EventStart;
+			}
+		}
+	}
+	segment.decoded.set_value();
+}
+
+void EnrichableI2cDecodeTool::RecordEvents(const EnrichableI2cOutput& decoded) {
+	for(size_t i = 0; i < decoded.eventCount; i++) {
+		const EnrichableI2cEvent& event = decoded.events[i];
+		switch(event.kind) {
+			case EnrichableI2cDecoder::EventFrame:
+				RecordFrame(event);
+				break;
+			case EnrichableI2cDecoder::EventStart:
+			case EnrichableI2cDecoder::EventStop:
+				// Packets are numbered only when they hold frames, as
+				// CommitPacketAndStartNewPacket does.
+				if(!packetFrames.empty()) {
+					CommitPacket(nextPacketId++);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+void EnrichableI2cDecodeTool::RecordFrame(const EnrichableI2cEvent& event) {
+	Frame frame;
+	frame.mStartingSampleInclusive = event.startingSample;
+	frame.mEndingSampleInclusive = event.endingSample;
+	frame.mData1 = event.value;
+	frame.mData2 = 0;
+	if(event.ack == I2C_DECODER_MISSING_ACK) {
+		frame.mFlags = I2C_MISSING_FLAG_ACK;
+	} else if(event.ack == I2C_DECODER_NAK) {
+		frame.mFlags = DISPLAY_AS_WARNING_FLAG;
+	} else {
+		frame.mFlags = I2C_FLAG_ACK;
+	}
+	frame.mType = event.address ? I2cAddress : I2cData;
+	if(frame.mType == I2cAddress) {
+		currentAddress = U8(frame.mData1 >> 1);
+	}
+	U32 context = 0;
+	if(registerMap.IsLoaded()) {
+		context = registerPointers.GetContext(registerMap, currentAddress, frame.mType == I2cAddress, frame);
+	}
+
+	// Requested now, so that a script in tagged mode works on the packet
+	// while it is still being decoded; collected as it is written.  The
+	// script is not asked about frames the register map describes.
+	packetTabular.push_back(std::future<std::vector<std::string>>());
+	bool mapped = context != 0 && registerMap.GetText(context, frame) != NULL;
+	if(!mapped && subprocess && subprocess->TabularEnabled() && subprocess->Subscribes(currentAddress, frame)) {
+		packetTabular.back() = subprocess->EmitTabularAsync(nextPacketId, frameCount, frame);
+	}
+	packetFrames.push_back(frame);
+	packetContexts.push_back(context);
+	frameCount++;
+}
+
+void EnrichableI2cDecodeTool::CommitPacket(U64 packetId) {
+	for(size_t i = 0; i < packetFrames.size(); i++) {
+		WriteFrame(packetFrames[i], packetContexts[i], packetId, &packetTabular[i]);
+	}
+	packetFrames.clear();
+	packetContexts.clear();
+	packetTabular.clear();
+}
+
+void EnrichableI2cDecodeTool::WriteFrame(const Frame& frame, U32 context, U64 packetId, std::future<std::vector<std::string>>* tabular) {
+	if(options.binaryOutput) {
+		EnrichableFrameFileRecord record;
+		record.startingSample = frame.mStartingSampleInclusive;
+		record.endingSample = frame.mEndingSampleInclusive;
+		record.packetId = packetId;
+		record.data = U8(frame.mData1);
+		record.type = frame.mType;
+		record.flags = frame.mFlags;
+		record.reserved = 0;
+		record.context = context;
+		fwrite(&record, sizeof(record), 1, output);
+		return;
+	}
+
+	// As GenerateExportFile: an address only has a line of its own when
+	// it is not acknowledged, and otherwise heads its data's lines.
+	if(frame.mType == I2cAddress) {
+		switch(options.addressDisplay) {
+			case NO_DIRECTION_7:
+				AnalyzerHelpers::GetNumberString(frame.mData1 >> 1, options.displayBase, 7, address, sizeof(address));
+				break;
+			case NO_DIRECTION_8:
+				AnalyzerHelpers::GetNumberString(frame.mData1 & 0xFE, options.displayBase, 8, address, sizeof(address));
+				break;
+			case YES_DIRECTION_8:
+				AnalyzerHelpers::GetNumberString(frame.mData1, options.displayBase, 8, address, sizeof(address));
+				break;
+		}
+		direction = (frame.mData1 & 0x1) ? "Read" : "Write";
+
+		if((frame.mFlags & I2C_FLAG_ACK) == 0) {
+			const char* ack = (frame.mFlags & I2C_MISSING_FLAG_ACK) ? "Missing ACK/NAK" : "NAK";
+			WriteCsvLine(frame, context, INVALID_RESULT_INDEX, "", ack, tabular);
+		}
+		return;
+	}
+
+	char data[128];
+	AnalyzerHelpers::GetNumberString(frame.mData1, options.displayBase, 8, data, sizeof(data));
+	const char* ack;
+	if(frame.mFlags & I2C_FLAG_ACK) {
+		ack = "ACK";
+	} else if(frame.mFlags & I2C_MISSING_FLAG_ACK) {
+		ack = "Missing ACK/NAK";
+	} else {
+		ack = "NAK";
+	}
+	WriteCsvLine(frame, context, packetId, data, ack, tabular);
+}
+
+void EnrichableI2cDecodeTool::WriteCsvLine(const Frame& frame, U32 context, U64 packetId, const char* data, const char* ack, std::future<std::vector<std::string>>* tabular) {
+	char time[128];
+	AnalyzerHelpers::GetTimeString(frame.mStartingSampleInclusive, 0, sampleRate, time, sizeof(time));
+
+	line.assign(time);
+	line += ',';
+	if(packetId != INVALID_RESULT_INDEX) {
+		line += std::to_string(packetId);
+	}
+	line += ',';
+	line += address;
+	line += ',';
+	line += data;
+	line += ',';
+	line += direction;
+	line += ',';
+	line += ack;
+	if(enriched) {
+		AppendEnrichment(frame, context, tabular);
+	}
+	line += '\n';
+	fwrite(line.data(), 1, line.length(), output);
+}
+
+void EnrichableI2cDecodeTool::AppendEnrichment(const Frame& frame, U32 context, std::future<std::vector<std::string>>* tabular) {
+	// The same text the frame's tabular entry would show, quoted for CSV
+	// with its lines separated by "; ".
+	std::vector<std::string> lines;
+	const std::vector<std::string>* mapped = registerMap.GetText(context, frame);
+	if(mapped != NULL) {
+		lines.push_back(mapped->back());
+	} else if(tabular->valid()) {
+		lines = tabular->get();
+	}
+
+	line += ",\"";
+	for(size_t i = 0; i < lines.size(); i++) {
+		if(i > 0) {
+			line += "; ";
+		}
+		for(char c : lines[i]) {
+			if(c == '"') {
+				line += '"';
+			}
+			line += c;
+		}
+	}
+	line += '"';
+}
+
+int main(int argc, char** argv) {
+	EnrichableI2cDecodeOptions options;
+	if(!EnrichableI2cDecodeTool::ParseArguments(argc, argv, options)) {
+		return 2;
+	}
+
+	EnrichableI2cDecodeTool tool;
+	return tool.Run(options);
+}
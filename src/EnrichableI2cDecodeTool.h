@@ -0,0 +1,202 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include "AnalyzerResults.h"
+#include "EnrichableAnalyzerSubprocess.h"
+#include "EnrichableI2cAnalyzerSettings.h"
+#include "EnrichableI2cDecoder.h"
+#include "EnrichableRegisterMap.h"
+#include "EnrichableTransitionExtractor.h"
+#include "EnrichableWorkStealingPool.h"
+
+#include <stdio.h>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Events and arrows the decoder may emit per call
+#define DECODE_TOOL_EVENT_CHUNK 4096
+// Bytes buffered by the output file
+#define DECODE_TOOL_OUTPUT_BUFFER (1 << 20)
+// Transitions in each segment of a parallel decode, before it is
+// extended to the next point where the bus is idle
+#define DECODE_TOOL_SEGMENT_TRANSITIONS (1 << 20)
+// Segments decoded or being decoded but not yet written, per thread
+#define DECODE_TOOL_SEGMENTS_PER_THREAD 4
+
+// A transition-list capture: this header, then the header's sclCount
+// SCL transition samples and sdaCount SDA transition samples, each a
+// little-endian 64-bit integer in increasing order.
+#define TRANSITION_LIST_MAGIC "I2CT"
+#define TRANSITION_LIST_VERSION 1
+struct EnrichableTransitionListHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t sampleRate;
+	// The level of each line before its first transition
+	uint8_t sclInitial;
+	uint8_t sdaInitial;
+	uint16_t reserved;
+	uint64_t sampleCount;
+	uint64_t sclCount;
+	uint64_t sdaCount;
+};
+
+// A binary frame file: this header, then one record per frame.
+#define FRAME_FILE_MAGIC "I2CF"
+#define FRAME_FILE_VERSION 1
+struct EnrichableFrameFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t sampleRate;
+	uint32_t reserved;
+};
+struct EnrichableFrameFileRecord {
+	uint64_t startingSample;
+	uint64_t endingSample;
+	// All ones for a frame after the last STOP
+	uint64_t packetId;
+	uint8_t data;
+	// I2cFrameType
+	uint8_t type;
+	uint8_t flags;
+	uint8_t reserved;
+	// The register map's context for the frame, or 0
+	uint32_t context;
+};
+
+// A stretch of a capture decoded by itself in a parallel decode.  Every
+// segment but the first begins at the bus going idle: after a STOP, with
+// both lines high until the next START.
+struct EnrichableI2cSegment {
+	EnrichableI2cTransitions input;
+	// The transitions, when they are not decoded where they lie
+	std::vector<uint64_t> scl;
+	std::vector<uint64_t> sda;
+	bool sclHigh;
+	bool sdaHigh;
+	bool first;
+	bool last;
+
+	std::vector<EnrichableI2cEvent> events;
+	std::vector<uint64_t> arrows;
+	std::promise<void> decoded;
+};
+
+struct EnrichableI2cDecodeOptions {
+	EnrichableI2cDecodeOptions();
+
+	std::string capturePath;
+	// Standard output if empty
+	std::string outputPath;
+	bool transitionList;
+	bool binaryOutput;
+	// Raw captures only; transition lists carry their own
+	U32 sampleRate;
+	U32 channelCount;
+	U32 sclChannel;
+	U32 sdaChannel;
+	// 0 for every sample in the file
+	U64 sampleCount;
+	U64 minimumPulse;
+	// An enrichment script, or a plugin, as "Enrichment Script" takes it
+	std::string enrichmentCommand;
+	U32 poolSize;
+	// Threads decoding at once; 0 for one per core
+	U32 threadCount;
+	std::string registerMapFile;
+	AddressDisplay addressDisplay;
+	DisplayBase displayBase;
+};
+
+// Decodes a capture file outside Logic with the analyzer's decoder,
+// writing the frames as GenerateExportFile would, or as a binary frame
+// file.  The capture is memory-mapped, and a transition list is decoded
+// where it lies.
+class EnrichableI2cDecodeTool {
+	public:
+		EnrichableI2cDecodeTool();
+		virtual ~EnrichableI2cDecodeTool();
+
+		// Reports usage to stderr and returns false if the arguments are
+		// not understood.
+		static bool ParseArguments(int argc, char** argv, EnrichableI2cDecodeOptions& options);
+		// Returns the process exit status.
+		int Run(const EnrichableI2cDecodeOptions& options);
+	protected:
+		bool MapCapture();
+		void UnmapCapture();
+		bool OpenOutput();
+		bool CloseOutput();
+		bool DecodeRaw();
+		bool DecodeTransitionList();
+		void WriteHeader();
+		void Decode(EnrichableI2cTransitions& input);
+		void DecodeSegments(const uint64_t* scl, size_t sclCount, const uint64_t* sda, size_t sdaCount, bool sclHigh, bool sdaHigh);
+		std::unique_ptr<EnrichableI2cSegment> NewSegment();
+		void SubmitSegment(std::unique_ptr<EnrichableI2cSegment> segment);
+		// Writes decoded segments, in order, until no more than keep are
+		// left outstanding.
+		void MergeSegments(size_t keep);
+		static void DecodeSegment(EnrichableI2cSegment& segment);
+		// Finds the first idle point at or after the fromSda'th SDA
+		// transition, returning how many transitions of each line come
+		// before it.  Without complete, more may follow the last given.
+		static bool FindSplit(
+			const uint64_t* scl,
+			size_t sclCount,
+			const uint64_t* sda,
+			size_t sdaCount,
+			bool sclHigh,
+			bool sdaHigh,
+			size_t fromSda,
+			bool complete,
+			size_t& sclSplit,
+			size_t& sdaSplit
+		);
+		void RecordEvents(const EnrichableI2cOutput& output);
+		void RecordFrame(const EnrichableI2cEvent& event);
+		void CommitPacket(U64 packetId);
+		void WriteFrame(const Frame& frame, U32 context, U64 packetId, std::future<std::vector<std::string>>* tabular);
+		void WriteCsvLine(const Frame& frame, U32 context, U64 packetId, const char* data, const char* ack, std::future<std::vector<std::string>>* tabular);
+		void AppendEnrichment(const Frame& frame, U32 context, std::future<std::vector<std::string>>* tabular);
+
+		EnrichableI2cDecodeOptions options;
+		int captureFile;
+		const uint8_t* capture;
+		size_t captureLength;
+		FILE* output;
+		std::vector<char> outputBuffer;
+		U32 sampleRate;
+
+		EnrichableI2cDecoder decoder;
+		std::vector<EnrichableI2cEvent> events;
+		std::vector<uint64_t> arrows;
+		EnrichableTransitionExtractor extractor;
+		std::unique_ptr<EnrichableWorkStealingPool> pool;
+		std::deque<std::unique_ptr<EnrichableI2cSegment>> segments;
+		std::vector<std::unique_ptr<EnrichableI2cSegment>> spareSegments;
+		U64 segmentCount;
+
+		std::unique_ptr<EnrichableAnalyzerSubprocess> subprocess;
+		EnrichableRegisterMap registerMap;
+		EnrichableRegisterPointers registerPointers;
+		bool enriched;
+
+		// 7-bit address of the frame being decoded, or UNKNOWN_ADDRESS
+		U8 currentAddress;
+		std::vector<Frame> packetFrames;
+		// The register map's context for each of packetFrames, or 0
+		std::vector<U32> packetContexts;
+		std::vector<std::future<std::vector<std::string>>> packetTabular;
+		U64 nextPacketId;
+		U64 frameCount;
+
+		// The last address frame's text, for the data frames after it
+		char address[128];
+		const char* direction;
+		// Reused for every line
+		std::string line;
+};
@@ -0,0 +1,173 @@
+#include "EnrichableI2cDecoder.h"
+
+#include <string.h>
+
+EnrichableI2cDecoder::EnrichableI2cDecoder()
+{
+	Reset(true, true);
+}
+
+EnrichableI2cDecoder::~EnrichableI2cDecoder()
+{
+}
+
+void EnrichableI2cDecoder::Reset(bool _sclHigh, bool _sdaHigh) {
+	state = SeekingStart;
+	sclHigh = _sclHigh;
+	sdaHigh = _sdaHigh;
+	needAddress = true;
+	bit = 0;
+	value = 0;
+	lastFall = 0;
+	ackRise = 0;
+	ackHigh = false;
+}
+
+bool EnrichableI2cDecoder::Decode(EnrichableI2cTransitions& input, EnrichableI2cOutput& output) {
+	while(input.sclCount > 0 || input.sdaCount > 0) {
+		if(
+			output.eventCapacity - output.eventCount < I2C_DECODER_EVENTS_PER_TRANSITION ||
+			output.arrowCapacity - output.arrowCount < I2C_DECODER_BITS
+		) {
+			return false;
+		}
+
+		// The clock goes first at the same sample only when it is falling.
+		bool clock;
+		if(input.sdaCount == 0) {
+			clock = true;
+		} else if(input.sclCount == 0) {
+			clock = false;
+		} else if(*input.scl != *input.sda) {
+			clock = *input.scl < *input.sda;
+		} else {
+			clock = sclHigh;
+		}
+
+		if(clock) {
+			uint64_t sample = *input.scl++;
+			input.sclCount--;
+			sclHigh = !sclHigh;
+			if(sclHigh) {
+				ClockRise(sample);
+			} else {
+				ClockFall(sample, output);
+			}
+		} else {
+			uint64_t sample = *input.sda++;
+			input.sdaCount--;
+			sdaHigh = !sdaHigh;
+			DataEdge(sample, output);
+		}
+	}
+
+	return true;
+}
+
+void EnrichableI2cDecoder::Finish(EnrichableI2cOutput& output) {
+	if(state != BitHigh || bit != I2C_DECODER_BITS) {
+		return;
+	}
+	if(output.eventCapacity == output.eventCount || output.arrowCapacity - output.arrowCount < I2C_DECODER_BITS) {
+		return;
+	}
+
+	EmitFrame(ackRise, ackHigh ? I2C_DECODER_NAK : I2C_DECODER_ACK, needAddress, output);
+	needAddress = false;
+	state = BitLow;
+	bit = 0;
+}
+
+void EnrichableI2cDecoder::ClockRise(uint64_t sample) {
+	// Data is read on the rising edge.
+	if(state != BitLow) {
+		return;
+	}
+
+	if(bit < I2C_DECODER_BITS) {
+		arrows[bit] = sample;
+		value = (uint8_t)((value << 1) | (sdaHigh ? 1 : 0));
+	} else {
+		ackRise = sample;
+		ackHigh = sdaHigh;
+	}
+	state = BitHigh;
+}
+
+void EnrichableI2cDecoder::ClockFall(uint64_t sample, EnrichableI2cOutput& output) {
+	switch(state) {
+		case SeekingStart:
+			return;
+		case AfterStart:
+		case Aborted:
+			break;
+		case BitLow:
+			return;
+		case BitHigh:
+			if(bit < I2C_DECODER_BITS) {
+				if(++bit == I2C_DECODER_BITS) {
+					lastFall = sample;
+				}
+				state = BitLow;
+				return;
+			}
+			EmitFrame(sample, ackHigh ? I2C_DECODER_NAK : I2C_DECODER_ACK, needAddress, output);
+			needAddress = false;
+			break;
+	}
+
+	state = BitLow;
+	bit = 0;
+	value = 0;
+}
+
+void EnrichableI2cDecoder::DataEdge(uint64_t sample, EnrichableI2cOutput& output) {
+	switch(state) {
+		case SeekingStart:
+			if(!sdaHigh && sclHigh) {
+				EmitCondition(EventBusStart, sample, output);
+				state = AfterStart;
+			}
+			return;
+		case AfterStart:
+		case BitLow:
+			// Data may change freely while the clock is low.
+			return;
+		case BitHigh:
+		case Aborted:
+			break;
+	}
+
+	// SDA changed while the clock was high: falling is a START, rising a
+	// STOP.  Either ends the byte; one cut short in its acknowledge bit
+	// is still emitted, after the condition.
+	EmitCondition(sdaHigh ? EventStop : EventStart, sample, output);
+	needAddress = true;
+	if(state == BitHigh && bit == I2C_DECODER_BITS) {
+		EmitFrame(lastFall, I2C_DECODER_MISSING_ACK, false, output);
+	}
+	state = Aborted;
+}
+
+void EnrichableI2cDecoder::EmitCondition(uint8_t kind, uint64_t sample, EnrichableI2cOutput& output) {
+	EnrichableI2cEvent& event = output.events[output.eventCount++];
+	event.startingSample = sample;
+	event.endingSample = sample;
+	event.kind = kind;
+	event.value = 0;
+	event.ack = 0;
+	event.address = 0;
+}
+
+void EnrichableI2cDecoder::EmitFrame(uint64_t endingSample, uint8_t ack, bool address, EnrichableI2cOutput& output) {
+	EnrichableI2cEvent& event = output.events[output.eventCount++];
+	event.startingSample = arrows[0];
+	event.endingSample = endingSample;
+	event.kind = EventFrame;
+	event.value = value;
+	event.ack = ack;
+	event.address = address ? 1 : 0;
+
+	memcpy(output.arrows + output.arrowCount, arrows, sizeof(arrows));
+	output.arrowCount += I2C_DECODER_BITS;
+}
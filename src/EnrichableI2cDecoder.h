@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Data bits in a byte, and arrows recorded for each decoded byte
+#define I2C_DECODER_BITS 8
+
+// Most events a single transition can produce: a START or STOP that
+// cuts short an acknowledge bit, followed by that byte's frame.
+#define I2C_DECODER_EVENTS_PER_TRANSITION 2
+
+// How a byte was acknowledged
+#define I2C_DECODER_ACK 0
+#define I2C_DECODER_NAK 1
+// A START or STOP arrived in place of the acknowledge bit
+#define I2C_DECODER_MISSING_ACK 2
+
+// A byte, or a START or STOP condition, in the order the decoder found
+// them.  Conditions have both samples set to the SDA edge.
+struct EnrichableI2cEvent {
+	uint64_t startingSample;
+	uint64_t endingSample;
+	uint8_t kind;
+	uint8_t value;
+	uint8_t ack;
+	// Non-zero for the first byte after a START
+	uint8_t address;
+};
+
+// The sample numbers of each line's transitions, in increasing order.
+// Decode consumes them from the front.
+struct EnrichableI2cTransitions {
+	const uint64_t* scl;
+	size_t sclCount;
+	const uint64_t* sda;
+	size_t sdaCount;
+};
+
+// Caller-owned buffers that events, and the sample of every byte's
+// I2C_DECODER_BITS rising clock edges, are appended to; arrows holds
+// those of each frame event in turn.
+struct EnrichableI2cOutput {
+	EnrichableI2cEvent* events;
+	size_t eventCapacity;
+	size_t eventCount;
+	uint64_t* arrows;
+	size_t arrowCapacity;
+	size_t arrowCount;
+};
+
+// The bit-level I2C state machine, free of the analyzer SDK, so that it
+// can run outside Logic.  It sweeps both lines' transitions together in
+// a single pass: data is sampled on each rising clock edge, and an SDA
+// edge while the clock is high is a START or STOP.  At the same sample,
+// an SDA edge counts as before a rising clock edge and after a falling
+// one.
+class EnrichableI2cDecoder {
+	public:
+		enum EventKind {
+			EventFrame = 0,
+			// The first START, found while waiting for the bus to start
+			EventBusStart = 1,
+			EventStart = 2,
+			EventStop = 3
+		};
+
+		EnrichableI2cDecoder();
+		virtual ~EnrichableI2cDecoder();
+
+		// Starts over, with each line's level before its first transition.
+		void Reset(bool sclHigh, bool sdaHigh);
+		// Every transition up to the last one given, on either line, must
+		// be given.  Returns false if it stopped early because the output
+		// buffers could not hold what the next transition might produce;
+		// the rest of the input is left in place.
+		bool Decode(EnrichableI2cTransitions& input, EnrichableI2cOutput& output);
+		// At the end of the data, emits a byte whose acknowledge bit has
+		// begun but not ended.
+		void Finish(EnrichableI2cOutput& output);
+	protected:
+		enum State {
+			SeekingStart,
+			// Waiting for the clock to fall after the first START
+			AfterStart,
+			BitLow,
+			BitHigh,
+			// A START or STOP cut a byte short; waiting for the clock to fall
+			Aborted
+		};
+
+		void ClockRise(uint64_t sample);
+		void ClockFall(uint64_t sample, EnrichableI2cOutput& output);
+		void DataEdge(uint64_t sample, EnrichableI2cOutput& output);
+		void EmitCondition(uint8_t kind, uint64_t sample, EnrichableI2cOutput& output);
+		void EmitFrame(uint64_t endingSample, uint8_t ack, bool address, EnrichableI2cOutput& output);
+
+		State state;
+		bool sclHigh;
+		bool sdaHigh;
+		bool needAddress;
+
+		// The byte being decoded; bit counts up to I2C_DECODER_BITS for
+		// the acknowledge bit.
+		uint32_t bit;
+		uint8_t value;
+		uint64_t arrows[I2C_DECODER_BITS];
+		uint64_t lastFall;
+		uint64_t ackRise;
+		bool ackHigh;
+};
@@ -0,0 +1,173 @@
+#include "EnrichableI2cTransactions.h"
+#include "EnrichableI2cAnalyzerResults.h"
+
+#include <string.h>
+
+EnrichableI2cTransactions::EnrichableI2cTransactions()
+{
+}
+
+EnrichableI2cTransactions::~EnrichableI2cTransactions()
+{
+}
+
+void EnrichableI2cTransactions::Clear() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	transactions.clear();
+	completedCount = 0;
+	completedTaken = 0;
+	hasPendingWrite = false;
+}
+
+U32 EnrichableI2cTransactions::AddPacket(
+	U64 packetId,
+	U64 firstFrame,
+	const std::vector<Frame>& frames,
+	bool repeatedStart
+) {
+	completedCount = 0;
+	completedTaken = 0;
+
+	if(frames.empty()) {
+		return 0;
+	}
+
+	const Frame& addressFrame = frames.front();
+	bool isAddress = IsAddress(addressFrame);
+	U8 address = (U8)(addressFrame.mData1 >> 1);
+	bool read = (addressFrame.mData1 & 0x1) != 0;
+
+	if(hasPendingWrite) {
+		hasPendingWrite = false;
+
+		// A read of the same device straight after the pointer write
+		// completes a register read.
+		if(
+			isAddress &&
+			read &&
+			address == pendingWrite.address &&
+			packetId == pendingWrite.firstPacket + 1 &&
+			pendingData.size() <= TRANSACTION_REGISTER_SIZE
+		) {
+			EnrichableI2cTransaction transaction = pendingWrite;
+			transaction.packetCount = 2;
+			transaction.frameCount = firstFrame + frames.size() - transaction.firstFrame;
+			transaction.endingSample = frames.back().mEndingSampleInclusive;
+			transaction.read = true;
+			transaction.registerLength = pendingData.size();
+			memcpy(transaction.registerBytes, pendingData.data(), pendingData.size());
+			transaction.payloadFirstFrame = firstFrame + 1;
+			transaction.payloadCount = frames.size() - 1;
+
+			std::vector<U8>& payload = GetNextPayload();
+			for(size_t i = 1; i < frames.size(); i++) {
+				payload.push_back((U8)frames[i].mData1);
+			}
+			Complete(transaction);
+
+			return completedCount;
+		}
+
+		CompletePendingWrite();
+	}
+
+	// Only writes carrying at least a register byte are register accesses;
+	// reads without a pointer write before them are left as packets.
+	if(!isAddress || read || frames.size() < 2) {
+		return completedCount;
+	}
+
+	EnrichableI2cTransaction transaction;
+	transaction.firstPacket = packetId;
+	transaction.packetCount = 1;
+	transaction.firstFrame = firstFrame;
+	transaction.frameCount = frames.size();
+	transaction.startingSample = addressFrame.mStartingSampleInclusive;
+	transaction.endingSample = frames.back().mEndingSampleInclusive;
+	transaction.address = address;
+	transaction.read = false;
+	transaction.registerBytes[0] = (U8)frames[1].mData1;
+	transaction.registerLength = 1;
+	transaction.payloadFirstFrame = firstFrame + 2;
+	transaction.payloadCount = frames.size() - 2;
+
+	if(repeatedStart) {
+		pendingWrite = transaction;
+		pendingData.clear();
+		for(size_t i = 1; i < frames.size(); i++) {
+			pendingData.push_back((U8)frames[i].mData1);
+		}
+		hasPendingWrite = true;
+	} else {
+		std::vector<U8>& payload = GetNextPayload();
+		for(size_t i = 2; i < frames.size(); i++) {
+			payload.push_back((U8)frames[i].mData1);
+		}
+		Complete(transaction);
+	}
+
+	return completedCount;
+}
+
+bool EnrichableI2cTransactions::TakeCompleted(
+	U64& transactionId,
+	EnrichableI2cTransaction& transaction,
+	std::vector<U8>& payload
+) {
+	if(completedTaken >= completedCount) {
+		return false;
+	}
+
+	transactionId = completedIds[completedTaken];
+	transaction = completed[completedTaken];
+	payload.assign(completedPayloads[completedTaken].begin(), completedPayloads[completedTaken].end());
+	completedTaken++;
+
+	return true;
+}
+
+U64 EnrichableI2cTransactions::GetCount() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	return transactions.size();
+}
+
+bool EnrichableI2cTransactions::GetTransaction(U64 transactionId, EnrichableI2cTransaction& transaction) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if(transactionId >= transactions.size()) {
+		return false;
+	}
+	transaction = transactions[transactionId];
+
+	return true;
+}
+
+std::vector<U8>& EnrichableI2cTransactions::GetNextPayload() {
+	std::vector<U8>& payload = completedPayloads[completedCount];
+	payload.clear();
+
+	return payload;
+}
+
+void EnrichableI2cTransactions::Complete(const EnrichableI2cTransaction& transaction) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	completedIds[completedCount] = transactions.size();
+	completed[completedCount] = transaction;
+	completedCount++;
+	transactions.push_back(transaction);
+}
+
+void EnrichableI2cTransactions::CompletePendingWrite() {
+	// The pointer write was not followed by a read after all; it stands
+	// on its own as a register write.
+	std::vector<U8>& payload = GetNextPayload();
+	payload.assign(pendingData.begin() + 1, pendingData.end());
+	Complete(pendingWrite);
+}
+
+bool EnrichableI2cTransactions::IsAddress(const Frame& frame) {
+	return frame.mType == I2cAddress;
+}
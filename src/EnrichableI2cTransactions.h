@@ -0,0 +1,76 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include "AnalyzerResults.h"
+#include <vector>
+#include <deque>
+#include <mutex>
+
+// Register pointers longer than this are not treated as register accesses
+#define TRANSACTION_REGISTER_SIZE 4
+
+// A register access: a write of the register pointer followed by a
+// repeated START and a read, or a write of the register followed by its
+// new contents.
+struct EnrichableI2cTransaction {
+	U64 firstPacket;
+	U32 packetCount;
+	U64 firstFrame;
+	U64 frameCount;
+	U64 startingSample;
+	U64 endingSample;
+	// 7-bit target address
+	U8 address;
+	bool read;
+	// Register pointer bytes, in the order they were sent
+	U8 registerBytes[TRANSACTION_REGISTER_SIZE];
+	U32 registerLength;
+	U64 payloadFirstFrame;
+	U64 payloadCount;
+};
+
+// Groups packets into register transactions as they are decoded.
+// Transactions are numbered in the order they complete; the analysis
+// thread adds them while the display reads them, so the list is kept
+// under a lock.
+class EnrichableI2cTransactions {
+	public:
+		EnrichableI2cTransactions();
+		virtual ~EnrichableI2cTransactions();
+
+		void Clear();
+
+		// Called with each committed packet's frames; returns how many
+		// transactions it completed, to be collected with TakeCompleted.
+		// repeatedStart is set when the packet ended in a START rather
+		// than a STOP.
+		U32 AddPacket(U64 packetId, U64 firstFrame, const std::vector<Frame>& frames, bool repeatedStart);
+		// Returns the completed transactions in order, with their ids and
+		// payload bytes.
+		bool TakeCompleted(U64& transactionId, EnrichableI2cTransaction& transaction, std::vector<U8>& payload);
+
+		U64 GetCount();
+		bool GetTransaction(U64 transactionId, EnrichableI2cTransaction& transaction);
+	protected:
+		std::vector<U8>& GetNextPayload();
+		void Complete(const EnrichableI2cTransaction& transaction);
+		void CompletePendingWrite();
+		static bool IsAddress(const Frame& frame);
+
+		std::mutex lock;
+		std::deque<EnrichableI2cTransaction> transactions;
+
+		// Transactions completed by the last AddPacket; at most the pending
+		// write and the packet itself.
+		U64 completedIds[2];
+		EnrichableI2cTransaction completed[2];
+		std::vector<U8> completedPayloads[2];
+		U32 completedCount = 0;
+		U32 completedTaken = 0;
+
+		// A register write that ended in a repeated START, and may yet turn
+		// out to be the pointer write of a read.
+		bool hasPendingWrite = false;
+		EnrichableI2cTransaction pendingWrite;
+		std::vector<U8> pendingData;
+};
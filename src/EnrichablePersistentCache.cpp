@@ -0,0 +1,489 @@
+#include "EnrichablePersistentCache.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <wordexp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+EnrichablePersistentCache::EnrichablePersistentCache()
+{
+}
+
+EnrichablePersistentCache::~EnrichablePersistentCache()
+{
+	Close();
+}
+
+bool EnrichablePersistentCache::Open(const std::string& directory, const std::string& command, U32 sampleRate) {
+	Close();
+
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	cacheDirectory = directory;
+	identity = GetIdentity(command, sampleRate);
+	fingerprintFrames = 0;
+	fingerprinting = true;
+	hits = 0;
+	misses = 0;
+
+	return true;
+}
+
+void EnrichablePersistentCache::AddCaptureFrame(const Frame& frame) {
+	// Called for every frame decoded; only the first few take the lock.
+	if(!fingerprinting) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	if(!fingerprinting) {
+		return;
+	}
+	Mix(identity, &frame.mStartingSampleInclusive, sizeof(frame.mStartingSampleInclusive));
+	Mix(identity, &frame.mEndingSampleInclusive, sizeof(frame.mEndingSampleInclusive));
+	Mix(identity, &frame.mData1, sizeof(frame.mData1));
+	Mix(identity, &frame.mData2, sizeof(frame.mData2));
+	Mix(identity, &frame.mType, sizeof(frame.mType));
+	Mix(identity, &frame.mFlags, sizeof(frame.mFlags));
+	if(++fingerprintFrames < PERSISTENT_FINGERPRINT_FRAMES) {
+		return;
+	}
+
+	fingerprinting = false;
+	if(OpenFile()) {
+		for(std::pair<U64, std::vector<char>>& pending : pendingRecords) {
+			if(!AppendRecord(pending.first, pending.second)) {
+				break;
+			}
+		}
+	}
+	pendingRecords.clear();
+}
+
+bool EnrichablePersistentCache::OpenFile() {
+	// Must be called with the cache lock held.
+	std::stringstream path;
+	path << cacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << identity << ".cache";
+
+	mkdir(cacheDirectory.c_str(), 0755);
+	cacheFd = open(path.str().c_str(), O_RDWR | O_CREAT, 0644);
+	if(cacheFd < 0) {
+		cacheFd = open(path.str().c_str(), O_RDONLY);
+	}
+	if(cacheFd < 0) {
+		std::cerr << "Unable to open enrichment cache file ";
+		std::cerr << path.str() << ": " << errno << "\n";
+		return false;
+	}
+
+	// Only one analyzer appends to a given file at a time; any others
+	// running the same script can still read what it holds.
+	writable = flock(cacheFd, LOCK_EX | LOCK_NB) == 0;
+
+	struct stat status;
+	if(fstat(cacheFd, &status) < 0) {
+		close(cacheFd);
+		cacheFd = -1;
+		return false;
+	}
+	fileLength = status.st_size;
+
+	char header[PERSISTENT_CACHE_HEADER_SIZE];
+	bool valid = fileLength >= PERSISTENT_CACHE_HEADER_SIZE &&
+		pread(cacheFd, header, sizeof(header), 0) == sizeof(header) &&
+		memcmp(header, PERSISTENT_CACHE_MAGIC, 8) == 0 &&
+		memcmp(header + 8, &identity, 8) == 0;
+	if(!valid) {
+		memcpy(header, PERSISTENT_CACHE_MAGIC, 8);
+		memcpy(header + 8, &identity, 8);
+		if(!writable || ftruncate(cacheFd, 0) < 0 ||
+			pwrite(cacheFd, header, sizeof(header), 0) != sizeof(header)) {
+			std::cerr << "Unable to initialize enrichment cache file ";
+			std::cerr << path.str() << "\n";
+			close(cacheFd);
+			cacheFd = -1;
+			return false;
+		}
+		fileLength = PERSISTENT_CACHE_HEADER_SIZE;
+	}
+
+	if(!MapFile(fileLength)) {
+		close(cacheFd);
+		cacheFd = -1;
+		return false;
+	}
+	IndexRecords();
+	if(writable) {
+		Compact(path.str());
+	}
+
+	std::cerr << "Enrichment cache " << path.str() << ": ";
+	std::cerr << index.size() << " records";
+	std::cerr << (writable ? "" : " (read-only)") << "\n";
+
+	return true;
+}
+
+void EnrichablePersistentCache::Close() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	UnmapFile();
+	if(cacheFd >= 0) {
+		close(cacheFd);
+		cacheFd = -1;
+	}
+	writable = false;
+	fileLength = 0;
+	index.clear();
+	fingerprinting = false;
+	pendingRecords.clear();
+}
+
+bool EnrichablePersistentCache::IsOpen() {
+	return cacheFd >= 0 || fingerprinting;
+}
+
+bool EnrichablePersistentCache::Find(
+	U32 kind,
+	U64 frameIndex,
+	const Frame& frame,
+	U32 sampleCount,
+	std::vector<std::string>& entries
+) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	if(cacheFd < 0) {
+		return false;
+	}
+
+	std::unordered_map<U64, U64>::iterator found = index.find(GetKey(kind, frameIndex));
+	if(found == index.end()) {
+		misses++;
+		return false;
+	}
+
+	U64 offset = found->second;
+	if(offset + PERSISTENT_RECORD_HEADER_SIZE > mappingLength && !MapFile(fileLength)) {
+		misses++;
+		return false;
+	}
+
+	const char* record = mapping + offset;
+	U32 recordSize;
+	S64 startingSample;
+	S64 endingSample;
+	U64 data1;
+	U64 data2;
+	U32 recordSampleCount;
+	U32 entryCount;
+	memcpy(&recordSize, record, 4);
+	memcpy(&startingSample, record + 16, 8);
+	memcpy(&endingSample, record + 24, 8);
+	memcpy(&data1, record + 32, 8);
+	memcpy(&data2, record + 40, 8);
+	memcpy(&recordSampleCount, record + 52, 4);
+	memcpy(&entryCount, record + 56, 4);
+
+	if(
+		startingSample != frame.mStartingSampleInclusive ||
+		endingSample != frame.mEndingSampleInclusive ||
+		data1 != frame.mData1 ||
+		data2 != frame.mData2 ||
+		(U8)record[48] != frame.mType ||
+		(U8)record[49] != frame.mFlags ||
+		recordSampleCount != sampleCount
+	) {
+		misses++;
+		return false;
+	}
+
+	// Entry bounds were checked when the record was indexed.
+	entries.clear();
+	const char* entry = record + PERSISTENT_RECORD_HEADER_SIZE;
+	for(U32 i = 0; i < entryCount; i++) {
+		U32 length;
+		memcpy(&length, entry, 4);
+		entries.push_back(std::string(entry + 4, length));
+		entry += 4 + length;
+	}
+	hits++;
+
+	return true;
+}
+
+void EnrichablePersistentCache::Store(
+	U32 kind,
+	U64 frameIndex,
+	const Frame& frame,
+	U32 sampleCount,
+	const std::vector<std::string>& entries
+) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	if((cacheFd < 0 || !writable) && !fingerprinting) {
+		return;
+	}
+
+	size_t recordSize = PERSISTENT_RECORD_HEADER_SIZE;
+	for(const std::string& entry : entries) {
+		recordSize += 4 + entry.length();
+	}
+	recordSize = (recordSize + 7) & ~(size_t)7;
+
+	std::vector<char> record(recordSize, 0);
+	U32 size = recordSize;
+	U32 entryCount = entries.size();
+	memcpy(&record[0], &size, 4);
+	memcpy(&record[4], &kind, 4);
+	memcpy(&record[8], &frameIndex, 8);
+	memcpy(&record[16], &frame.mStartingSampleInclusive, 8);
+	memcpy(&record[24], &frame.mEndingSampleInclusive, 8);
+	memcpy(&record[32], &frame.mData1, 8);
+	memcpy(&record[40], &frame.mData2, 8);
+	record[48] = frame.mType;
+	record[49] = frame.mFlags;
+	memcpy(&record[52], &sampleCount, 4);
+	memcpy(&record[56], &entryCount, 4);
+
+	size_t position = PERSISTENT_RECORD_HEADER_SIZE;
+	for(const std::string& entry : entries) {
+		U32 length = entry.length();
+		memcpy(&record[position], &length, 4);
+		memcpy(&record[position + 4], entry.data(), length);
+		position += 4 + length;
+	}
+
+	if(fingerprinting) {
+		pendingRecords.emplace_back(GetKey(kind, frameIndex), std::move(record));
+		return;
+	}
+	AppendRecord(GetKey(kind, frameIndex), record);
+}
+
+bool EnrichablePersistentCache::AppendRecord(U64 key, const std::vector<char>& record) {
+	// Must be called with the cache lock held.
+	if(cacheFd < 0 || !writable) {
+		return false;
+	}
+
+	if(pwrite(cacheFd, &record[0], record.size(), fileLength) != (ssize_t)record.size()) {
+		std::cerr << "Unable to append to enrichment cache: " << errno;
+		std::cerr << "; no further responses will be stored.\n";
+		if(ftruncate(cacheFd, fileLength) < 0) {
+			// The partial record is discarded when the file is next indexed.
+		}
+		writable = false;
+		return false;
+	}
+
+	index[key] = fileLength;
+	fileLength += record.size();
+	return true;
+}
+
+U64 EnrichablePersistentCache::GetHits() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+	return hits;
+}
+
+U64 EnrichablePersistentCache::GetMisses() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+	return misses;
+}
+
+U64 EnrichablePersistentCache::GetRecordCount() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+	return index.size();
+}
+
+U64 EnrichablePersistentCache::GetKey(U32 kind, U64 frameIndex) {
+	return (frameIndex << 2) | (kind & 3);
+}
+
+void EnrichablePersistentCache::Mix(U64& hash, const void* data, size_t length) {
+	const U8* bytes = (const U8*)data;
+	for(size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+}
+
+U64 EnrichablePersistentCache::GetIdentity(const std::string& command, U32 sampleRate) {
+	// FNV-1a over the command, the sample rate, and the contents of every
+	// word of the command that names a file, so that editing the script
+	// starts a fresh cache.
+	U64 hash = 0xCBF29CE484222325ull;
+
+	Mix(hash, command.c_str(), command.length() + 1);
+	Mix(hash, &sampleRate, sizeof(sampleRate));
+
+	wordexp_t words;
+	if(wordexp(command.c_str(), &words, WRDE_NOCMD) == 0) {
+		for(size_t i = 0; i < words.we_wordc; i++) {
+			struct stat status;
+			if(stat(words.we_wordv[i], &status) < 0 || !S_ISREG(status.st_mode)) {
+				continue;
+			}
+			std::ifstream file(words.we_wordv[i], std::ios::binary);
+			char buffer[4096];
+			while(file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+				Mix(hash, buffer, file.gcount());
+			}
+		}
+		wordfree(&words);
+	}
+
+	return hash;
+}
+
+bool EnrichablePersistentCache::MapFile(U64 length) {
+	// Must be called with the cache lock held.
+	UnmapFile();
+
+	void* mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, cacheFd, 0);
+	if(mapped == MAP_FAILED) {
+		std::cerr << "Unable to map enrichment cache: " << errno << "\n";
+		return false;
+	}
+	mapping = (const char*)mapped;
+	mappingLength = length;
+
+	return true;
+}
+
+void EnrichablePersistentCache::UnmapFile() {
+	if(mapping != NULL) {
+		munmap((void*)mapping, mappingLength);
+		mapping = NULL;
+		mappingLength = 0;
+	}
+}
+
+void EnrichablePersistentCache::IndexRecords() {
+	// Must be called with the cache lock held and the whole file mapped.
+	// Scanning stops at the first record that is incomplete or corrupt,
+	// such as one cut short by a crash; it and anything after it are
+	// dropped.
+	U64 offset = PERSISTENT_CACHE_HEADER_SIZE;
+	while(offset + PERSISTENT_RECORD_HEADER_SIZE <= mappingLength) {
+		const char* record = mapping + offset;
+		U32 recordSize;
+		U32 kind;
+		U64 frameIndex;
+		U32 entryCount;
+		memcpy(&recordSize, record, 4);
+		memcpy(&kind, record + 4, 4);
+		memcpy(&frameIndex, record + 8, 8);
+		memcpy(&entryCount, record + 56, 4);
+
+		if(recordSize < PERSISTENT_RECORD_HEADER_SIZE || recordSize % 8 != 0 ||
+			offset + recordSize > mappingLength) {
+			break;
+		}
+
+		U64 position = PERSISTENT_RECORD_HEADER_SIZE;
+		U32 i;
+		for(i = 0; i < entryCount && position + 4 <= recordSize; i++) {
+			U32 length;
+			memcpy(&length, record + position, 4);
+			if(length > recordSize - position - 4) {
+				break;
+			}
+			position += 4 + length;
+		}
+		if(i != entryCount) {
+			break;
+		}
+
+		index[GetKey(kind, frameIndex)] = offset;
+		offset += recordSize;
+	}
+
+	if(offset < fileLength && writable) {
+		std::cerr << "Discarding " << (fileLength - offset);
+		std::cerr << " bytes of incomplete enrichment cache records.\n";
+		if(ftruncate(cacheFd, offset) == 0) {
+			fileLength = offset;
+		}
+	}
+}
+
+void EnrichablePersistentCache::Compact(const std::string& path) {
+	// Must be called with the cache lock held, the file writable and
+	// indexed.  Every record stored for a frame already in the file
+	// supersedes the one before it, which stays behind; once enough has
+	// built up, the newest records are copied to a fresh file that then
+	// replaces this one.  Anyone still reading the old file keeps it.
+	U64 liveBytes = 0;
+	std::vector<U64> offsets;
+	offsets.reserve(index.size());
+	for(const std::pair<const U64, U64>& entry : index) {
+		U32 recordSize;
+		memcpy(&recordSize, mapping + entry.second, 4);
+		liveBytes += recordSize;
+		offsets.push_back(entry.second);
+	}
+	U64 supersededBytes = fileLength - PERSISTENT_CACHE_HEADER_SIZE - liveBytes;
+	if(supersededBytes < PERSISTENT_COMPACT_MINIMUM_BYTES || supersededBytes * 2 < fileLength) {
+		return;
+	}
+
+	std::string compactedPath = path + ".compact";
+	int compactedFd = open(compactedPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(compactedFd < 0 || flock(compactedFd, LOCK_EX | LOCK_NB) != 0) {
+		if(compactedFd >= 0) {
+			close(compactedFd);
+		}
+		return;
+	}
+
+	// Records keep their order, so a frame's newest record stays last.
+	std::sort(offsets.begin(), offsets.end());
+	std::unordered_map<U64, U64> compactedIndex;
+	U64 compactedLength = PERSISTENT_CACHE_HEADER_SIZE;
+	bool written = pwrite(compactedFd, mapping, PERSISTENT_CACHE_HEADER_SIZE, 0) == PERSISTENT_CACHE_HEADER_SIZE;
+	for(size_t i = 0; written && i < offsets.size(); i++) {
+		const char* record = mapping + offsets[i];
+		U32 recordSize;
+		U32 kind;
+		U64 frameIndex;
+		memcpy(&recordSize, record, 4);
+		memcpy(&kind, record + 4, 4);
+		memcpy(&frameIndex, record + 8, 8);
+		written = pwrite(compactedFd, record, recordSize, compactedLength) == (ssize_t)recordSize;
+		compactedIndex[GetKey(kind, frameIndex)] = compactedLength;
+		compactedLength += recordSize;
+	}
+	if(!written || rename(compactedPath.c_str(), path.c_str()) < 0) {
+		std::cerr << "Unable to compact enrichment cache: " << errno << "\n";
+		close(compactedFd);
+		unlink(compactedPath.c_str());
+		return;
+	}
+
+	std::cerr << "Compacted enrichment cache " << path << ": ";
+	std::cerr << supersededBytes << " bytes of superseded records removed\n";
+
+	UnmapFile();
+	close(cacheFd);
+	cacheFd = compactedFd;
+	fileLength = compactedLength;
+	index.swap(compactedIndex);
+	if(!MapFile(fileLength)) {
+		close(cacheFd);
+		cacheFd = -1;
+		writable = false;
+		index.clear();
+	}
+}
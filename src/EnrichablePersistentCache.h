@@ -0,0 +1,119 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include "AnalyzerResults.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <atomic>
+#include <mutex>
+
+#define PERSISTENT_CACHE_MAGIC "EICACHE1"
+#define PERSISTENT_CACHE_HEADER_SIZE 16
+#define PERSISTENT_RECORD_HEADER_SIZE 64
+
+// Frames of the capture hashed into its file's identity
+#define PERSISTENT_FINGERPRINT_FRAMES 64
+
+// Opening a file rewrites it without its superseded records once they
+// take up at least this many bytes and half of the file.
+#define PERSISTENT_COMPACT_MINIMUM_BYTES 1048576
+
+// Append-only file of enrichment responses that outlives the analyzer,
+// so a capture that is analyzed again with the same script does not
+// need the script at all for anything it has already answered.
+//
+// One file exists per combination of script command, script contents,
+// sample rate and capture, the last told apart by the capture's first
+// PERSISTENT_FINGERPRINT_FRAMES frames: the file is only chosen once
+// they have been decoded, and until then nothing is found and whatever
+// is stored is held back to be written to it.  A capture with fewer
+// frames is not cached.  Records are keyed by request kind and frame
+// index, and each carries the frame it was produced for; a record whose
+// frame no longer matches (different decode settings) is treated as a
+// miss and superseded by the next one stored.
+//
+// File layout: an 8-byte magic followed by the 8-byte identity hash,
+// then records of
+//
+//    0: U32 record size, including this header and padding to 8 bytes
+//    4: U32 request kind
+//    8: U64 frame index
+//   16: S64 starting sample
+//   24: S64 ending sample
+//   32: U64 data1
+//   40: U64 data2
+//   48: U8 type, U8 flags, 2 bytes reserved
+//   52: U32 sample count
+//   56: U32 entry count, 4 bytes reserved
+//   64: entries, each a U32 length followed by that many bytes
+//
+// in host byte order.  The file is memory-mapped for reading; new
+// records are appended with write() and the mapping is extended as
+// lookups reach them.
+class EnrichablePersistentCache {
+	public:
+		EnrichablePersistentCache();
+		virtual ~EnrichablePersistentCache();
+
+		// Starts identifying the capture; the file itself is opened once
+		// AddCaptureFrame has seen enough of it.
+		bool Open(const std::string& directory, const std::string& command, U32 sampleRate);
+		void Close();
+		// True from Open until Close, whether or not the file has been
+		// chosen yet.
+		bool IsOpen();
+		// Given each frame as it is decoded, in order.
+		void AddCaptureFrame(const Frame& frame);
+
+		bool Find(
+			U32 kind,
+			U64 frameIndex,
+			const Frame& frame,
+			U32 sampleCount,
+			std::vector<std::string>& entries
+		);
+		void Store(
+			U32 kind,
+			U64 frameIndex,
+			const Frame& frame,
+			U32 sampleCount,
+			const std::vector<std::string>& entries
+		);
+
+		U64 GetHits();
+		U64 GetMisses();
+		U64 GetRecordCount();
+	protected:
+		static U64 GetKey(U32 kind, U64 frameIndex);
+		static void Mix(U64& hash, const void* data, size_t length);
+		static U64 GetIdentity(const std::string& command, U32 sampleRate);
+		bool OpenFile();
+		bool AppendRecord(U64 key, const std::vector<char>& record);
+		bool MapFile(U64 length);
+		void UnmapFile();
+		void IndexRecords();
+		void Compact(const std::string& path);
+
+		std::string cacheDirectory;
+		// Hash of the script and sample rate, and then of the capture's
+		// frames as they arrive.
+		U64 identity = 0;
+		U32 fingerprintFrames = 0;
+		std::atomic<bool> fingerprinting{false};
+		// Records stored before the file was chosen, with their keys.
+		std::vector<std::pair<U64, std::vector<char>>> pendingRecords;
+
+		int cacheFd = -1;
+		bool writable = false;
+		const char* mapping = NULL;
+		U64 mappingLength = 0;
+		U64 fileLength = 0;
+		U64 hits = 0;
+		U64 misses = 0;
+
+		// Offset of the newest record for each key.
+		std::unordered_map<U64, U64> index;
+		std::mutex cacheLock;
+};
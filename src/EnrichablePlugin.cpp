@@ -0,0 +1,229 @@
+#include "EnrichablePlugin.h"
+
+#include <iostream>
+
+#include <dlfcn.h>
+#include <string.h>
+
+// Replies that fit here are written without allocating.
+#define PLUGIN_BUFFER_SIZE 1024
+
+EnrichablePlugin::EnrichablePlugin():
+	library(NULL),
+	context(NULL),
+	teardown(NULL),
+	feature(NULL),
+	bubble(NULL),
+	tabular(NULL),
+	marker(NULL)
+{
+}
+
+EnrichablePlugin::~EnrichablePlugin()
+{
+	Unload();
+}
+
+bool EnrichablePlugin::IsPluginCommand(const std::string& command) {
+	std::string path = command.substr(0, command.find(' '));
+	const char* suffixes[] = {".so", ".dylib"};
+
+	for(const char* suffix : suffixes) {
+		size_t length = strlen(suffix);
+		if(path.length() > length && path.compare(path.length() - length, length, suffix) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool EnrichablePlugin::Load(const std::string& command) {
+	Unload();
+
+	size_t separator = command.find(' ');
+	std::string path = command.substr(0, separator);
+	std::string arguments = separator == std::string::npos ? "" : command.substr(separator + 1);
+
+	library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if(library == NULL) {
+		std::cerr << "Unable to load enrichment plugin: " << dlerror() << "\n";
+		return false;
+	}
+
+	enrichable_plugin_api_version_fn version =
+		(enrichable_plugin_api_version_fn)dlsym(library, "enrichable_plugin_api_version");
+	if(version == NULL || version() != ENRICHABLE_PLUGIN_API_VERSION) {
+		std::cerr << "Enrichment plugin " << path << " does not implement API version ";
+		std::cerr << ENRICHABLE_PLUGIN_API_VERSION << "\n";
+		Unload();
+		return false;
+	}
+
+	enrichable_plugin_init_fn init = (enrichable_plugin_init_fn)dlsym(library, "enrichable_plugin_init");
+	teardown = (enrichable_plugin_teardown_fn)dlsym(library, "enrichable_plugin_teardown");
+	feature = (enrichable_plugin_feature_fn)dlsym(library, "enrichable_plugin_feature");
+	bubble = (enrichable_plugin_bubble_fn)dlsym(library, "enrichable_plugin_bubble");
+	tabular = (enrichable_plugin_tabular_fn)dlsym(library, "enrichable_plugin_tabular");
+	marker = (enrichable_plugin_marker_fn)dlsym(library, "enrichable_plugin_marker");
+
+	if(init != NULL) {
+		context = init(arguments.c_str());
+		if(context == NULL) {
+			std::cerr << "Enrichment plugin " << path << " failed to initialize\n";
+			teardown = NULL;
+			Unload();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void EnrichablePlugin::Unload() {
+	if(library == NULL) {
+		return;
+	}
+
+	if(teardown != NULL) {
+		teardown(context);
+	}
+	dlclose(library);
+
+	library = NULL;
+	context = NULL;
+	teardown = NULL;
+	feature = NULL;
+	bubble = NULL;
+	tabular = NULL;
+	marker = NULL;
+}
+
+bool EnrichablePlugin::IsLoaded() {
+	return library != NULL;
+}
+
+bool EnrichablePlugin::GetFeatureEnablement(const char* name) {
+	if(feature == NULL) {
+		return true;
+	}
+	if(feature(context, name) == 0) {
+		std::cerr << "message type \"";
+		std::cerr << name;
+		std::cerr << "\" disabled\n";
+		return false;
+	}
+	return true;
+}
+
+bool EnrichablePlugin::HasBubble() {
+	return bubble != NULL;
+}
+
+bool EnrichablePlugin::HasTabular() {
+	return tabular != NULL;
+}
+
+bool EnrichablePlugin::HasMarker() {
+	return marker != NULL;
+}
+
+bool EnrichablePlugin::Bubble(
+	const enrichable_frame& frame,
+	const char* channel,
+	std::vector<std::string>& lines
+) {
+	if(bubble == NULL) {
+		return false;
+	}
+
+	return GetLines(
+		[&](char* buffer, size_t size) { return bubble(context, &frame, channel, buffer, size); },
+		lines
+	);
+}
+
+bool EnrichablePlugin::Tabular(const enrichable_frame& frame, std::vector<std::string>& lines) {
+	if(tabular == NULL) {
+		return false;
+	}
+
+	return GetLines(
+		[&](char* buffer, size_t size) { return tabular(context, &frame, buffer, size); },
+		lines
+	);
+}
+
+size_t EnrichablePlugin::Marker(const enrichable_frame& frame, std::vector<enrichable_marker>& markers) {
+	if(marker == NULL) {
+		return 0;
+	}
+
+	if(markers.size() < 16) {
+		markers.resize(16);
+	}
+
+	long count = marker(context, &frame, markers.data(), markers.size());
+	if(count > (long)markers.size()) {
+		markers.resize(count);
+		count = marker(context, &frame, markers.data(), markers.size());
+	}
+	if(count < 0 || count > (long)markers.size()) {
+		return 0;
+	}
+
+	return count;
+}
+
+void EnrichablePlugin::GetFrame(
+	U64 packetId,
+	U64 frameIndex,
+	const Frame& frame,
+	U32 sampleCount,
+	enrichable_frame& pluginFrame
+) {
+	pluginFrame.packet_id = packetId;
+	pluginFrame.frame_index = frameIndex;
+	pluginFrame.starting_sample = frame.mStartingSampleInclusive;
+	pluginFrame.ending_sample = frame.mEndingSampleInclusive;
+	pluginFrame.type = frame.mType;
+	pluginFrame.flags = frame.mFlags;
+	pluginFrame.data1 = frame.mData1;
+	pluginFrame.data2 = frame.mData2;
+	pluginFrame.sample_count = sampleCount;
+}
+
+template<typename Callback>
+bool EnrichablePlugin::GetLines(Callback callback, std::vector<std::string>& lines) {
+	char buffer[PLUGIN_BUFFER_SIZE];
+
+	lines.clear();
+	long length = callback(buffer, sizeof(buffer));
+	if(length < 0) {
+		return true;
+	}
+	if((size_t)length <= sizeof(buffer)) {
+		SplitLines(buffer, length, lines);
+		return true;
+	}
+
+	std::vector<char> larger(length);
+	long written = callback(larger.data(), larger.size());
+	if(written >= 0 && (size_t)written <= larger.size()) {
+		SplitLines(larger.data(), written, lines);
+	}
+
+	return true;
+}
+
+void EnrichablePlugin::SplitLines(const char* buffer, size_t length, std::vector<std::string>& lines) {
+	// Lines as the text protocol would deliver them, without the empty
+	// line that ends the reply.
+	size_t start = 0;
+	while(start < length) {
+		const char* end = (const char*)memchr(buffer + start, '\n', length - start);
+		size_t lineLength = end == NULL ? length - start : end - (buffer + start);
+		lines.emplace_back(buffer + start, lineLength);
+		start += lineLength + 1;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "AnalyzerResults.h"
+#include "EnrichablePluginApi.h"
+#include <string>
+#include <vector>
+
+// An in-process enrichment plugin: a shared library exporting the C
+// interface in EnrichablePluginApi.h, called directly instead of
+// exchanging messages with a script.
+class EnrichablePlugin {
+	public:
+		EnrichablePlugin();
+		virtual ~EnrichablePlugin();
+
+		// Whether a parser command names a plugin rather than a script:
+		// its first word is a path ending in a shared library suffix.
+		static bool IsPluginCommand(const std::string& command);
+
+		bool Load(const std::string& command);
+		void Unload();
+		bool IsLoaded();
+
+		// Enablement of a message type, as the script's answer to the
+		// corresponding feature message would give it.
+		bool GetFeatureEnablement(const char* feature);
+
+		bool HasBubble();
+		bool HasTabular();
+		bool HasMarker();
+
+		bool Bubble(const enrichable_frame& frame, const char* channel, std::vector<std::string>& lines);
+		bool Tabular(const enrichable_frame& frame, std::vector<std::string>& lines);
+		// Grows markers to hold the reply; returns the number of markers.
+		size_t Marker(const enrichable_frame& frame, std::vector<enrichable_marker>& markers);
+
+		static void GetFrame(
+			U64 packetId,
+			U64 frameIndex,
+			const Frame& frame,
+			U32 sampleCount,
+			enrichable_frame& pluginFrame
+		);
+	protected:
+		static void SplitLines(const char* buffer, size_t length, std::vector<std::string>& lines);
+		template<typename Callback>
+		bool GetLines(Callback callback, std::vector<std::string>& lines);
+
+		void* library;
+		void* context;
+
+		enrichable_plugin_teardown_fn teardown;
+		enrichable_plugin_feature_fn feature;
+		enrichable_plugin_bubble_fn bubble;
+		enrichable_plugin_tabular_fn tabular;
+		enrichable_plugin_marker_fn marker;
+};
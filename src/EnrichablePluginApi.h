@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+ * The C interface exported by in-process enrichment plugins; include
+ * this header when building one.  A plugin is a shared library given as
+ * the "Enrichment Script" in place of a command.
+ *
+ * Every function is looked up by name with dlsym.  A plugin exports
+ * enrichable_plugin_api_version, returning the ENRICHABLE_PLUGIN_API_VERSION
+ * it was built against, and whichever of the others it implements;
+ * messages without a callback are disabled.  Callbacks may be called
+ * from the decoding and display threads at the same time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENRICHABLE_PLUGIN_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A frame, with the fields a script would receive for it. */
+typedef struct {
+	uint64_t packet_id;
+	uint64_t frame_index;
+	int64_t starting_sample;
+	int64_t ending_sample;
+	uint8_t type;
+	uint8_t flags;
+	uint64_t data1;
+	uint64_t data2;
+	/* Marker requests only; otherwise 0. */
+	uint32_t sample_count;
+} enrichable_frame;
+
+/* marker_type is numbered as in the binary protocol, from 0 for "Dot". */
+typedef struct {
+	uint8_t sample_number;
+	uint8_t marker_type;
+	char channel[16];
+} enrichable_marker;
+
+typedef int (*enrichable_plugin_api_version_fn)(void);
+
+/* Optional.  arguments is whatever followed the library path in the
+ * setting.  The returned context is passed to every other call; NULL
+ * fails the load. */
+typedef void* (*enrichable_plugin_init_fn)(const char* arguments);
+typedef void (*enrichable_plugin_teardown_fn)(void* context);
+
+/* Asked for "bubble", "marker" and "tabular": return 1 to enable the
+ * message, 0 to disable it, or -1 for the default. */
+typedef int (*enrichable_plugin_feature_fn)(void* context, const char* feature);
+
+/* Write the lines to display, separated by newlines, into buffer and
+ * return their length.  If they do not fit, return the length needed
+ * and the call is repeated with a buffer at least that large.  A
+ * negative return is treated as an empty response. */
+typedef long (*enrichable_plugin_bubble_fn)(
+	void* context,
+	const enrichable_frame* frame,
+	const char* channel,
+	char* buffer,
+	size_t buffer_size
+);
+typedef long (*enrichable_plugin_tabular_fn)(
+	void* context,
+	const enrichable_frame* frame,
+	char* buffer,
+	size_t buffer_size
+);
+
+/* Fill markers and return how many there are; as above, a return larger
+ * than capacity repeats the call with room for that many. */
+typedef long (*enrichable_plugin_marker_fn)(
+	void* context,
+	const enrichable_frame* frame,
+	enrichable_marker* markers,
+	size_t capacity
+);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+#include "EnrichablePrefetchWindow.h"
+
+// Frames beyond the requested one fetched when the window is at its smallest
+#define MINIMUM_PREFETCH 4
+
+EnrichablePrefetchWindow::EnrichablePrefetchWindow(U32 _maximumSize):
+	maximumSize(_maximumSize),
+	size(_maximumSize < MINIMUM_PREFETCH ? _maximumSize : MINIMUM_PREFETCH)
+{
+}
+
+EnrichablePrefetchWindow::~EnrichablePrefetchWindow()
+{
+}
+
+void EnrichablePrefetchWindow::SetMaximumSize(U32 _maximumSize) {
+	maximumSize = _maximumSize;
+	if(size > maximumSize) {
+		size = maximumSize;
+	}
+}
+
+U32 EnrichablePrefetchWindow::GetSize() {
+	return size;
+}
+
+void EnrichablePrefetchWindow::RecordHit(U64 frameIndex, bool prefetched) {
+	if(hasLastAccess && frameIndex != lastAccess) {
+		backwards = frameIndex < lastAccess;
+	}
+	hasLastAccess = true;
+	lastAccess = frameIndex;
+
+	if(prefetched) {
+		used++;
+	}
+}
+
+void EnrichablePrefetchWindow::RecordMiss(U64 frameIndex) {
+	if(hasLastAccess) {
+		U64 distance = frameIndex > lastAccess ? frameIndex - lastAccess : lastAccess - frameIndex;
+		if(distance > (U64)size * 2 + 1) {
+			// A jump rather than a scroll; whatever we were prefetching
+			// is no longer relevant.
+			size = maximumSize < MINIMUM_PREFETCH ? maximumSize : MINIMUM_PREFETCH;
+			issued = 0;
+			used = 0;
+		}
+		if(frameIndex != lastAccess) {
+			backwards = frameIndex < lastAccess;
+		}
+	}
+	hasLastAccess = true;
+	lastAccess = frameIndex;
+
+	Adapt();
+}
+
+void EnrichablePrefetchWindow::RecordPrefetched(U32 count) {
+	issued += count;
+}
+
+void EnrichablePrefetchWindow::GetRange(U64 frameIndex, U64 frameCount, U64& first, U64& last) {
+	if(backwards) {
+		first = frameIndex > size ? frameIndex - size : 0;
+		last = frameIndex;
+	} else {
+		first = frameIndex;
+		last = frameIndex + size;
+	}
+	if(frameCount == 0) {
+		last = first;
+	} else if(last >= frameCount) {
+		last = frameCount - 1;
+	}
+}
+
+void EnrichablePrefetchWindow::Adapt() {
+	if(issued == 0) {
+		return;
+	}
+
+	// Most of what we fetched was shown: fetch further ahead next time.
+	// Most of it was wasted: fetch less.
+	if(used * 4 >= issued * 3) {
+		size = size * 2 > maximumSize ? maximumSize : size * 2;
+	} else if(used * 4 < issued) {
+		size = size / 2 < MINIMUM_PREFETCH ? MINIMUM_PREFETCH : size / 2;
+		if(size > maximumSize) {
+			size = maximumSize;
+		}
+	}
+	issued = 0;
+	used = 0;
+}
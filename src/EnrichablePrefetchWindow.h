@@ -0,0 +1,34 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+
+// Decides which frames to fetch alongside a frame the UI asked for.
+// The window follows the direction the user is scrolling in, grows
+// while prefetched frames are being used and shrinks when they are
+// not (or when the user jumps somewhere else entirely).
+class EnrichablePrefetchWindow {
+	public:
+		EnrichablePrefetchWindow(U32 maximumSize);
+		virtual ~EnrichablePrefetchWindow();
+
+		void SetMaximumSize(U32 maximumSize);
+		U32 GetSize();
+
+		void RecordHit(U64 frameIndex, bool prefetched);
+		void RecordMiss(U64 frameIndex);
+		void RecordPrefetched(U32 count);
+		void GetRange(U64 frameIndex, U64 frameCount, U64& first, U64& last);
+	protected:
+		void Adapt();
+
+		U32 maximumSize;
+		U32 size;
+
+		bool hasLastAccess = false;
+		U64 lastAccess = 0;
+		bool backwards = false;
+
+		// Prefetched frames issued and used since the window last adapted.
+		U32 issued = 0;
+		U32 used = 0;
+};
@@ -0,0 +1,523 @@
+#include "EnrichableRegisterMap.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <string.h>
+#include <stdlib.h>
+
+EnrichableRegisterMap::EnrichableRegisterMap():
+	loaded(false),
+	currentDevice(NULL),
+	currentRegister(NULL),
+	currentField(NULL),
+	currentValue(false),
+	currentValueNumber(0)
+{
+	for(S16& index : deviceIndex) {
+		index = -1;
+	}
+}
+
+EnrichableRegisterMap::~EnrichableRegisterMap()
+{
+}
+
+bool EnrichableRegisterMap::Load(const std::string& path) {
+	std::ifstream file(path.c_str());
+	if(!file) {
+		std::cerr << "Unable to open register map " << path << "\n";
+		return false;
+	}
+
+	std::string line;
+	std::string error;
+	U32 lineNumber = 0;
+	while(std::getline(file, line)) {
+		lineNumber++;
+		if(!ParseLine(line, error)) {
+			std::cerr << "Register map " << path << ":" << lineNumber << ": ";
+			std::cerr << error << "\n";
+			devices.clear();
+			return false;
+		}
+	}
+
+	Compile();
+	loaded = true;
+
+	U32 registerCount = 0;
+	for(const Device& device : devices) {
+		registerCount += device.registers.size();
+	}
+	std::cerr << "Loaded register map " << path << ": ";
+	std::cerr << devices.size() << " devices, " << registerCount << " registers\n";
+	return true;
+}
+
+bool EnrichableRegisterMap::IsLoaded() const {
+	return loaded;
+}
+
+bool EnrichableRegisterMap::HasDevice(U8 address) const {
+	return address < 128 && deviceIndex[address] >= 0;
+}
+
+U32 EnrichableRegisterMap::GetContext(U32 kind, U8 address, U8 registerAddress) {
+	return (kind << 16) | ((U32)address << 8) | registerAddress;
+}
+
+const std::vector<std::string>* EnrichableRegisterMap::GetText(U32 context, const Frame& frame) const {
+	U32 kind = context >> 16;
+	U8 address = (U8)(context >> 8) & 0x7F;
+	U8 registerAddress = (U8)context;
+	if(kind == 0 || !HasDevice(address)) {
+		return NULL;
+	}
+
+	const Device& device = devices[deviceIndex[address]];
+	if(kind == REGISTER_MAP_CONTEXT_ADDRESS) {
+		return (frame.mData1 & 0x1) != 0 ? &device.readText : &device.writeText;
+	}
+
+	S16 index = device.registerIndex[registerAddress];
+	if(index < 0) {
+		return NULL;
+	}
+	const Register& compiled = device.registers[index];
+	if(kind == REGISTER_MAP_CONTEXT_POINTER) {
+		return &compiled.pointerText;
+	}
+	if(kind == REGISTER_MAP_CONTEXT_REGISTER) {
+		return &compiled.valueText[frame.mData1 & 0xFF];
+	}
+	return NULL;
+}
+
+const std::vector<EnrichableRegisterMapMarker>* EnrichableRegisterMap::GetMarkers(U8 address, U8 registerAddress, U8 value) const {
+	if(!HasDevice(address)) {
+		return NULL;
+	}
+
+	const Device& device = devices[deviceIndex[address]];
+	S16 index = device.registerIndex[registerAddress];
+	if(index < 0 || device.registers[index].valueMarkers[value].empty()) {
+		return NULL;
+	}
+	return &device.registers[index].valueMarkers[value];
+}
+
+bool EnrichableRegisterMap::ParseLine(const std::string& line, std::string& error) {
+	std::string content = line.substr(0, line.find('#'));
+	std::istringstream stream(content);
+	std::vector<std::string> words;
+	std::string word;
+	while(stream >> word) {
+		words.push_back(word);
+	}
+	if(words.empty()) {
+		return true;
+	}
+
+	const std::string& keyword = words[0];
+	U32 number;
+	if(keyword == "device") {
+		if(words.size() != 3 || !ParseNumber(words[1], 127, number)) {
+			error = "expected: device <7-bit address> <name>";
+			return false;
+		}
+		if(deviceIndex[number] >= 0) {
+			error = "device " + words[1] + " is already described";
+			return false;
+		}
+		deviceIndex[number] = devices.size();
+		devices.push_back(Device());
+		currentDevice = &devices.back();
+		currentDevice->name = words[2];
+		for(S16& index : currentDevice->registerIndex) {
+			index = -1;
+		}
+		currentRegister = NULL;
+		currentField = NULL;
+		currentValue = false;
+	} else if(keyword == "register") {
+		if(words.size() < 3 || words.size() > 4 || !ParseNumber(words[1], 255, number)) {
+			error = "expected: register <address> <name> [format]";
+			return false;
+		}
+		if(currentDevice == NULL) {
+			error = "register before any device";
+			return false;
+		}
+		if(currentDevice->registerIndex[number] >= 0) {
+			error = "register " + words[1] + " is already described";
+			return false;
+		}
+		if(words.size() == 4 && !IsValidFormat(words[3])) {
+			error = "unsupported format " + words[3];
+			return false;
+		}
+		currentDevice->registerIndex[number] = currentDevice->registers.size();
+		currentDevice->registers.push_back(Register());
+		currentRegister = &currentDevice->registers.back();
+		currentRegister->address = (U8)number;
+		currentRegister->name = words[2];
+		currentRegister->format = words.size() == 4 ? words[3] : "";
+		currentField = NULL;
+		currentValue = false;
+	} else if(keyword == "field") {
+		if(words.size() < 3 || words.size() > 4) {
+			error = "expected: field <bit|high:low> <name> [format]";
+			return false;
+		}
+		if(currentRegister == NULL) {
+			error = "field before any register";
+			return false;
+		}
+
+		U32 high;
+		U32 low;
+		size_t colon = words[1].find(':');
+		if(colon == std::string::npos) {
+			if(!ParseNumber(words[1], 7, high)) {
+				error = "bit must be from 0 to 7";
+				return false;
+			}
+			low = high;
+		} else if(!ParseNumber(words[1].substr(0, colon), 7, high) ||
+			!ParseNumber(words[1].substr(colon + 1), 7, low) || low > high) {
+			error = "bits must be high:low, from 7 to 0";
+			return false;
+		}
+		if(words.size() == 4 && !IsValidFormat(words[3])) {
+			error = "unsupported format " + words[3];
+			return false;
+		}
+		currentRegister->fields.push_back(Field());
+		currentField = &currentRegister->fields.back();
+		currentField->name = words[2];
+		currentField->high = high;
+		currentField->low = low;
+		currentField->format = words.size() == 4 ? words[3] : "";
+		currentValue = false;
+	} else if(keyword == "value") {
+		if(words.size() < 3 || !ParseNumber(words[1], 255, number)) {
+			error = "expected: value <number> <name>";
+			return false;
+		}
+		if(currentRegister == NULL) {
+			error = "value before any register";
+			return false;
+		}
+
+		// Names may contain spaces; they run to the end of the line.
+		std::string name = words[2];
+		for(size_t i = 3; i < words.size(); i++) {
+			name += " " + words[i];
+		}
+		std::map<U32, std::string>& values = currentField != NULL ? currentField->values : currentRegister->values;
+		values[number] = name;
+		currentValue = true;
+		currentValueNumber = number;
+	} else if(keyword == "marker") {
+		AnalyzerResults::MarkerType markerType;
+		if(words.size() != 2 || !ParseMarkerType(words[1], markerType)) {
+			error = "expected: marker <Dot|ErrorDot|Square|ErrorSquare|UpArrow|DownArrow|X|ErrorX|Start|Stop|One|Zero>";
+			return false;
+		}
+		if(currentRegister == NULL) {
+			error = "marker before any register";
+			return false;
+		}
+
+		MarkerRule rule;
+		rule.anyValue = !currentValue;
+		rule.value = currentValueNumber;
+		rule.markerType = markerType;
+		(currentField != NULL ? currentField->markers : currentRegister->markers).push_back(rule);
+	} else {
+		error = "unknown keyword " + keyword;
+		return false;
+	}
+
+	return true;
+}
+
+void EnrichableRegisterMap::Compile() {
+	for(Device& device : devices) {
+		device.readText.clear();
+		device.readText.push_back("R");
+		device.readText.push_back("R[" + device.name + "]");
+		device.readText.push_back("Read " + device.name);
+		device.writeText.clear();
+		device.writeText.push_back("W");
+		device.writeText.push_back("W[" + device.name + "]");
+		device.writeText.push_back("Write " + device.name);
+
+		for(Register& compiled : device.registers) {
+			CompileRegister(compiled);
+		}
+	}
+
+	currentDevice = NULL;
+	currentRegister = NULL;
+	currentField = NULL;
+}
+
+void EnrichableRegisterMap::CompileRegister(Register& compiled) {
+	compiled.pointerText.clear();
+	compiled.pointerText.push_back("@");
+	compiled.pointerText.push_back("@" + compiled.name);
+	compiled.pointerText.push_back("Register " + compiled.name);
+
+	for(U32 value = 0; value < 256; value++) {
+		std::vector<std::string>& text = compiled.valueText[value];
+		std::vector<EnrichableRegisterMapMarker>& markers = compiled.valueMarkers[value];
+		text.clear();
+		markers.clear();
+
+		std::map<U32, std::string>::const_iterator name = compiled.values.find(value);
+		std::string raw = name != compiled.values.end() ?
+			name->second :
+			Format(compiled.format.empty() ? "0x%02X" : compiled.format, value, 8);
+		text.push_back(compiled.name);
+		text.push_back(compiled.name + "=" + raw);
+		AddMarkers(compiled.markers, value, 0, markers);
+
+		std::string decoded;
+		for(const Field& field : compiled.fields) {
+			U32 width = field.high - field.low + 1;
+			U32 fieldValue = (value >> field.low) & ((1u << width) - 1);
+			AddMarkers(field.markers, fieldValue, 7 - field.high, markers);
+
+			// Single-bit flags without a name or format for their value
+			// are listed only when set.
+			std::string fieldText;
+			name = field.values.find(fieldValue);
+			if(name != field.values.end()) {
+				fieldText = field.name + "=" + name->second;
+			} else if(!field.format.empty()) {
+				fieldText = field.name + "=" + Format(field.format, fieldValue, width);
+			} else if(width == 1) {
+				fieldText = fieldValue != 0 ? field.name : "";
+			} else {
+				fieldText = field.name + "=" + Format("%u", fieldValue, width);
+			}
+
+			if(!fieldText.empty()) {
+				decoded += decoded.empty() ? "" : " ";
+				decoded += fieldText;
+			}
+		}
+		if(!decoded.empty()) {
+			text.push_back(compiled.name + ": " + decoded);
+		}
+	}
+}
+
+void EnrichableRegisterMap::AddMarkers(const std::vector<MarkerRule>& rules, U32 value, U8 arrow, std::vector<EnrichableRegisterMapMarker>& markers) {
+	for(const MarkerRule& rule : rules) {
+		if(rule.anyValue ? value != 0 : value == rule.value) {
+			EnrichableRegisterMapMarker marker;
+			marker.arrow = arrow;
+			marker.markerType = rule.markerType;
+			markers.push_back(marker);
+		}
+	}
+}
+
+bool EnrichableRegisterMap::ParseNumber(const std::string& text, U32 maximum, U32& value) {
+	if(text.empty()) {
+		return false;
+	}
+
+	char* end;
+	unsigned long parsed = strtoul(text.c_str(), &end, 0);
+	if(*end != '\0' || parsed > maximum) {
+		return false;
+	}
+	value = (U32)parsed;
+	return true;
+}
+
+bool EnrichableRegisterMap::ParseMarkerType(const std::string& text, AnalyzerResults::MarkerType& markerType) {
+	static const struct {
+		const char* name;
+		AnalyzerResults::MarkerType markerType;
+	} markerTypes[] = {
+		{"Dot", AnalyzerResults::Dot},
+		{"ErrorDot", AnalyzerResults::ErrorDot},
+		{"Square", AnalyzerResults::Square},
+		{"ErrorSquare", AnalyzerResults::ErrorSquare},
+		{"UpArrow", AnalyzerResults::UpArrow},
+		{"DownArrow", AnalyzerResults::DownArrow},
+		{"X", AnalyzerResults::X},
+		{"ErrorX", AnalyzerResults::ErrorX},
+		{"Start", AnalyzerResults::Start},
+		{"Stop", AnalyzerResults::Stop},
+		{"One", AnalyzerResults::One},
+		{"Zero", AnalyzerResults::Zero},
+	};
+
+	for(const auto& candidate : markerTypes) {
+		if(text == candidate.name) {
+			markerType = candidate.markerType;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EnrichableRegisterMap::IsValidFormat(const std::string& format) {
+	for(size_t i = 0; i < format.length(); i++) {
+		if(format[i] != '%') {
+			continue;
+		}
+		i++;
+		while(i < format.length() && format[i] >= '0' && format[i] <= '9') {
+			i++;
+		}
+		if(i == format.length() || strchr("duxXb%", format[i]) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string EnrichableRegisterMap::Format(const std::string& format, U32 value, U32 bits) {
+	std::string result;
+	for(size_t i = 0; i < format.length(); i++) {
+		if(format[i] != '%') {
+			result += format[i];
+			continue;
+		}
+
+		i++;
+		bool zeroPad = i < format.length() && format[i] == '0';
+		U32 width = 0;
+		while(i < format.length() && format[i] >= '0' && format[i] <= '9') {
+			width = width * 10 + (format[i] - '0');
+			i++;
+		}
+		if(i == format.length()) {
+			break;
+		}
+
+		char conversion = format[i];
+		if(conversion == '%') {
+			result += '%';
+			continue;
+		}
+
+		bool negative = false;
+		U32 magnitude = value;
+		if(conversion == 'd' && bits > 0 && (value >> (bits - 1)) & 1) {
+			negative = true;
+			magnitude = (1u << bits) - value;
+		}
+
+		U32 base = conversion == 'x' || conversion == 'X' ? 16 : conversion == 'b' ? 2 : 10;
+		const char* digits = conversion == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+		std::string number;
+		do {
+			number.insert(number.begin(), digits[magnitude % base]);
+			magnitude /= base;
+		} while(magnitude != 0);
+
+		// Zeros go between the sign and the digits, spaces before both.
+		size_t length = number.length() + (negative ? 1 : 0);
+		if(length < width && zeroPad) {
+			number.insert(0, width - length, '0');
+		}
+		if(negative) {
+			number.insert(number.begin(), '-');
+		}
+		if(number.length() < width) {
+			number.insert(0, width - number.length(), ' ');
+		}
+		result += number;
+	}
+	return result;
+}
+
+EnrichableRegisterPointers::EnrichableRegisterPointers() {
+	Clear();
+}
+
+EnrichableRegisterPointers::~EnrichableRegisterPointers() {
+}
+
+void EnrichableRegisterPointers::Clear() {
+	for(S16& pointer : pointers) {
+		pointer = -1;
+	}
+	read = false;
+	byteCount = 0;
+}
+
+U32 EnrichableRegisterPointers::GetContext(const EnrichableRegisterMap& map, U8 address, bool isAddress, const Frame& frame) {
+	if(isAddress) {
+		read = (frame.mData1 & 0x1) != 0;
+		byteCount = 0;
+		if(map.HasDevice(address)) {
+			return EnrichableRegisterMap::GetContext(REGISTER_MAP_CONTEXT_ADDRESS, address, 0);
+		}
+		return 0;
+	}
+
+	if(!map.HasDevice(address)) {
+		return 0;
+	}
+
+	// The first byte written after the address sets the pointer; every
+	// byte read or written after that moves it on.
+	S16& pointer = pointers[address];
+	if(!read && byteCount++ == 0) {
+		pointer = S16(frame.mData1 & 0xFF);
+		return EnrichableRegisterMap::GetContext(REGISTER_MAP_CONTEXT_POINTER, address, U8(pointer));
+	}
+
+	if(pointer < 0) {
+		return 0;
+	}
+	U32 context = EnrichableRegisterMap::GetContext(REGISTER_MAP_CONTEXT_REGISTER, address, U8(pointer));
+	pointer = (pointer + 1) & 0xFF;
+	return context;
+}
+
+EnrichableRegisterContexts::EnrichableRegisterContexts() {
+}
+
+EnrichableRegisterContexts::~EnrichableRegisterContexts() {
+}
+
+void EnrichableRegisterContexts::Clear() {
+	std::lock_guard<std::mutex> guard(lock);
+	contexts.clear();
+}
+
+void EnrichableRegisterContexts::Add(U64 frameIndex, U32 context) {
+	std::lock_guard<std::mutex> guard(lock);
+	FrameContext frameContext;
+	frameContext.frameIndex = frameIndex;
+	frameContext.context = context;
+	contexts.push_back(frameContext);
+}
+
+U32 EnrichableRegisterContexts::Get(U64 frameIndex) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<FrameContext>::iterator found = std::lower_bound(
+		contexts.begin(),
+		contexts.end(),
+		frameIndex,
+		[](const FrameContext& frameContext, U64 index) {
+			return frameContext.frameIndex < index;
+		}
+	);
+	if(found == contexts.end() || found->frameIndex != frameIndex) {
+		return 0;
+	}
+	return found->context;
+}
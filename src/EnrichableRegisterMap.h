@@ -0,0 +1,153 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include "AnalyzerResults.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+// What the decoder knows about a frame of a device in the register map,
+// as a context: the kind in bits 16 and up, the 7-bit address in bits
+// 15-8 and the register in bits 7-0.  Contexts are kept beside the
+// frames rather than in them, so scripts and caches see frames as
+// decoded.
+#define REGISTER_MAP_CONTEXT_ADDRESS 1
+#define REGISTER_MAP_CONTEXT_POINTER 2
+#define REGISTER_MAP_CONTEXT_REGISTER 3
+
+// A marker to place on one of a data byte's bit arrows, counted from the
+// most significant bit.
+struct EnrichableRegisterMapMarker {
+	U8 arrow;
+	AnalyzerResults::MarkerType markerType;
+};
+
+// Decodes register accesses from a description of the devices on the bus
+// in place of an enrichment script.  The description is compiled when it
+// is loaded into the text and markers of every value of every register,
+// so decoding and display only index tables.  A loaded map is never
+// changed, and may be read from any thread.
+class EnrichableRegisterMap {
+	public:
+		EnrichableRegisterMap();
+		virtual ~EnrichableRegisterMap();
+
+		// Reports any error in the file, with its line, to stderr.
+		bool Load(const std::string& path);
+		bool IsLoaded() const;
+
+		bool HasDevice(U8 address) const;
+		static U32 GetContext(U32 kind, U8 address, U8 registerAddress);
+
+		// Display text for a frame with the given context, shortest first;
+		// NULL if the map does not describe the frame.
+		const std::vector<std::string>* GetText(U32 context, const Frame& frame) const;
+		// Markers for a value written to or read from a register; NULL if
+		// there are none.
+		const std::vector<EnrichableRegisterMapMarker>* GetMarkers(U8 address, U8 registerAddress, U8 value) const;
+	protected:
+		struct MarkerRule {
+			bool anyValue;
+			U32 value;
+			AnalyzerResults::MarkerType markerType;
+		};
+		struct Field {
+			std::string name;
+			U32 low;
+			U32 high;
+			std::string format;
+			std::map<U32, std::string> values;
+			std::vector<MarkerRule> markers;
+		};
+		struct Register {
+			U8 address;
+			std::string name;
+			std::string format;
+			std::map<U32, std::string> values;
+			std::vector<MarkerRule> markers;
+			std::vector<Field> fields;
+
+			// Compiled
+			std::vector<std::string> pointerText;
+			std::vector<std::string> valueText[256];
+			std::vector<EnrichableRegisterMapMarker> valueMarkers[256];
+		};
+		struct Device {
+			std::string name;
+			std::vector<Register> registers;
+
+			// Compiled
+			S16 registerIndex[256];
+			std::vector<std::string> readText;
+			std::vector<std::string> writeText;
+		};
+
+		bool ParseLine(const std::string& line, std::string& error);
+		void Compile();
+		void CompileRegister(Register& compiled);
+		void AddMarkers(const std::vector<MarkerRule>& rules, U32 value, U8 arrow, std::vector<EnrichableRegisterMapMarker>& markers);
+
+		static bool ParseNumber(const std::string& text, U32 maximum, U32& value);
+		static bool ParseMarkerType(const std::string& text, AnalyzerResults::MarkerType& markerType);
+		static bool IsValidFormat(const std::string& format);
+		// Formats a value as printf would, supporting only flags-free %d,
+		// %u, %x, %X and %b with an optional zero-padded width, and %%.
+		// %d treats the value as two's complement of the given bit width.
+		static std::string Format(const std::string& format, U32 value, U32 bits);
+
+		bool loaded;
+		std::vector<Device> devices;
+		S16 deviceIndex[128];
+
+		// Parser state: the device, register and field being described,
+		// and where the next marker line applies.
+		Device* currentDevice;
+		Register* currentRegister;
+		Field* currentField;
+		bool currentValue;
+		U32 currentValueNumber;
+};
+
+// Follows each mapped device's register pointer through a capture as the
+// device itself would, so that every frame's register is known without
+// looking back through the capture.
+class EnrichableRegisterPointers {
+	public:
+		EnrichableRegisterPointers();
+		virtual ~EnrichableRegisterPointers();
+
+		void Clear();
+		// Returns the context of a frame sent to the given 7-bit address,
+		// or 0 if the map does not describe the device; isAddress is set
+		// for the address byte that begins each transfer.  Called for
+		// every frame, in order.
+		U32 GetContext(const EnrichableRegisterMap& map, U8 address, bool isAddress, const Frame& frame);
+	protected:
+		// Each device's register pointer, or -1 until it is written
+		S16 pointers[128];
+		bool read;
+		U32 byteCount;
+};
+
+// The contexts of a capture's mapped frames, by frame index.  The
+// analysis thread adds them in order while the display reads them, so
+// the list is kept under a lock.
+class EnrichableRegisterContexts {
+	public:
+		EnrichableRegisterContexts();
+		virtual ~EnrichableRegisterContexts();
+
+		void Clear();
+		void Add(U64 frameIndex, U32 context);
+		// 0 for a frame the map does not describe.
+		U32 Get(U64 frameIndex);
+	protected:
+		struct FrameContext {
+			U64 frameIndex;
+			U32 context;
+		};
+
+		std::mutex lock;
+		std::vector<FrameContext> contexts;
+};
@@ -0,0 +1,102 @@
+#include "EnrichableRequestEncoder.h"
+#include "EnrichableAnalyzerSubprocess.h"
+
+#include <string.h>
+
+EnrichableRequestEncoder::EnrichableRequestEncoder():
+	length(0)
+{
+}
+
+EnrichableRequestEncoder::~EnrichableRequestEncoder()
+{
+}
+
+void EnrichableRequestEncoder::Clear() {
+	length = 0;
+}
+
+void EnrichableRequestEncoder::AppendText(const char* text) {
+	AppendText(text, strlen(text));
+}
+
+void EnrichableRequestEncoder::AppendText(const char* text, size_t textLength) {
+	if(textLength > sizeof(buffer) - length) {
+		textLength = sizeof(buffer) - length;
+	}
+	memcpy(buffer + length, text, textLength);
+	length += textLength;
+}
+
+void EnrichableRequestEncoder::AppendCharacter(char character) {
+	if(length < sizeof(buffer)) {
+		buffer[length++] = character;
+	}
+}
+
+void EnrichableRequestEncoder::AppendHex(U64 value) {
+	static const char digits[] = "0123456789abcdef";
+	char reversed[16];
+	size_t count = 0;
+
+	do {
+		reversed[count++] = digits[value & 0xF];
+		value >>= 4;
+	} while(value != 0);
+
+	while(count > 0) {
+		AppendCharacter(reversed[--count]);
+	}
+}
+
+void EnrichableRequestEncoder::AppendBinaryRecord(
+	U32 messageType,
+	U64 packetId,
+	U64 frameIndex,
+	const Frame& frame,
+	U32 sampleCount
+) {
+	if(sizeof(buffer) - length < BINARY_RECORD_SIZE) {
+		return;
+	}
+
+	U8* record = (U8*)buffer + length;
+	memset(record, 0, BINARY_RECORD_SIZE);
+	EncodeU32(&record[0], messageType);
+	EncodeU32(&record[4], sampleCount);
+	EncodeU64(&record[8], packetId);
+	EncodeU64(&record[16], frameIndex);
+	EncodeU64(&record[24], frame.mStartingSampleInclusive);
+	EncodeU64(&record[32], frame.mEndingSampleInclusive);
+	record[40] = frame.mType;
+	record[41] = frame.mFlags;
+	EncodeU64(&record[48], frame.mData1);
+	EncodeU64(&record[56], frame.mData2);
+	length += BINARY_RECORD_SIZE;
+}
+
+void EnrichableRequestEncoder::SetU32(size_t offset, U32 value) {
+	if(offset + 4 <= length) {
+		EncodeU32((U8*)buffer + offset, value);
+	}
+}
+
+const char* EnrichableRequestEncoder::GetData() {
+	return buffer;
+}
+
+size_t EnrichableRequestEncoder::GetLength() {
+	return length;
+}
+
+void EnrichableRequestEncoder::EncodeU32(U8* buffer, U32 value) {
+	for(unsigned i = 0; i < 4; i++) {
+		buffer[i] = (U8)(value >> (8 * i));
+	}
+}
+
+void EnrichableRequestEncoder::EncodeU64(U8* buffer, U64 value) {
+	for(unsigned i = 0; i < 8; i++) {
+		buffer[i] = (U8)(value >> (8 * i));
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include "AnalyzerResults.h"
+
+// Longest request we format: a prefix, nine fields of up to sixteen hex
+// digits, a channel name and their separators, with room to spare.
+#define REQUEST_BUFFER_SIZE 256
+
+// Formats a single request into a fixed buffer, so that sending one
+// costs no allocation.  Text that would overflow the buffer is dropped;
+// only the analyzer's own short channel names are ever appended as text.
+class EnrichableRequestEncoder {
+	public:
+		EnrichableRequestEncoder();
+		virtual ~EnrichableRequestEncoder();
+
+		void Clear();
+		void AppendText(const char* text);
+		void AppendText(const char* text, size_t textLength);
+		void AppendCharacter(char character);
+		// Lower-case hexadecimal without leading zeros, as std::hex
+		// formats an unsigned value.
+		void AppendHex(U64 value);
+		// The binary protocol's fixed-size request record.
+		void AppendBinaryRecord(
+			U32 messageType,
+			U64 packetId,
+			U64 frameIndex,
+			const Frame& frame,
+			U32 sampleCount
+		);
+		// Overwrites four bytes already appended, little-endian; used to
+		// tag a binary record.
+		void SetU32(size_t offset, U32 value);
+
+		const char* GetData();
+		size_t GetLength();
+	protected:
+		static void EncodeU32(U8* buffer, U32 value);
+		static void EncodeU64(U8* buffer, U64 value);
+
+		char buffer[REQUEST_BUFFER_SIZE];
+		size_t length;
+};
@@ -0,0 +1,113 @@
+#include "EnrichableResponseCache.h"
+
+EnrichableResponseCache::EnrichableResponseCache(U32 _capacity):
+	capacity(_capacity)
+{
+}
+
+EnrichableResponseCache::~EnrichableResponseCache()
+{
+}
+
+bool EnrichableResponseCache::Get(RequestKind kind, U64 frameIndex, std::vector<std::string>& response, bool* prefetched) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	std::unordered_map<U64, std::list<Entry>::iterator>::iterator found = index.find(
+		GetKey(kind, frameIndex)
+	);
+	if(found == index.end()) {
+		misses++;
+		return false;
+	}
+
+	entries.splice(entries.begin(), entries, found->second);
+	response = found->second->response;
+	if(prefetched != NULL) {
+		*prefetched = found->second->prefetched;
+	}
+	found->second->prefetched = false;
+	hits++;
+
+	return true;
+}
+
+bool EnrichableResponseCache::Contains(RequestKind kind, U64 frameIndex) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	return index.find(GetKey(kind, frameIndex)) != index.end();
+}
+
+void EnrichableResponseCache::Put(RequestKind kind, U64 frameIndex, const std::vector<std::string>& response, bool prefetched) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	if(capacity == 0) {
+		return;
+	}
+
+	U64 key = GetKey(kind, frameIndex);
+	std::unordered_map<U64, std::list<Entry>::iterator>::iterator found = index.find(key);
+	if(found != index.end()) {
+		found->second->response = response;
+		found->second->prefetched = prefetched;
+		entries.splice(entries.begin(), entries, found->second);
+		return;
+	}
+
+	Entry entry;
+	entry.key = key;
+	entry.response = response;
+	entry.prefetched = prefetched;
+	entries.push_front(entry);
+	index[key] = entries.begin();
+	Evict();
+}
+
+void EnrichableResponseCache::Clear() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	entries.clear();
+	index.clear();
+}
+
+void EnrichableResponseCache::SetCapacity(U32 _capacity) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	capacity = _capacity;
+	Evict();
+}
+
+U32 EnrichableResponseCache::GetCapacity() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	return capacity;
+}
+
+U32 EnrichableResponseCache::GetSize() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	return index.size();
+}
+
+U64 EnrichableResponseCache::GetHits() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	return hits;
+}
+
+U64 EnrichableResponseCache::GetMisses() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	return misses;
+}
+
+U64 EnrichableResponseCache::GetKey(RequestKind kind, U64 frameIndex) {
+	return (frameIndex << 1) | (U64)kind;
+}
+
+void EnrichableResponseCache::Evict() {
+	// Must be called with the cache lock held.
+	while(index.size() > capacity) {
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
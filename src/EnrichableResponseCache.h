@@ -0,0 +1,51 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include <vector>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+// Bounded least-recently-used cache of enrichment responses, keyed by
+// frame index and the kind of request that produced them.
+class EnrichableResponseCache {
+	public:
+		enum RequestKind {
+			Bubble = 0,
+			Tabular = 1
+		};
+
+		EnrichableResponseCache(U32 capacity);
+		virtual ~EnrichableResponseCache();
+
+		bool Get(RequestKind kind, U64 frameIndex, std::vector<std::string>& response, bool* prefetched = NULL);
+		void Put(RequestKind kind, U64 frameIndex, const std::vector<std::string>& response, bool prefetched = false);
+		bool Contains(RequestKind kind, U64 frameIndex);
+		void Clear();
+
+		void SetCapacity(U32 capacity);
+		U32 GetCapacity();
+		U32 GetSize();
+		U64 GetHits();
+		U64 GetMisses();
+	protected:
+		struct Entry {
+			U64 key;
+			std::vector<std::string> response;
+			// Fetched ahead of time and not yet asked for
+			bool prefetched;
+		};
+
+		static U64 GetKey(RequestKind kind, U64 frameIndex);
+		void Evict();
+
+		U32 capacity;
+		U64 hits = 0;
+		U64 misses = 0;
+
+		// Most recently used entries are at the front of the list.
+		std::list<Entry> entries;
+		std::unordered_map<U64, std::list<Entry>::iterator> index;
+		std::mutex cacheLock;
+};
@@ -0,0 +1,325 @@
+#include "EnrichableSharedTransport.h"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <new>
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+EnrichableSharedTransport::EnrichableSharedTransport()
+{
+	// With a single hardware thread, spinning only delays the script.
+	if(std::thread::hardware_concurrency() == 1) {
+		spinLimit[WaitReadable] = 0;
+		spinLimit[WaitWritable] = 0;
+		spinMaximum = 0;
+	}
+}
+
+EnrichableSharedTransport::~EnrichableSharedTransport()
+{
+	Destroy();
+}
+
+bool EnrichableSharedTransport::Create() {
+#ifdef __linux__
+	Destroy();
+
+	memoryFd = MoveAboveChildDescriptors(memfd_create("enrichable-shm", MFD_CLOEXEC));
+	requestEventFd = MoveAboveChildDescriptors(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	replyEventFd = MoveAboveChildDescriptors(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	if(memoryFd < 0 || requestEventFd < 0 || replyEventFd < 0) {
+		std::cerr << "Failed to create shared memory transport: ";
+		std::cerr << errno;
+		std::cerr << "\n";
+		Destroy();
+		return false;
+	}
+
+	regionLength = SHARED_REQUEST_RING_OFFSET + 2 * (SHARED_RING_HEADER_SIZE + SHARED_RING_SIZE);
+	if(ftruncate(memoryFd, regionLength) < 0) {
+		std::cerr << "Failed to size shared memory transport: ";
+		std::cerr << errno;
+		std::cerr << "\n";
+		Destroy();
+		return false;
+	}
+	void* mapped = mmap(NULL, regionLength, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+	if(mapped == MAP_FAILED) {
+		std::cerr << "Failed to map shared memory transport: ";
+		std::cerr << errno;
+		std::cerr << "\n";
+		regionLength = 0;
+		Destroy();
+		return false;
+	}
+	region = (char*)mapped;
+
+	U32 header[3] = {SHARED_TRANSPORT_MAGIC, SHARED_TRANSPORT_VERSION, SHARED_RING_SIZE};
+	memcpy(region, header, sizeof(header));
+	parentWaiting = new(region + SHARED_PARENT_WAITING_OFFSET) std::atomic<U32>(0);
+	childWaiting = new(region + SHARED_CHILD_WAITING_OFFSET) std::atomic<U32>(0);
+	AttachRing(request, SHARED_REQUEST_RING_OFFSET);
+	AttachRing(reply, SHARED_REQUEST_RING_OFFSET + SHARED_RING_HEADER_SIZE + SHARED_RING_SIZE);
+
+	return true;
+#else
+	std::cerr << "Shared memory transport is only supported on Linux.\n";
+	return false;
+#endif
+}
+
+void EnrichableSharedTransport::Destroy() {
+	if(region != NULL) {
+		munmap(region, regionLength);
+		region = NULL;
+		regionLength = 0;
+	}
+	if(memoryFd >= 0) {
+		close(memoryFd);
+		memoryFd = -1;
+	}
+	if(requestEventFd >= 0) {
+		close(requestEventFd);
+		requestEventFd = -1;
+	}
+	if(replyEventFd >= 0) {
+		close(replyEventFd);
+		replyEventFd = -1;
+	}
+	parentWaiting = NULL;
+	childWaiting = NULL;
+}
+
+int EnrichableSharedTransport::MoveAboveChildDescriptors(int fd) {
+	if(fd < 0 || fd >= SHARED_CHILD_FD_END) {
+		return fd;
+	}
+	int moved = fcntl(fd, F_DUPFD_CLOEXEC, SHARED_CHILD_FD_END);
+	int error = errno;
+	close(fd);
+	errno = error;
+	return moved;
+}
+
+std::string EnrichableSharedTransport::GetEnvironment() {
+	std::stringstream environment;
+	environment << SHARED_CHILD_MEMORY_FD << "," << SHARED_CHILD_REQUEST_FD << "," << SHARED_CHILD_REPLY_FD << "," << SHARED_RING_SIZE;
+	return environment.str();
+}
+
+void EnrichableSharedTransport::AddChildFileActions(posix_spawn_file_actions_t* actions) {
+	// dup2 clears close-on-exec on the copy only.
+	posix_spawn_file_actions_adddup2(actions, memoryFd, SHARED_CHILD_MEMORY_FD);
+	posix_spawn_file_actions_adddup2(actions, requestEventFd, SHARED_CHILD_REQUEST_FD);
+	posix_spawn_file_actions_adddup2(actions, replyEventFd, SHARED_CHILD_REPLY_FD);
+}
+
+void EnrichableSharedTransport::CloseChildDescriptors() {
+	// Our mapping keeps the memory alive; only the script needs the fd.
+	if(memoryFd >= 0) {
+		close(memoryFd);
+		memoryFd = -1;
+	}
+}
+
+void EnrichableSharedTransport::AttachRing(Ring& ring, size_t offset) {
+	ring.head = new(region + offset) std::atomic<U64>(0);
+	ring.tail = new(region + offset + 64) std::atomic<U64>(0);
+	ring.data = region + offset + SHARED_RING_HEADER_SIZE;
+}
+
+size_t EnrichableSharedTransport::Write(const char* buffer, size_t length) {
+	U64 head = request.head->load(std::memory_order_relaxed);
+	U64 tail = request.tail->load(std::memory_order_acquire);
+	size_t count = SHARED_RING_SIZE - (head - tail);
+	if(count > length) {
+		count = length;
+	}
+	if(count == 0) {
+		return 0;
+	}
+
+	size_t offset = head & (SHARED_RING_SIZE - 1);
+	size_t first = SHARED_RING_SIZE - offset < count ? SHARED_RING_SIZE - offset : count;
+	memcpy(request.data + offset, buffer, first);
+	memcpy(request.data, buffer + first, count - first);
+	request.head->store(head + count, std::memory_order_release);
+	WakeChild();
+
+	return count;
+}
+
+size_t EnrichableSharedTransport::Read(char* buffer, size_t length) {
+	U64 head = reply.head->load(std::memory_order_acquire);
+	U64 tail = reply.tail->load(std::memory_order_relaxed);
+	size_t count = head - tail;
+	if(count > length) {
+		count = length;
+	}
+	if(count == 0) {
+		return 0;
+	}
+
+	size_t offset = tail & (SHARED_RING_SIZE - 1);
+	size_t first = SHARED_RING_SIZE - offset < count ? SHARED_RING_SIZE - offset : count;
+	memcpy(buffer, reply.data + offset, first);
+	memcpy(buffer + first, reply.data, count - first);
+	reply.tail->store(tail + count, std::memory_order_release);
+
+	// The script may be waiting for room to write more replies.
+	WakeChild();
+
+	return count;
+}
+
+bool EnrichableSharedTransport::Readable() {
+	return reply.head->load(std::memory_order_acquire) != reply.tail->load(std::memory_order_relaxed);
+}
+
+bool EnrichableSharedTransport::Writable() {
+	return request.head->load(std::memory_order_relaxed) - request.tail->load(std::memory_order_acquire) < SHARED_RING_SIZE;
+}
+
+void EnrichableSharedTransport::SetConcurrentReader(bool concurrent) {
+	concurrentReader = concurrent;
+}
+
+bool EnrichableSharedTransport::Ready(WaitReason reason) {
+	// While waiting for room, replies must still be drained or a script
+	// blocked on a full reply ring would never consume our requests;
+	// unless another thread is draining them.
+	if(reason == WaitWritable) {
+		return Writable() || (!concurrentReader && Readable());
+	}
+	return Readable();
+}
+
+void EnrichableSharedTransport::SetWaiting(WaitReason reason, bool waiting) {
+	std::lock_guard<std::mutex> guard(waitingLock);
+	if(waiting) {
+		waitingReasons |= 1u << reason;
+	} else {
+		waitingReasons &= ~(1u << reason);
+	}
+	parentWaiting->store(waitingReasons != 0, std::memory_order_seq_cst);
+}
+
+void EnrichableSharedTransport::WakeChild() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(childWaiting->load(std::memory_order_relaxed)) {
+		U64 one = 1;
+		if(write(requestEventFd, &one, sizeof(one)) < 0) {
+			// The counter is already non-zero; the script will wake anyway.
+		}
+	}
+}
+
+bool EnrichableSharedTransport::Wait(WaitReason reason, int timeoutMs, int hangupFd) {
+	if(Ready(reason) || timeoutMs == 0) {
+		return true;
+	}
+
+	// A busy script usually answers within a few microseconds, so spin
+	// first; the spin is lengthened while that keeps paying off and
+	// shortened while it does not.
+	U32& spin = spinLimit[reason];
+	for(U32 i = 0; i < spin; i++) {
+		if(Ready(reason)) {
+			if(spin < spinMaximum) {
+				spin *= 2;
+			}
+			return true;
+		}
+		std::this_thread::yield();
+	}
+	if(spin > SHARED_SPIN_MINIMUM) {
+		spin /= 2;
+	}
+
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	while(true) {
+		SetWaiting(reason, true);
+		if(Ready(reason)) {
+			SetWaiting(reason, false);
+			return true;
+		}
+
+		int sliceMs = SHARED_WAIT_SLICE_MS;
+		if(timeoutMs > 0) {
+			int remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()
+			).count();
+			if(remainingMs <= 0) {
+				SetWaiting(reason, false);
+				return true;
+			}
+			if(remainingMs < sliceMs) {
+				sliceMs = remainingMs;
+			}
+		}
+
+		struct pollfd fds[2];
+		fds[0].fd = replyEventFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = hangupFd;
+		fds[1].events = POLLIN;
+		int ready = poll(fds, 2, sliceMs);
+		SetWaiting(reason, false);
+		if(ready < 0 && errno != EINTR) {
+			return false;
+		}
+
+		bool woken = false;
+		if(ready > 0 && (fds[0].revents & POLLIN)) {
+			U64 count;
+			woken = read(replyEventFd, &count, sizeof(count)) == sizeof(count);
+		}
+		if(Ready(reason)) {
+			// Both waiters share the eventfd; the wakeup taken here may
+			// have been meant for the other too.
+			if(woken) {
+				std::lock_guard<std::mutex> guard(waitingLock);
+				if(waitingReasons != 0) {
+					U64 one = 1;
+					if(write(replyEventFd, &one, sizeof(one)) < 0) {
+						// Already signalled.
+					}
+				}
+			}
+			return true;
+		}
+		if(ready > 0 && (fds[1].revents & (POLLIN | POLLHUP)) && !DrainDescriptor(hangupFd)) {
+			return Ready(reason);
+		}
+	}
+}
+
+bool EnrichableSharedTransport::DrainDescriptor(int hangupFd) {
+	// The script's stdout stays connected so that we notice it exiting;
+	// anything it still prints there is not part of the protocol.
+	char discard[4096];
+	ssize_t count = read(hangupFd, discard, sizeof(discard));
+	if(count < 0 && errno == EINTR) {
+		return true;
+	}
+	if(count <= 0) {
+		return false;
+	}
+
+	std::cerr << "Ignoring " << count << " bytes written to stdout by ";
+	std::cerr << "the analyzer subprocess while using shared memory.\n";
+	return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include <string>
+#include <atomic>
+#include <mutex>
+
+#include <spawn.h>
+
+#define SHARED_TRANSPORT_ENVIRONMENT "ENRICHABLE_SHM"
+#define SHARED_TRANSPORT_MAGIC 0x4D485345  // "ESHM"
+#define SHARED_TRANSPORT_VERSION 1
+
+// Bytes of each ring; must be a power of two
+#define SHARED_RING_SIZE 1048576
+
+// Offsets within the shared region
+#define SHARED_PARENT_WAITING_OFFSET 64
+#define SHARED_CHILD_WAITING_OFFSET 128
+#define SHARED_REQUEST_RING_OFFSET 192
+#define SHARED_RING_HEADER_SIZE 128
+
+// Where the script finds the memfd and the request and reply eventfds;
+// ours are kept above these, so that moving them there cannot overwrite
+// one not yet moved.
+#define SHARED_CHILD_MEMORY_FD 3
+#define SHARED_CHILD_REQUEST_FD 4
+#define SHARED_CHILD_REPLY_FD 5
+#define SHARED_CHILD_FD_END 6
+
+// Longest single sleep while waiting on the other side; bounds the cost
+// of a wakeup lost by a script that cannot issue memory fences.
+#define SHARED_WAIT_SLICE_MS 10
+
+// Spin iterations before sleeping, adapted between these bounds
+#define SHARED_SPIN_MINIMUM 16
+#define SHARED_SPIN_MAXIMUM 16384
+
+// A pair of single-producer, single-consumer byte rings in a memfd
+// shared with the script: requests flow from us to the script through
+// one, replies flow back through the other.  The region is laid out as
+//
+//      0: U32 magic, U32 version, U32 ring size
+//     64: U32 set while we are waiting for the script
+//    128: U32 set while the script is waiting for us
+//    192: request ring
+//    192 + 128 + ring size: reply ring
+//
+// where each ring is a U64 head (bytes ever written) at +0, a U64 tail
+// (bytes ever read) at +64, and its data at +128, all little-endian.
+// Whichever side advances a ring checks the other side's waiting flag
+// afterwards and, if set, wakes it through its eventfd.
+//
+// Linux only; Create() fails elsewhere and the pipes are used instead.
+class EnrichableSharedTransport {
+	public:
+		enum WaitReason {
+			WaitReadable,
+			WaitWritable
+		};
+
+		EnrichableSharedTransport();
+		virtual ~EnrichableSharedTransport();
+
+		bool Create();
+		void Destroy();
+
+		// "memfd,request eventfd,reply eventfd,ring size", for the
+		// script's environment.
+		std::string GetEnvironment();
+		// Our descriptors are closed on exec, so that no other child
+		// holds them; these actions give the script its own copies at
+		// the numbers GetEnvironment names.  Added after stdin and
+		// stdout are set up.
+		void AddChildFileActions(posix_spawn_file_actions_t* actions);
+		void CloseChildDescriptors();
+
+		size_t Write(const char* buffer, size_t length);
+		size_t Read(char* buffer, size_t length);
+		bool Readable();
+		bool Writable();
+
+		// Set while another thread reads the replies; a wait for room
+		// then no longer returns for replies that are that thread's to
+		// take.
+		void SetConcurrentReader(bool concurrent);
+
+		// Returns once the script has made the progress we are waiting
+		// for, timeoutMs has passed, or hangupFd has hung up; returns
+		// false only in the latter case.  One thread may wait for each
+		// reason at once.
+		bool Wait(WaitReason reason, int timeoutMs, int hangupFd);
+	protected:
+		struct Ring {
+			std::atomic<U64>* head;
+			std::atomic<U64>* tail;
+			char* data;
+		};
+
+		static int MoveAboveChildDescriptors(int fd);
+		void AttachRing(Ring& ring, size_t offset);
+		bool Ready(WaitReason reason);
+		void SetWaiting(WaitReason reason, bool waiting);
+		void WakeChild();
+		bool DrainDescriptor(int hangupFd);
+
+		int memoryFd = -1;
+		int requestEventFd = -1;
+		int replyEventFd = -1;
+		char* region = NULL;
+		size_t regionLength = 0;
+
+		Ring request;
+		Ring reply;
+		std::atomic<U32>* parentWaiting = NULL;
+		std::atomic<U32>* childWaiting = NULL;
+
+		std::atomic<bool> concurrentReader{false};
+
+		// The script sees one waiting flag, set while either reason has a
+		// waiter; the reasons waited for are kept here, under the lock,
+		// so that one waiter finishing does not clear it for the other.
+		std::mutex waitingLock;
+		U32 waitingReasons = 0;
+
+		// Each reason's spin is adapted separately, by its own waiter.
+		U32 spinLimit[2] = {SHARED_SPIN_MINIMUM, SHARED_SPIN_MINIMUM};
+		U32 spinMaximum = SHARED_SPIN_MAXIMUM;
+};
@@ -0,0 +1,181 @@
+#include "EnrichableSubprocessStatistics.h"
+
+EnrichableLatencyHistogram::EnrichableLatencyHistogram()
+{
+	Reset();
+}
+
+EnrichableLatencyHistogram::~EnrichableLatencyHistogram()
+{
+}
+
+void EnrichableLatencyHistogram::Record(U64 microseconds) {
+	buckets[GetBucket(microseconds)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+
+	U64 previous = maximum.load(std::memory_order_relaxed);
+	while(microseconds > previous &&
+		!maximum.compare_exchange_weak(previous, microseconds, std::memory_order_relaxed)) {
+	}
+}
+
+void EnrichableLatencyHistogram::Reset() {
+	for(U32 i = 0; i < LATENCY_BUCKETS; i++) {
+		buckets[i].store(0, std::memory_order_relaxed);
+	}
+	count.store(0, std::memory_order_relaxed);
+	maximum.store(0, std::memory_order_relaxed);
+}
+
+U64 EnrichableLatencyHistogram::GetCount() {
+	return count.load(std::memory_order_relaxed);
+}
+
+U64 EnrichableLatencyHistogram::GetMaximum() {
+	return maximum.load(std::memory_order_relaxed);
+}
+
+U64 EnrichableLatencyHistogram::GetPercentile(double fraction) {
+	// Samples may still be arriving; work from one pass over the buckets
+	// rather than trusting the separately-kept count.
+	U64 counts[LATENCY_BUCKETS];
+	U64 total = 0;
+	for(U32 i = 0; i < LATENCY_BUCKETS; i++) {
+		counts[i] = buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+	if(total == 0) {
+		return 0;
+	}
+
+	// The sample at this rank, rounding up, is the percentile.
+	U64 target = (U64)(fraction * total);
+	if(target < fraction * total || target == 0) {
+		target++;
+	}
+	U64 seen = 0;
+	for(U32 i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += counts[i];
+		if(seen >= target) {
+			U64 limit = GetBucketLimit(i);
+			U64 maximumSeen = GetMaximum();
+			return limit < maximumSeen ? limit : maximumSeen;
+		}
+	}
+
+	return GetMaximum();
+}
+
+U32 EnrichableLatencyHistogram::GetBucket(U64 microseconds) {
+	// Values below LATENCY_SUB_BUCKETS each get their own bucket; above
+	// that, the top bits below the leading one pick the sub-bucket.
+	if(microseconds < LATENCY_SUB_BUCKETS) {
+		return (U32)microseconds;
+	}
+
+	U32 exponent = 0;
+	for(U64 value = microseconds; value > 1; value >>= 1) {
+		exponent++;
+	}
+	U32 shift = exponent - 3;
+	U32 subBucket = (U32)(microseconds >> shift) & (LATENCY_SUB_BUCKETS - 1);
+
+	return (exponent - 2) * LATENCY_SUB_BUCKETS + subBucket;
+}
+
+U64 EnrichableLatencyHistogram::GetBucketLimit(U32 bucket) {
+	if(bucket < LATENCY_SUB_BUCKETS) {
+		return bucket;
+	}
+
+	U32 shift = bucket / LATENCY_SUB_BUCKETS - 1;
+	U64 subBucket = bucket % LATENCY_SUB_BUCKETS;
+
+	return ((LATENCY_SUB_BUCKETS + subBucket + 1) << shift) - 1;
+}
+
+EnrichableSubprocessStatistics::EnrichableSubprocessStatistics()
+{
+	Reset();
+}
+
+EnrichableSubprocessStatistics::~EnrichableSubprocessStatistics()
+{
+}
+
+void EnrichableSubprocessStatistics::Reset() {
+	for(U32 i = 0; i < STATISTICS_MESSAGE_TYPES; i++) {
+		messages[i].requests.store(0, std::memory_order_relaxed);
+		messages[i].cached.store(0, std::memory_order_relaxed);
+		messages[i].late.store(0, std::memory_order_relaxed);
+		messages[i].latency.Reset();
+	}
+	protocolErrors.store(0, std::memory_order_relaxed);
+	scriptExits.store(0, std::memory_order_relaxed);
+}
+
+void EnrichableSubprocessStatistics::RecordRequest(U32 messageType) {
+	messages[GetIndex(messageType)].requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EnrichableSubprocessStatistics::RecordCached(U32 messageType) {
+	messages[GetIndex(messageType)].cached.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EnrichableSubprocessStatistics::RecordLate(U32 messageType) {
+	messages[GetIndex(messageType)].late.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EnrichableSubprocessStatistics::RecordResponse(
+	U32 messageType,
+	std::chrono::steady_clock::time_point sent
+) {
+	S64 microseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - sent
+	).count();
+
+	messages[GetIndex(messageType)].latency.Record(microseconds > 0 ? microseconds : 0);
+}
+
+void EnrichableSubprocessStatistics::RecordProtocolError() {
+	protocolErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EnrichableSubprocessStatistics::RecordScriptExit() {
+	scriptExits.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EnrichableSubprocessStatistics::Dump(std::ostream& out) {
+	const char* names[STATISTICS_MESSAGE_TYPES] = {"feature", "bubble", "marker", "tabular", "packet", "transaction"};
+
+	for(U32 i = 0; i < STATISTICS_MESSAGE_TYPES; i++) {
+		MessageStatistics& message = messages[i];
+		U64 requests = message.requests.load(std::memory_order_relaxed);
+		U64 cached = message.cached.load(std::memory_order_relaxed);
+		if(requests == 0 && cached == 0) {
+			continue;
+		}
+
+		out << "Enrichment " << names[i] << " requests: ";
+		out << requests << " sent, ";
+		out << cached << " cached, ";
+		out << message.late.load(std::memory_order_relaxed) << " late";
+		if(message.latency.GetCount() > 0) {
+			out << "; round trip p50 " << message.latency.GetPercentile(0.5) << " us";
+			out << ", p99 " << message.latency.GetPercentile(0.99) << " us";
+			out << ", max " << message.latency.GetMaximum() << " us";
+		}
+		out << "\n";
+	}
+
+	U64 errors = protocolErrors.load(std::memory_order_relaxed);
+	U64 exits = scriptExits.load(std::memory_order_relaxed);
+	if(errors > 0 || exits > 0) {
+		out << "Enrichment script errors: " << errors << " invalid responses, ";
+		out << exits << " exits\n";
+	}
+}
+
+U32 EnrichableSubprocessStatistics::GetIndex(U32 messageType) {
+	return messageType < STATISTICS_MESSAGE_TYPES ? messageType : 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "LogicPublicTypes.h"
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Latency histogram resolution: each power of two of microseconds is
+// split into this many equal buckets, bounding percentile error to
+// about 12%.
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+// Message types are counted separately, indexed like the binary
+// protocol's message types; feature negotiation takes the otherwise
+// unused index 0.
+#define STATISTICS_MESSAGE_TYPES 6
+
+// Round-trip times in microseconds, recorded without locking.
+class EnrichableLatencyHistogram {
+	public:
+		EnrichableLatencyHistogram();
+		virtual ~EnrichableLatencyHistogram();
+
+		void Record(U64 microseconds);
+		void Reset();
+
+		U64 GetCount();
+		U64 GetMaximum();
+		// Upper bound of the bucket holding the given fraction of samples.
+		U64 GetPercentile(double fraction);
+	protected:
+		static U32 GetBucket(U64 microseconds);
+		static U64 GetBucketLimit(U32 bucket);
+
+		std::atomic<U64> buckets[LATENCY_BUCKETS];
+		std::atomic<U64> count;
+		std::atomic<U64> maximum;
+};
+
+// Always-on counters for traffic with the enrichment script.  Everything
+// is a relaxed atomic so that both the analysis and display threads can
+// record without contending on a lock.
+class EnrichableSubprocessStatistics {
+	public:
+		EnrichableSubprocessStatistics();
+		virtual ~EnrichableSubprocessStatistics();
+
+		void Reset();
+
+		// A request written to the script
+		void RecordRequest(U32 messageType);
+		// A request answered from the memo, the persistent cache or a
+		// late response, without asking the script
+		void RecordCached(U32 messageType);
+		// A request whose deadline passed before its reply arrived
+		void RecordLate(U32 messageType);
+		// A reply fully read; sent is when its request was written
+		void RecordResponse(U32 messageType, std::chrono::steady_clock::time_point sent);
+		void RecordProtocolError();
+		void RecordScriptExit();
+
+		void Dump(std::ostream& out);
+	protected:
+		struct MessageStatistics {
+			std::atomic<U64> requests;
+			std::atomic<U64> cached;
+			std::atomic<U64> late;
+			EnrichableLatencyHistogram latency;
+		};
+
+		static U32 GetIndex(U32 messageType);
+
+		MessageStatistics messages[STATISTICS_MESSAGE_TYPES];
+		std::atomic<U64> protocolErrors;
+		std::atomic<U64> scriptExits;
+};
@@ -0,0 +1,263 @@
+#include "EnrichableTransitionExtractor.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRANSITION_EXTRACTOR_X86
+#include <immintrin.h>
+#endif
+
+// Appends the sample of every set bit in a word of differences.
+static inline size_t ExtractBits(uint64_t difference, uint64_t firstSample, uint64_t* out, size_t count) {
+	while(difference) {
+		out[count++] = firstSample + __builtin_ctzll(difference);
+		difference &= difference - 1;
+	}
+	return count;
+}
+
+static inline uint64_t Difference(uint64_t word, uint64_t previous) {
+	return word ^ ((word << 1) | (previous >> (TRANSITION_EXTRACTOR_WORD_BITS - 1)));
+}
+
+// Each kernel scans words [first, end) and appends the sample of every
+// transition in them to out, which must have room for one per sample.
+// previous is the word before first, or one whose top bit is the first
+// sample when first is 0.
+static size_t ScanScalar(const uint64_t* words, uint64_t first, uint64_t end, uint64_t previous, uint64_t* out) {
+	size_t count = 0;
+	for(uint64_t i = first; i < end; i++) {
+		uint64_t word = words[i];
+		count = ExtractBits(Difference(word, previous), i * TRANSITION_EXTRACTOR_WORD_BITS, out, count);
+		previous = word;
+	}
+	return count;
+}
+
+#ifdef TRANSITION_EXTRACTOR_X86
+__attribute__((target("sse2")))
+static size_t ScanSse2(const uint64_t* words, uint64_t first, uint64_t end, uint64_t previous, uint64_t* out) {
+	if(first == end) {
+		return 0;
+	}
+	// The first word's predecessor may not be in memory, so it is done
+	// alone; after it, the word before each pair is loaded with it.
+	size_t count = ExtractBits(Difference(words[first], previous), first * TRANSITION_EXTRACTOR_WORD_BITS, out, 0);
+	uint64_t i = first + 1;
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + 2 <= end; i += 2) {
+		__m128i word = _mm_loadu_si128((const __m128i*)(words + i));
+		__m128i before = _mm_loadu_si128((const __m128i*)(words + i - 1));
+		__m128i difference = _mm_xor_si128(word, _mm_or_si128(_mm_slli_epi64(word, 1), _mm_srli_epi64(before, 63)));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(difference, zero)) == 0xFFFF) {
+			continue;
+		}
+		uint64_t lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, difference);
+		count = ExtractBits(lanes[0], i * TRANSITION_EXTRACTOR_WORD_BITS, out, count);
+		count = ExtractBits(lanes[1], (i + 1) * TRANSITION_EXTRACTOR_WORD_BITS, out, count);
+	}
+	return count + ScanScalar(words, i, end, words[i - 1], out + count);
+}
+
+__attribute__((target("avx2")))
+static size_t ScanAvx2(const uint64_t* words, uint64_t first, uint64_t end, uint64_t previous, uint64_t* out) {
+	if(first == end) {
+		return 0;
+	}
+	size_t count = ExtractBits(Difference(words[first], previous), first * TRANSITION_EXTRACTOR_WORD_BITS, out, 0);
+	uint64_t i = first + 1;
+	for(; i + 4 <= end; i += 4) {
+		__m256i word = _mm256_loadu_si256((const __m256i*)(words + i));
+		__m256i before = _mm256_loadu_si256((const __m256i*)(words + i - 1));
+		__m256i difference = _mm256_xor_si256(word, _mm256_or_si256(_mm256_slli_epi64(word, 1), _mm256_srli_epi64(before, 63)));
+		if(_mm256_testz_si256(difference, difference)) {
+			continue;
+		}
+		uint64_t lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, difference);
+		for(uint64_t lane = 0; lane < 4; lane++) {
+			count = ExtractBits(lanes[lane], (i + lane) * TRANSITION_EXTRACTOR_WORD_BITS, out, count);
+		}
+	}
+	return count + ScanScalar(words, i, end, words[i - 1], out + count);
+}
+#endif
+
+EnrichableTransitionExtractor::EnrichableTransitionExtractor()
+{
+	capture.words = NULL;
+	capture.sampleCount = 0;
+	capture.channelCount = 0;
+	minimumPulse = 1;
+	nextWord = 0;
+	horizon = 0;
+	kernel = DetectKernel();
+}
+
+EnrichableTransitionExtractor::~EnrichableTransitionExtractor()
+{
+}
+
+uint64_t EnrichableTransitionExtractor::WordsPerChannel(uint64_t sampleCount) {
+	return (sampleCount + TRANSITION_EXTRACTOR_WORD_BITS - 1) / TRANSITION_EXTRACTOR_WORD_BITS;
+}
+
+EnrichableTransitionExtractor::Kernel EnrichableTransitionExtractor::DetectKernel() {
+#ifdef TRANSITION_EXTRACTOR_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		return KernelAvx2;
+	}
+	if(__builtin_cpu_supports("sse2")) {
+		return KernelSse2;
+	}
+#endif
+	return KernelScalar;
+}
+
+const char* EnrichableTransitionExtractor::KernelName(Kernel kernel) {
+	switch(kernel) {
+		case KernelSse2:
+			return "sse2";
+		case KernelAvx2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+bool EnrichableTransitionExtractor::Reset(const EnrichablePackedCapture& _capture, const uint32_t* selected, size_t selectedCount, uint64_t _minimumPulse) {
+	capture = _capture;
+	minimumPulse = _minimumPulse > 1 ? _minimumPulse : 1;
+	nextWord = 0;
+	horizon = 0;
+	channels.clear();
+
+	uint64_t wordsPerChannel = WordsPerChannel(capture.sampleCount);
+	channels.resize(selectedCount);
+	for(size_t i = 0; i < selectedCount; i++) {
+		if(selected[i] >= capture.channelCount) {
+			channels.clear();
+			return false;
+		}
+		Channel& channel = channels[i];
+		channel.words = capture.words + selected[i] * wordsPerChannel;
+		channel.initialLevel = wordsPerChannel > 0 && (channel.words[0] & 1);
+		// No transition at the first sample
+		channel.carry = channel.initialLevel ? (uint64_t(1) << (TRANSITION_EXTRACTOR_WORD_BITS - 1)) : 0;
+		channel.pending = false;
+		channel.pendingSample = 0;
+		channel.transitions.clear();
+	}
+	return true;
+}
+
+void EnrichableTransitionExtractor::SetKernel(Kernel _kernel) {
+	kernel = _kernel <= DetectKernel() ? _kernel : DetectKernel();
+}
+
+EnrichableTransitionExtractor::Kernel EnrichableTransitionExtractor::GetKernel() const {
+	return kernel;
+}
+
+bool EnrichableTransitionExtractor::InitialLevel(size_t index) const {
+	return channels[index].initialLevel;
+}
+
+bool EnrichableTransitionExtractor::Next() {
+	uint64_t wordsPerChannel = WordsPerChannel(capture.sampleCount);
+	if(nextWord >= wordsPerChannel) {
+		return false;
+	}
+
+	uint64_t endWord = nextWord + TRANSITION_EXTRACTOR_WINDOW_WORDS;
+	if(endWord > wordsPerChannel) {
+		endWord = wordsPerChannel;
+	}
+	bool last = endWord == wordsPerChannel;
+	uint64_t endSample = last ? capture.sampleCount : endWord * TRANSITION_EXTRACTOR_WORD_BITS;
+
+	for(size_t i = 0; i < channels.size(); i++) {
+		Channel& channel = channels[i];
+		channel.transitions.clear();
+		if(minimumPulse > 1) {
+			Scan(channel, nextWord, endWord, raw);
+			Filter(channel, endSample);
+		} else {
+			Scan(channel, nextWord, endWord, channel.transitions);
+		}
+	}
+
+	nextWord = endWord;
+	if(last) {
+		horizon = capture.sampleCount;
+	} else {
+		horizon = endSample > minimumPulse ? endSample - minimumPulse : 0;
+	}
+	return true;
+}
+
+uint64_t EnrichableTransitionExtractor::Horizon() const {
+	return horizon;
+}
+
+const std::vector<uint64_t>& EnrichableTransitionExtractor::Transitions(size_t index) const {
+	return channels[index].transitions;
+}
+
+void EnrichableTransitionExtractor::GetI2cTransitions(size_t scl, size_t sda, EnrichableI2cTransitions& input) const {
+	input.scl = channels[scl].transitions.data();
+	input.sclCount = channels[scl].transitions.size();
+	input.sda = channels[sda].transitions.data();
+	input.sdaCount = channels[sda].transitions.size();
+}
+
+void EnrichableTransitionExtractor::Scan(Channel& channel, uint64_t firstWord, uint64_t endWord, std::vector<uint64_t>& out) {
+	out.resize((endWord - firstWord) * TRANSITION_EXTRACTOR_WORD_BITS);
+
+	size_t count;
+	switch(kernel) {
+#ifdef TRANSITION_EXTRACTOR_X86
+		case KernelAvx2:
+			count = ScanAvx2(channel.words, firstWord, endWord, channel.carry, out.data());
+			break;
+		case KernelSse2:
+			count = ScanSse2(channel.words, firstWord, endWord, channel.carry, out.data());
+			break;
+#endif
+		default:
+			count = ScanScalar(channel.words, firstWord, endWord, channel.carry, out.data());
+			break;
+	}
+	channel.carry = channel.words[endWord - 1];
+
+	// The padding after the last sample is not part of the capture.
+	while(count > 0 && out[count - 1] >= capture.sampleCount) {
+		count--;
+	}
+	out.resize(count);
+}
+
+void EnrichableTransitionExtractor::Filter(Channel& channel, uint64_t endSample) {
+	// A transition is kept once the line has held its new level for the
+	// minimum width; one followed sooner by another is a glitch, and both
+	// are dropped.
+	for(size_t i = 0; i < raw.size(); i++) {
+		uint64_t sample = raw[i];
+		if(channel.pending) {
+			if(sample - channel.pendingSample < minimumPulse) {
+				channel.pending = false;
+				continue;
+			}
+			channel.transitions.push_back(channel.pendingSample);
+		}
+		channel.pending = true;
+		channel.pendingSample = sample;
+	}
+
+	// Anything still pending at the end of the capture never lasted the
+	// minimum width.
+	if(channel.pending && channel.pendingSample + minimumPulse <= endSample) {
+		channel.transitions.push_back(channel.pendingSample);
+		channel.pending = false;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "EnrichableI2cDecoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Samples scanned for each selected channel per call to Next
+#define TRANSITION_EXTRACTOR_WINDOW_WORDS 4096
+#define TRANSITION_EXTRACTOR_WORD_BITS 64
+
+// A raw capture packed one bit per sample per channel.  Each channel's
+// samples are a stream of 64-bit words, least significant bit first,
+// padded to a whole word; channel c's stream follows channel c - 1's.
+struct EnrichablePackedCapture {
+	const uint64_t* words;
+	uint64_t sampleCount;
+	uint32_t channelCount;
+};
+
+// Finds every transition in selected channels of a packed capture.
+// Each word is XORed with itself shifted by one sample, carrying the
+// last sample of the word before, so that every set bit marks a sample
+// that differs from the one before it.  The fastest kernel the CPU
+// supports is picked at runtime.
+//
+// Pulses shorter than the minimum width are dropped along with the
+// transition that ended them, so a glitch leaves the line's level as it
+// was.
+class EnrichableTransitionExtractor {
+	public:
+		enum Kernel {
+			KernelScalar,
+			KernelSse2,
+			KernelAvx2
+		};
+
+		EnrichableTransitionExtractor();
+		virtual ~EnrichableTransitionExtractor();
+
+		static uint64_t WordsPerChannel(uint64_t sampleCount);
+		static Kernel DetectKernel();
+		static const char* KernelName(Kernel kernel);
+
+		// Starts over on the given channels, in the order given; false if
+		// one is not in the capture.  Pulses of fewer than minimumPulse
+		// samples are filtered out.
+		bool Reset(const EnrichablePackedCapture& capture, const uint32_t* channels, size_t channelCount, uint64_t minimumPulse);
+		// Overrides the detected kernel; one the CPU lacks falls back.
+		void SetKernel(Kernel kernel);
+		Kernel GetKernel() const;
+
+		// The level of a selected channel's first sample.
+		bool InitialLevel(size_t index) const;
+		// Replaces each selected channel's transitions with those of the
+		// next window of samples; false once the capture is exhausted.
+		bool Next();
+		// Every transition up to and including this sample, on every
+		// selected channel, has been extracted by the last Next, and none
+		// after it.
+		uint64_t Horizon() const;
+		const std::vector<uint64_t>& Transitions(size_t index) const;
+		// Points the decoder's input at two selected channels' transitions.
+		void GetI2cTransitions(size_t scl, size_t sda, EnrichableI2cTransitions& input) const;
+	protected:
+		struct Channel {
+			const uint64_t* words;
+			bool initialLevel;
+			// The last sample of the word before the next one scanned
+			uint64_t carry;
+			// A transition that may yet turn out to start a glitch
+			bool pending;
+			uint64_t pendingSample;
+			std::vector<uint64_t> transitions;
+		};
+
+		void Scan(Channel& channel, uint64_t firstWord, uint64_t endWord, std::vector<uint64_t>& out);
+		void Filter(Channel& channel, uint64_t endSample);
+
+		EnrichablePackedCapture capture;
+		std::vector<Channel> channels;
+		uint64_t minimumPulse;
+		uint64_t nextWord;
+		uint64_t horizon;
+		Kernel kernel;
+		std::vector<uint64_t> raw;
+};
@@ -0,0 +1,90 @@
+#include "EnrichableWorkStealingPool.h"
+
+EnrichableWorkStealingPool::EnrichableWorkStealingPool(unsigned threadCount):
+	nextQueue(0),
+	queued(0),
+	stopping(false)
+{
+	if(threadCount == 0) {
+		threadCount = 1;
+	}
+	for(unsigned i = 0; i < threadCount; i++) {
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+	for(unsigned i = 0; i < threadCount; i++) {
+		threads.push_back(std::thread(&EnrichableWorkStealingPool::Run, this, i));
+	}
+}
+
+EnrichableWorkStealingPool::~EnrichableWorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		stopping = true;
+	}
+	idle.notify_all();
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+void EnrichableWorkStealingPool::Submit(std::function<void()> task) {
+	Queue& queue = *queues[nextQueue++ % queues.size()];
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		queued++;
+	}
+	idle.notify_one();
+}
+
+unsigned EnrichableWorkStealingPool::ThreadCount() const {
+	return (unsigned)threads.size();
+}
+
+void EnrichableWorkStealingPool::Run(unsigned index) {
+	std::function<void()> task;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> guard(idleLock);
+			idle.wait(guard, [this] { return queued > 0 || stopping; });
+			if(queued == 0) {
+				return;
+			}
+			// Claimed here, so that the count never promises a task that
+			// another thread has already taken.
+			queued--;
+		}
+		// A claimed task is on some queue until it is taken.
+		while(!Take(index, task)) {
+			std::this_thread::yield();
+		}
+		task();
+		task = nullptr;
+	}
+}
+
+bool EnrichableWorkStealingPool::Take(unsigned index, std::function<void()>& task) {
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if(!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+	for(size_t i = 1; i < queues.size(); i++) {
+		Queue& other = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(other.lock);
+		if(!other.tasks.empty()) {
+			task = std::move(other.tasks.front());
+			other.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads, each with its own queue of tasks.  A thread
+// runs the newest task on its own queue, and when that is empty takes
+// the oldest from another's, so that a thread left with long tasks does
+// not hold up the rest.  Tasks are spread across the queues as they are
+// submitted.
+class EnrichableWorkStealingPool {
+	public:
+		explicit EnrichableWorkStealingPool(unsigned threadCount);
+		// Runs every task already submitted before returning.
+		virtual ~EnrichableWorkStealingPool();
+
+		void Submit(std::function<void()> task);
+		unsigned ThreadCount() const;
+	protected:
+		struct Queue {
+			std::mutex lock;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		void Run(unsigned index);
+		bool Take(unsigned index, std::function<void()>& task);
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> threads;
+		std::atomic<unsigned> nextQueue;
+
+		// Idle threads sleep until a task is submitted.
+		std::mutex idleLock;
+		std::condition_variable idle;
+		size_t queued;
+		bool stopping;
+};